@@ -16,6 +16,7 @@
 #include <fcntl.h>
 #include <string.h>
 #include <stdarg.h>
+#include <pthread.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -29,6 +30,11 @@
 
 #define USENET_CMD_BUFF_SZ 1
 #define USENET_SIZE_BUFF_SZ 8
+#define USENET_MSG_HEADER_SZ (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)
+#define USENET_MSG_MAX_SZ (1024 * 1024)
+#define USENET_DECODER_INIT_SZ 1024
+#define USENET_POOL_BLOCK_SZ 256
+#define USENET_POOL_NUM_BLOCKS 16
 #define USENET_JSON_BUFF_SZ 151
 #define USENET_LOG_MESSAGE_SZ 256
 #define USENET_PROC_FILE_BUFF_SZ 512
@@ -63,13 +69,69 @@
 #define USENET_JSON_FN_4 "usenet_progress"
 #define USENET_JSON_FN_5 "usenet_done"
 
+/* opcodes of the binary broadcast payload, matches USENET_JSON_FN_1..5 */
+#define USENET_RPC_OP_COMPLETE 0x01
+#define USENET_RPC_OP_UPDATE_LIST 0x02
+#define USENET_RPC_OP_SCP_COMPLETE 0x03
+#define USENET_RPC_OP_PROGRESS 0x04
+#define USENET_RPC_OP_DONE 0x05
+
+#define USENET_RPC_MAX_OPCODE 32								/* size of the dense opcode table */
+#define USENET_RPC_NAME_TABLE_SZ 64							/* name hash table size, power of two */
+
+#define USENET_PROC_MAX_CHILDREN 16								/* children tracked by the supervisor */
+
+#define USENET_TRANSFER_DEF_BUFFER_KB 1024						/* default size of a transfer buffer */
+#define USENET_TRANSFER_DEF_DEPTH 4								/* default number of buffers read ahead */
+#define USENET_TRANSFER_MAX_DEPTH 16
+#define USENET_TRANSFER_ALIGN 4096
+#define USENET_TRANSFER_WAIT_SEC 10								/* socket wait timeout of a blocked channel */
+#define USENET_TRANSFER_MAX_IDLE 6								/* socket waits without progress before a transfer fails */
+#define USENET_TRANSFER_IDLE_SEC (USENET_TRANSFER_WAIT_SEC * USENET_TRANSFER_MAX_IDLE)
+#define USENET_TRANSFER_DEF_WORKERS 2							/* default number of concurrent transfers */
+#define USENET_TRANSFER_MAX_WORKERS 8
+#define USENET_TRANSFER_PATH_SZ 512
+#define USENET_TRANSFER_PART_SUFFIX ".part"						/* name of a segmented copy until every range landed */
+#define USENET_TRANSFER_CHECKPOINT_SZ (64 * 1024 * 1024)			/* bytes sent between checkpoints */
+#define USENET_TRANSFER_VERIFY_SZ (1024 * 1024)					/* tail of the remote prefix compared on resume */
+#define USENET_TRANSFER_MODE_SCP "scp"
+#define USENET_TRANSFER_MODE_SFTP "sftp"
+#define USENET_TRANSFER_MODE_LOCAL "local"						/* copy to a local path, for measuring the engine */
+#define USENET_TRANSFER_MODE_NULL "null"						/* drop the data, for measuring the engine */
+#define USENET_TRANSFER_AGAIN -3								/* the sink can't take data without blocking */
+#define USENET_TRANSFER_READAHEAD_SZ (8 * 1024 * 1024)			/* source read ahead when the transfer starts */
+#define USENET_TRANSFER_MAX_STREAMS 8							/* sessions writing segments of one file */
+#define USENET_TRANSFER_DEF_SEGMENT_MB 256						/* files from this size are split into segments */
+#define USENET_TRANSFER_PRIORITY_NEWEST "newest"				/* highest nzb id is copied first */
+#define USENET_TRANSFER_PRIORITY_SMALLEST "smallest"			/* smallest file is copied first */
+#define USENET_SHAPE_MAX_WINDOWS 8								/* windows of the transfer schedule */
+#define USENET_SHAPE_BURST_SEC 0.25								/* credit a bucket can build up, in seconds of its rate */
+#define USENET_SYNC_DEF_BLOCK_KB 4096							/* block compared when patching a remote copy */
+#define USENET_SSH_EXEC_BUF_SZ 4096								/* initial output buffer of a remote command */
+#define USENET_HASH_HEX_SZ 65									/* sha-256 in hex with the terminator */
+
+#define USENET_SSH_MAX_SESSIONS 32								/* sessions held by the cache */
+#define USENET_SSH_MAX_ATTEMPTS 2								/* channel open attempts before giving up */
+#define USENET_SSH_DEF_KEEPALIVE 30								/* default keepalive interval in seconds */
+#define USENET_SSH_DEF_IDLE_TIMEOUT 300							/* default idle time before a session is closed */
+#define USENET_SSH_ACQUIRE_WAIT_SEC 60							/* wait for a slot while every session is busy */
+
+#define USENET_BIN_PAYLOAD_SZ 13								/* opcode, nzb id, pid and progress */
+#define USENET_BIN_PROGRESS_SCALE 10000						/* fixed point scale of the progress */
+
 
 #define USENET_NZB_SUCCESS "SUCCESS/UNPACK"
 
+#define USENET_NZB_HISTORY_INSERT 0x01						/* id not seen by the last poll */
+#define USENET_NZB_HISTORY_UPDATE 0x02						/* status changed since the last poll */
+#define USENET_NZB_HISTORY_REMOVE 0x03						/* id no longer in the history */
+
 #define USENET_NZBGET_XMLRESPONSE_VALUE "value"
 #define USENET_NZBGET_XMLRESPONSE_ARRAY "array"
 #define USENET_NZBGET_XMLRESPONSE_MEMBER "member"
 #define USENET_NZBGET_XMLRESPONSE_NAME "name"
+#define USENET_NZBGET_TRANSPORT_XMLRPC "xmlrpc"
+#define USENET_NZBGET_TRANSPORT_JSONRPC "jsonrpc"
 
 #define USENET_CONFIG_YES "Y"
 
@@ -94,6 +156,16 @@ struct gapi_login
 	const char* log_file_path;		/* log file path */
 	const char* log_to_file;		/* flag to indicate log to file */
 	const char* scp_progress;		/* scp progress flag, a callback is called on this flag frequently */
+	const char* binary_broadcast;	/* flag to send broadcasts in the binary payload */
+	const char* spool_dir;			/* directory of request files, the request json is used if not set */
+	const char* transfer_mode;		/* scp, sftp, local or null, sftp transfers can be resumed */
+	const char* checkpoint_dir;		/* directory of the sftp transfer checkpoints */
+	const char* transfer_verify;	/* hash the sent data and check it against the remote copy */
+	const char* transfer_schedule;	/* global rate by time of day, HH:MM-HH:MM=KB,... */
+	const char* transfer_priority;	/* queue order, newest, smallest or submission order if not set */
+	const char* transfer_skip_existing;	/* skip files whose remote copy matches */
+	const char* transfer_delta;		/* patch an existing remote copy in sftp mode */
+	const char* nzbget_transport;	/* xmlrpc or jsonrpc, xmlrpc if not set */
 
 	int scan_freq;					/* frequency scan the instructions */
     int exp;						/* expiry time since unix start */
@@ -101,6 +173,17 @@ struct gapi_login
 	int svr_wait_time;				/* default server wait time */
 	int nzb_fsize_threshold;		/* file size tolerance */
 	int progress_update_interval;	/* progress update interval */
+	int scp_buffer_size;			/* size of a transfer buffer in kilobytes */
+	int scp_pipeline_depth;			/* number of transfer buffers read ahead of the channel */
+	int transfer_workers;			/* number of files copied concurrently */
+	int ssh_keepalive;				/* keepalive interval of the cached ssh sessions in seconds */
+	int ssh_idle_timeout;			/* seconds an idle ssh session is cached */
+	int transfer_streams;			/* parallel sftp streams for a large file, 1 disables segmenting */
+	int segment_threshold_mb;		/* smallest file in megabytes split into segments */
+	int transfer_rate_kb;			/* global transfer rate in KB/s outside the schedule, 0 is unlimited */
+	int transfer_file_rate_kb;		/* rate of each transfer in KB/s, 0 is unlimited */
+	int transfer_direct_mb;			/* files from this size in megabytes bypass the page cache, 0 disables */
+	int delta_block_kb;				/* block size in kilobytes compared when patching a remote copy */
 
 	config_t _config;
 };
@@ -113,6 +196,201 @@ struct usenet_message
 	char* msg_body;
 };
 
+/*
+ * Incremental message decoder. Bytes received from the socket are fed
+ * in as they arrive, partial frames are buffered until complete and
+ * every complete frame is handed to the handler.
+ */
+struct usenet_msg_decoder
+{
+	char* _buf;													/* pending bytes of an incomplete frame */
+	size_t _len;												/* number of bytes pending */
+	size_t _cap;												/* capacity of the buffer */
+
+	void* _ext_obj;												/* object passed to the handler */
+	int (*_handler)(void*, struct usenet_message*);				/* called for every complete frame */
+};
+
+/*
+ * Binary payload for the fixed shape broadcasts. Encoded in network
+ * byte order into USENET_BIN_PAYLOAD_SZ bytes.
+ */
+struct usenet_bin_payload
+{
+	unsigned char _opcode;										/* one of USENET_RPC_OP_* */
+	int _nzb_id;												/* nzb id the broadcast refers to */
+	pid_t _pid;													/* process id of the sender */
+	unsigned int _progress;										/* progress scaled by USENET_BIN_PROGRESS_SCALE */
+};
+
+/*
+ * Arguments of a dispatched rpc. For json messages the body and tokens
+ * are set and the payload is empty, for binary messages _json is NULL.
+ */
+struct usenet_rpc_call
+{
+	unsigned char _opcode;										/* resolved opcode */
+	const char* _json;											/* json message body */
+	jsmntok_t* _tok;											/* tokens of the json message */
+	int _num_tok;												/* number of tokens */
+	struct usenet_bin_payload _payload;							/* decoded binary payload */
+};
+
+typedef int (*usenet_rpc_fn)(void*, struct usenet_rpc_call*);
+
+/* name to opcode entry of the rpc table */
+struct usenet_rpc_name
+{
+	unsigned int _hash;
+	unsigned char _opcode;
+	const char* _name;
+};
+
+/*
+ * Rpc dispatch table. Handlers are indexed by opcode, names are
+ * resolved to opcodes through an open addressed hash table.
+ */
+struct usenet_rpc_table
+{
+	void* _ext_obj;												/* object passed to the handlers */
+	usenet_rpc_fn _handlers[USENET_RPC_MAX_OPCODE];
+	struct usenet_rpc_name _names[USENET_RPC_NAME_TABLE_SZ];
+};
+
+/* Message body pool counters */
+struct usenet_pool_stats
+{
+	unsigned long _hits;										/* allocations served from the pool */
+	unsigned long _misses;										/* allocations passed to malloc */
+	unsigned long _in_use;										/* pool blocks currently taken */
+};
+
+/* Exit status and resource usage of a reaped child */
+struct usenet_proc_stat
+{
+	pid_t _pid;
+	int _status;												/* status as returned by wait4 */
+	double _cpu_time;											/* user and system time in seconds */
+	long _max_rss;												/* maximum resident set size in kilobytes */
+	double _wall_time;											/* seconds between start and reaping */
+};
+
+typedef int (*usenet_proc_exit_fn)(void*, const struct usenet_proc_stat*);
+
+/* child tracked by the supervisor */
+struct usenet_proc_child
+{
+	pid_t _pid;
+	int _pidfd;													/* process descriptor, -1 if not supported */
+	struct timespec _start;										/* monotonic start time */
+	usenet_proc_exit_fn _exit_fn;								/* called once the child is reaped */
+	void* _ext_obj;												/* object passed to the exit callback */
+};
+
+/*
+ * Supervisor of the child processes. Each child gets a pidfd
+ * registered with the caller's epoll descriptor. Where pidfds
+ * are not available, children are reaped on SIGCHLD.
+ */
+struct usenet_proc_supervisor
+{
+	int _epoll_fd;
+	pthread_mutex_t _mutex;										/* children are started from the connection thread */
+	size_t _num_children;
+	struct usenet_proc_child _children[USENET_PROC_MAX_CHILDREN];
+};
+
+/* Result of a transfer */
+struct usenet_transfer_stat
+{
+	size_t _bytes;												/* bytes written to the channel */
+	double _seconds;											/* wall time of the transfer */
+	double _mbps;												/* achieved rate in MB/s */
+	size_t _reads;												/* read calls on the source */
+	size_t _writes;												/* write calls on the sink */
+};
+
+/* Token bucket of a transfer, the rate is in bytes per second, 0 is unlimited */
+struct usenet_shape_bucket
+{
+	double _rate;
+	double _tokens;												/* negative while in deficit */
+	struct timespec _last;										/* last refill */
+};
+
+/* Counters of the shaping decisions */
+struct usenet_shape_stat
+{
+	unsigned long long _bytes;									/* bytes charged */
+	unsigned long long _throttled;								/* writes delayed */
+	unsigned long long _global_waits;							/* delays caused by the global cap */
+	double _wait_seconds;										/* total delay */
+	double _global_rate;										/* current global cap in bytes per second */
+};
+
+/* Streaming hash of the data sent */
+struct usenet_hash
+{
+	void* _ctx;													/* digest context */
+	size_t _bytes;
+};
+
+/* Cached ssh session, defined in sshint.c */
+struct usenet_ssh_conn;
+struct _LIBSSH2_SESSION;
+struct _LIBSSH2_SFTP;
+
+/* Destination of the transfer engine, set up by usenet_transfer_sink_init */
+struct usenet_transfer_sink
+{
+	const char* _name;
+	int _remote_flg;											/* the copy is on the server */
+	int _fd;													/* local copy */
+	struct usenet_ssh_conn* _conn;								/* session of the scp sink */
+	void* _channel;
+	time_t _progress;											/* last time the channel moved */
+	int (*_open)(struct usenet_transfer_sink*, struct gapi_login*, const char*, const struct stat*);
+	ssize_t (*_write)(struct usenet_transfer_sink*, const char*, size_t);	/* USENET_TRANSFER_AGAIN if busy */
+	int (*_wait)(struct usenet_transfer_sink*);						/* wait until the sink takes data */
+	int (*_finish)(struct usenet_transfer_sink*);
+	void (*_close)(struct usenet_transfer_sink*, int);				/* releases the sink, flag set on failure */
+};
+
+/* A file queued for copying to the remote server */
+struct usenet_transfer_job
+{
+	int _nzb_id;												/* history item of the file */
+	int _priority;												/* higher is copied first */
+	char* _source;
+	char* _target;
+	float _progress;											/* updated by the worker under the pool lock */
+	int _result;												/* USENET_SUCCESS if copied */
+	struct usenet_transfer_stat _stat;
+	struct usenet_transfer_pool* _pool;							/* pool running the job */
+	struct usenet_transfer_job* _next;
+};
+
+typedef int (*usenet_transfer_progress_fn)(void*, int, float);
+
+/*
+ * Pool of transfer workers. Jobs are copied in submission order, finished
+ * jobs are handed back to the owner, signalled through the event descriptor.
+ */
+struct usenet_transfer_pool
+{
+	struct gapi_login* _config;
+	int _event_fd;												/* readable when jobs have finished */
+	volatile int _stop_flg;
+	size_t _num_workers;
+	pthread_t _workers[USENET_TRANSFER_MAX_WORKERS];
+	pthread_mutex_t _mutex;
+	pthread_cond_t _cond;
+	struct usenet_transfer_job* _queue;							/* jobs waiting for a worker */
+	struct usenet_transfer_job* _queue_tail;
+	struct usenet_transfer_job* _active[USENET_TRANSFER_MAX_WORKERS];
+	struct usenet_transfer_job* _done;							/* finished jobs not yet collected */
+};
+
 /* Usenet string array */
 struct usenet_str_arr
 {
@@ -178,6 +456,68 @@ struct usenet_nzb_filellist
 	(list)->_u_std_fname = NULL;				\
 	(list)->_u_r_fpath = NULL
 
+/*
+ * nzbget calls queued to be sent in one round trip. The results are set
+ * by the flush, USENET_SUCCESS or USENET_ERROR for each queued call.
+ */
+struct usenet_nzb_batch
+{
+	int* _delete_ids;									/* removed from the history by one editqueue */
+	size_t _num_delete;
+	size_t _delete_sz;
+	int _scan_flg;
+	int _groups_flg;
+	int _history_flg;
+
+	int _delete_result;
+	int _scan_result;
+	int _groups_result;
+	int _history_result;
+
+	struct usenet_nzb_filellist* _groups;
+	size_t _num_groups;
+	struct usenet_nzb_filellist* _history;
+	size_t _num_history;
+};
+
+/* entries of the nzbget history seen by the last poll, sorted by nzb id */
+struct usenet_nzb_history
+{
+	struct usenet_nzb_filellist* _list;
+	size_t _num;
+};
+
+typedef int (*usenet_nzb_history_fn)(void*, int, struct usenet_nzb_filellist*);
+
+/* response of a json rpc call, the tokens index into the buffer */
+struct usenet_jsonrpc_res
+{
+	char* _buffer;
+	size_t _size;
+	jsmntok_t* _tok;
+	int _num;
+	jsmntok_t* _result;									/* value of the result member */
+};
+
+/* result of a call read as the response arrives */
+struct usenet_uxmlrpc_result
+{
+	int _ok;											/* USENET_SUCCESS if the call returned a value */
+	int _bool;											/* boolean returned by the call */
+	struct usenet_nzb_filellist* _list;					/* entries of an array of structs */
+	size_t _num;
+};
+
+/* a call of a multicall, types has a character per parameter */
+struct usenet_uxmlrpc_call
+{
+	const char* _method;
+	const char* _types;									/* s string, i int, b boolean, A int array */
+	char** _paras;										/* values of the s, i and b parameters */
+	int* _ints;											/* values of the A parameter */
+	size_t _num_ints;
+};
+
 int usenet_utils_load_config(struct gapi_login* login);
 int usenet_utils_destroy_config(struct gapi_login* login);
 
@@ -191,10 +531,34 @@ int usenent_message_response_instruct(struct usenet_message* msg);							/* Resp
 int usenet_nzb_search_and_get(const char* nzb_desc, const char* s_url);						/* search get and issue rpc call to nzbget */
 int usenet_read_file(const char* path, char** buff, size_t* sz);								/* Read contents of a file pointed by file path */
 int usenet_serialise_message(struct usenet_message* msg, void** buff, size_t* sz);			/* Serialise the message into buffer */
+int usenet_send_message(int sock, struct usenet_message* msg);								/* Vectored write of the message to socket */
 
 /* unserialise the buffer */
 int usenet_unserialise_message(const void* buff, const size_t sz, struct usenet_message* msg);
 
+/*
+ * Frame decoder methods. The message passed to the handler is only valid
+ * for the duration of the call, the body is released afterwards. A feed
+ * which fails leaves the stream out of step, the connection must be reset.
+ */
+int usenet_decoder_init(struct usenet_msg_decoder* dec, int (*handler)(void*, struct usenet_message*), void* ext_obj);
+int usenet_decoder_feed(struct usenet_msg_decoder* dec, const void* data, size_t sz);
+int usenet_decoder_reset(struct usenet_msg_decoder* dec);
+int usenet_decoder_destroy(struct usenet_msg_decoder* dec);
+
+/*
+ * Per thread pool of fixed size blocks for message bodies. Requests larger
+ * than USENET_POOL_BLOCK_SZ, or made while the pool is exhausted, fall back
+ * to malloc. A block must be released by the thread which allocated it.
+ */
+void* usenet_pool_alloc(size_t sz);
+void usenet_pool_free(void* ptr);
+int usenet_pool_get_stats(struct usenet_pool_stats* stats);
+
+/* binary broadcast payload encoding */
+int usenet_bin_encode(const struct usenet_bin_payload* payload, char* buff, size_t sz);
+int usenet_bin_decode(const char* buff, size_t sz, struct usenet_bin_payload* payload);
+
 pid_t usenet_find_process(const char* pname);												/* find process id */
 
 /*
@@ -213,6 +577,11 @@ int usenet_utils_remove_chars(char** str, size_t len);
  */
 int usenet_utils_time_diff(const char* file);
 
+/*
+ * Seconds elapsed since start on the monotonic clock
+ */
+double usenet_utils_elapsed(const struct timespec* start);
+
 
 int usenet_utils_append_std_fname(struct usenet_nzb_filellist* list);
 
@@ -250,6 +619,76 @@ int usenet_utils_scp_file(struct gapi_login* config,
 						  const char* target,
 						  int (*prog)(void*, float),
 						  void* ext_obj);
+/*
+ * Ssh session cache
+ */
+struct usenet_ssh_conn* usenet_ssh_acquire(struct gapi_login* config, int fresh);
+int usenet_ssh_release(struct usenet_ssh_conn* conn, int broken);
+struct _LIBSSH2_SESSION* usenet_ssh_get_session(struct usenet_ssh_conn* conn);
+int usenet_ssh_get_socket(struct usenet_ssh_conn* conn);
+int usenet_ssh_maintain(struct gapi_login* config);
+int usenet_ssh_cleanup(void);
+int usenet_ssh_exec(struct usenet_ssh_conn* conn, const char* cmd, char** out, size_t* len);
+int usenet_ssh_quote(const char* str, char* buf, size_t sz);
+
+/*
+ * Skip or patch the copies already on the server.
+ */
+int usenet_sync_unchanged(struct gapi_login* config, const char* source, const char* target);
+int usenet_sync_delta(struct gapi_login* config,
+					  struct usenet_ssh_conn* conn,
+					  struct _LIBSSH2_SFTP* sftp,
+					  int fd,
+					  const struct stat* fstat,
+					  const char* target,
+					  struct usenet_hash* hash,
+					  size_t* sent);
+
+/*
+ * Bandwidth shaping, transfers charge the bytes written and sleep off
+ * the deficit of their own and the global bucket.
+ */
+int usenet_shape_init(struct usenet_shape_bucket* bucket, struct gapi_login* config, int streams);
+int usenet_shape_take(struct usenet_shape_bucket* bucket, struct gapi_login* config, size_t bytes);
+int usenet_shape_get_stat(struct usenet_shape_stat* stat);
+
+/*
+ * Content hashing of the transfers, the remote copy is hashed with
+ * sha256sum over the session of the transfer.
+ */
+int usenet_hash_init(struct usenet_hash* hash);
+int usenet_hash_update(struct usenet_hash* hash, const void* data, size_t len);
+int usenet_hash_final(struct usenet_hash* hash, char* hex, size_t sz);
+void usenet_hash_free(struct usenet_hash* hash);
+int usenet_hash_remote(struct usenet_ssh_conn* conn, const char* target, long long offset, long long len, char* hex, size_t sz);
+
+/*
+ * Transfer engine
+ */
+int usenet_transfer_file(struct gapi_login* config,
+						 const char* source,
+						 const char* target,
+						 int (*prog)(void*, float),
+						 void* ext_obj,
+						 struct usenet_transfer_stat* stat);
+int usenet_transfer_sink_init(struct usenet_transfer_sink* sink, struct gapi_login* config);
+int usenet_transfer_open_source(struct gapi_login* config, const char* source, struct stat* stat_buf);
+ssize_t usenet_transfer_read(int fd, void* buf, size_t len, off_t offset);
+void usenet_transfer_release_pages(int fd, off_t offset, size_t len);
+int usenet_sftp_transfer_file(struct gapi_login* config,
+							  const char* source,
+							  const char* target,
+							  int (*prog)(void*, float),
+							  void* ext_obj,
+							  struct usenet_transfer_stat* stat);
+int usenet_transfer_pool_init(struct usenet_transfer_pool* pool, struct gapi_login* config);
+int usenet_transfer_pool_submit(struct usenet_transfer_pool* pool, int nzb_id, const char* source, const char* target);
+int usenet_transfer_pool_find(struct usenet_transfer_pool* pool, int nzb_id);
+struct usenet_transfer_job* usenet_transfer_pool_collect(struct usenet_transfer_pool* pool);
+int usenet_transfer_pool_progress(struct usenet_transfer_pool* pool, usenet_transfer_progress_fn fn, void* ext_obj);
+int usenet_transfer_pool_destroy(struct usenet_transfer_pool* pool);
+void usenet_transfer_job_free(struct usenet_transfer_job* job);
+
 /*
  * JSON Parser helper methods
  */
@@ -257,22 +696,76 @@ int usjson_parse_message(const char* msg, jsmntok_t** tok, int* num);
 int usjson_get_token(const char* msg, jsmntok_t* tok, size_t num_tokens, const char* key, char** value, jsmntok_t** obj);
 int usjson_get_token_arr_as_str(const char* msg, jsmntok_t* tok, struct usenet_str_arr* str_arr);
 
+/*
+ * Rpc dispatch methods
+ */
+int usenet_rpc_init(struct usenet_rpc_table* table, void* ext_obj);
+int usenet_rpc_register(struct usenet_rpc_table* table, const char* name, unsigned char opcode, usenet_rpc_fn fn);
+int usenet_rpc_lookup(struct usenet_rpc_table* table, const char* name, size_t len);
+int usenet_rpc_dispatch_json(struct usenet_rpc_table* table, const char* msg);
+int usenet_rpc_dispatch_bin(struct usenet_rpc_table* table, const char* buff, size_t sz);
+
+/*
+ * Child process supervision
+ */
+int usenet_proc_init(struct usenet_proc_supervisor* sup, int epoll_fd);
+int usenet_proc_spawn(struct usenet_proc_supervisor* sup, char* const argv[], usenet_proc_exit_fn fn, void* ext_obj, pid_t* pid);
+int usenet_proc_handle_event(struct usenet_proc_supervisor* sup, int fd);
+int usenet_proc_reap(struct usenet_proc_supervisor* sup);
+int usenet_proc_kill(struct usenet_proc_supervisor* sup, pid_t pid, int sig);
+int usenet_proc_destroy(struct usenet_proc_supervisor* sup);
+
 /*
  * nzbget methods
  */
+int usenet_nzb_init(struct gapi_login* config);
+int usenet_nzb_cleanup(void);
 int usenet_update_nzb_list(void);
 int usenet_nzb_scan(void);
 int usenet_nzb_get_filelist(struct usenet_nzb_filellist** f_list, size_t* num);
 int usenet_nzb_get_history(struct usenet_nzb_filellist** f_list, size_t* num);
 int usenet_nzb_delete_item_from_history(int* ids, size_t num);
+int usenet_nzb_batch_init(struct usenet_nzb_batch* batch);
+int usenet_nzb_batch_delete(struct usenet_nzb_batch* batch, int id);
+int usenet_nzb_batch_scan(struct usenet_nzb_batch* batch);
+int usenet_nzb_batch_groups(struct usenet_nzb_batch* batch);
+int usenet_nzb_batch_history(struct usenet_nzb_batch* batch);
+int usenet_nzb_batch_flush(struct usenet_nzb_batch* batch);
+void usenet_nzb_batch_free(struct usenet_nzb_batch* batch);
+int usenet_nzb_set_field(struct usenet_nzb_filellist* f_list, const char* name, const char* value);
+
+/*
+ * nzbget history cache
+ */
+int usenet_nzb_history_init(struct usenet_nzb_history* hist);
+int usenet_nzb_history_sync(struct usenet_nzb_history* hist,
+							struct usenet_nzb_filellist* list,
+							size_t num,
+							usenet_nzb_history_fn fn,
+							void* self);
+int usenet_nzb_history_forget(struct usenet_nzb_history* hist, int id);
+struct usenet_nzb_filellist* usenet_nzb_history_find(struct usenet_nzb_history* hist, int id);
+void usenet_nzb_history_free(struct usenet_nzb_history* hist);
 
 
 /*
  * xml rpc methods
  */
-int usenet_uxmlrpc_call(const char* method_name, char** paras, size_t size, xmlDocPtr* res);
-int usenet_uxmlrpc_get_node_count(xmlNodePtr root_node, const char* key, int* count, xmlNodePtr* node);
-int usenet_uxmlrpc_get_member(xmlNodePtr member_node, const char* name, char** value);
+int usenet_uxmlrpc_init(void);
+int usenet_uxmlrpc_cleanup(void);
+int usenet_uxmlrpc_call_list(const char* method_name, char** paras, size_t size, struct usenet_uxmlrpc_result* res);
+int usenet_uxmlrpc_multicall(struct usenet_uxmlrpc_call* calls, size_t num, struct usenet_uxmlrpc_result* res);
+void usenet_uxmlrpc_free_results(struct usenet_uxmlrpc_result* res, size_t num);
+
+/*
+ * json rpc methods
+ */
+int usenet_ujsonrpc_init(void);
+int usenet_ujsonrpc_cleanup(void);
+int usenet_ujsonrpc_call(const char* method, const char* params, struct usenet_jsonrpc_res* res);
+int usenet_ujsonrpc_get_list(struct usenet_jsonrpc_res* res, struct usenet_nzb_filellist** f_list, size_t* num);
+int usenet_ujsonrpc_result_true(struct usenet_jsonrpc_res* res);
+void usenet_ujsonrpc_free(struct usenet_jsonrpc_res* res);
 
 #define USENET_REQUEST_RESPONSE 0x00
 #define USENET_REQUEST_RESPONSE_PENDING 0x01
@@ -283,6 +776,7 @@ int usenet_uxmlrpc_get_member(xmlNodePtr member_node, const char* name, char** v
 #define USENET_REQUEST_PULSE 0x06
 #define USENET_REQUEST_BROADCAST 0x07
 #define USENET_REQUEST_PROGRESS 0x08
+#define USENET_REQUEST_BROADCAST_BIN 0x09
 
 
 /* helper method for logging */
@@ -338,6 +832,20 @@ static inline void _usenet_log_message_args(const char* msg, const char* fname,
 		}																\
 	}
 
+/* Create the message body from the block pool */
+#define USENET_CREATE_POOLED_MESSAGE(msg, sz)							\
+	do {																\
+		(msg)->msg_body = (char*) usenet_pool_alloc(sizeof(char) * ((sz) + 1)); \
+		(msg)->size = (sz) + USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ;	\
+	} while(0)
+
+/* Release the pooled message body */
+#define USENET_DESTROY_POOLED_MESSAGE(msg)		\
+	do {										\
+		usenet_pool_free((msg)->msg_body);		\
+		(msg)->msg_body = NULL;					\
+	} while(0)
+
 /* Returns the size of the message */
 #define USENET_GET_MSG_SIZE(msg) \
 	(size_t) (msg)->size
@@ -350,4 +858,21 @@ static inline void _usenet_log_message_args(const char* msg, const char* fname,
 
 #define USENET_CONV_MB(sz)						\
 	sz / (1000 * 1000)
+
+/* Transfer buffer size in bytes, the config is in kilobytes */
+#define USENET_TRANSFER_BUFFER_SIZE(config)								\
+	((size_t) ((config)->scp_buffer_size > 0 ? (config)->scp_buffer_size : USENET_TRANSFER_DEF_BUFFER_KB) * 1024)
+
+/* Check the remote copy of the transfers */
+#define USENET_TRANSFER_VERIFY_FLG(config)								\
+	((config)->transfer_verify && strcmp((config)->transfer_verify, USENET_CONFIG_YES) == 0)
+
+/* Skip the files already on the server */
+#define USENET_TRANSFER_SKIP_FLG(config)								\
+	((config)->transfer_skip_existing && strcmp((config)->transfer_skip_existing, USENET_CONFIG_YES) == 0)
+
+/* Patch the remote copies which can't be resumed */
+#define USENET_TRANSFER_DELTA_FLG(config)								\
+	((config)->transfer_delta && strcmp((config)->transfer_delta, USENET_CONFIG_YES) == 0)
+
 #endif /* _USENET_H_ */
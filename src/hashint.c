@@ -0,0 +1,115 @@
+/*
+ * Content hashes of the transferred files. The hash is updated with the
+ * buffers as they are written to the server, the remote copy is hashed
+ * by a single command run over the ssh session of the transfer.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <openssl/evp.h>
+
+#include "usenet.h"
+
+/* start a sha-256 over the data sent */
+int usenet_hash_init(struct usenet_hash* hash)
+{
+	if(hash == NULL)
+		return USENET_ARG_ERROR;
+
+	hash->_bytes = 0;
+	hash->_ctx = EVP_MD_CTX_new();
+	if(hash->_ctx == NULL)
+		return USENET_ERROR;
+
+	if(EVP_DigestInit_ex((EVP_MD_CTX*) hash->_ctx, EVP_sha256(), NULL) != 1) {
+		EVP_MD_CTX_free((EVP_MD_CTX*) hash->_ctx);
+		hash->_ctx = NULL;
+		return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+int usenet_hash_update(struct usenet_hash* hash, const void* data, size_t len)
+{
+	if(hash == NULL || hash->_ctx == NULL)
+		return USENET_ARG_ERROR;
+
+	hash->_bytes += len;
+	return EVP_DigestUpdate((EVP_MD_CTX*) hash->_ctx, data, len) == 1 ? USENET_SUCCESS : USENET_ERROR;
+}
+
+/* finish the hash into hex, the context is released */
+int usenet_hash_final(struct usenet_hash* hash, char* hex, size_t sz)
+{
+	unsigned int _i = 0, _len = 0;
+	unsigned char _md[EVP_MAX_MD_SIZE];
+
+	if(hash == NULL || hash->_ctx == NULL || hex == NULL || sz < USENET_HASH_HEX_SZ)
+		return USENET_ARG_ERROR;
+
+	EVP_DigestFinal_ex((EVP_MD_CTX*) hash->_ctx, _md, &_len);
+	usenet_hash_free(hash);
+
+	for(_i = 0; _i < _len; _i++)
+		sprintf(hex + _i * 2, "%02x", _md[_i]);
+	hex[_len * 2] = '\0';
+
+	return USENET_SUCCESS;
+}
+
+void usenet_hash_free(struct usenet_hash* hash)
+{
+	if(hash == NULL || hash->_ctx == NULL)
+		return;
+
+	EVP_MD_CTX_free((EVP_MD_CTX*) hash->_ctx);
+	hash->_ctx = NULL;
+}
+
+/*
+ * Hash the remote file, or len bytes from offset if len is positive,
+ * with sha256sum on the server. The session is left in blocking mode.
+ */
+int usenet_hash_remote(struct usenet_ssh_conn* conn, const char* target, long long offset, long long len, char* hex, size_t sz)
+{
+	int _ret = USENET_ERROR, _i = 0;
+	size_t _len = 0;
+	char* _out = NULL;
+	char _path[USENET_TRANSFER_PATH_SZ * 4] = {0};
+	char _cmd[USENET_TRANSFER_PATH_SZ * 4 + 128] = {0};
+
+	if(conn == NULL || target == NULL || hex == NULL || sz < USENET_HASH_HEX_SZ)
+		return USENET_ARG_ERROR;
+
+	if(usenet_ssh_quote(target, _path, sizeof(_path)) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	if(len > 0)
+		snprintf(_cmd, sizeof(_cmd), "tail -c +%lld -- %s | head -c %lld | sha256sum", offset + 1, _path, len);
+	else
+		snprintf(_cmd, sizeof(_cmd), "sha256sum -- %s", _path);
+
+	/* the digest is the first word of the output */
+	if(usenet_ssh_exec(conn, _cmd, &_out, &_len) != 0 || _len < USENET_HASH_HEX_SZ - 1) {
+		USENET_LOG_MESSAGE_ARGS("remote hash of %s failed", target);
+		goto clean_up;
+	}
+
+	for(_i = 0; _i < USENET_HASH_HEX_SZ - 1; _i++) {
+		if(!isxdigit((unsigned char) _out[_i]))
+			goto clean_up;
+		hex[_i] = (char) tolower((unsigned char) _out[_i]);
+	}
+	hex[_i] = '\0';
+
+	_ret = USENET_SUCCESS;
+
+clean_up:
+	if(_out)
+		free(_out);
+
+	return _ret;
+}
@@ -0,0 +1,206 @@
+/*
+ * Cache of the nzbget history between polls. Each poll is merged with the
+ * entries seen by the last one by nzb id, only the entries which were
+ * added, changed status or left the history are passed on, so the work
+ * done per poll follows the changes rather than the size of the history.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "usenet.h"
+
+static int _history_cmp_id(const void* a, const void* b);
+static int _history_same_status(const struct usenet_nzb_filellist* a, const struct usenet_nzb_filellist* b);
+static size_t _history_count_changes(struct usenet_nzb_history* hist, struct usenet_nzb_filellist* list, size_t num);
+static void _history_move(struct usenet_nzb_filellist* dest, struct usenet_nzb_filellist* src);
+
+int usenet_nzb_history_init(struct usenet_nzb_history* hist)
+{
+	if(hist == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(hist, 0, sizeof(struct usenet_nzb_history));
+	return USENET_SUCCESS;
+}
+
+/*
+ * Merge the history of a poll into the cache and call fn for each entry
+ * inserted, updated or removed. The inserted and updated entries are taken
+ * from the list, the slots left are empty and freed by the caller as
+ * before. The entry passed to fn belongs to the cache and may be changed
+ * by it, a removed entry is freed once fn returns. Returns the number of
+ * changes or USENET_ERROR if the cache could not be rebuilt.
+ */
+int usenet_nzb_history_sync(struct usenet_nzb_history* hist,
+							struct usenet_nzb_filellist* list,
+							size_t num,
+							usenet_nzb_history_fn fn,
+							void* self)
+{
+	size_t _i = 0, _j = 0, _k = 0, _changes = 0;
+	struct usenet_nzb_filellist* _next = NULL;
+
+	if(hist == NULL || (list == NULL && num > 0))
+		return USENET_ARG_ERROR;
+
+	/* nzbget sends the newest first, the merge needs both sides by id */
+	if(num > 1)
+		qsort(list, num, sizeof(struct usenet_nzb_filellist), _history_cmp_id);
+
+	/* the usual poll finds nothing new, the cache is kept as it is */
+	_changes = _history_count_changes(hist, list, num);
+	if(_changes == 0)
+		return 0;
+
+	if(num > 0) {
+		_next = (struct usenet_nzb_filellist*) calloc(num, sizeof(struct usenet_nzb_filellist));
+		if(_next == NULL)
+			return USENET_ERROR;
+	}
+
+	while(_i < hist->_num || _j < num) {
+
+		/* an id sent twice is only counted once */
+		if(_j < num && _k > 0 && _next[_k-1]._nzb_id == list[_j]._nzb_id) {
+			_j++;
+			continue;
+		}
+
+		if(_j >= num || (_i < hist->_num && hist->_list[_i]._nzb_id < list[_j]._nzb_id)) {
+			USENET_LOG_MESSAGE_ARGS("nzb %i left the history", hist->_list[_i]._nzb_id);
+			if(fn)
+				fn(self, USENET_NZB_HISTORY_REMOVE, &hist->_list[_i]);
+			USENET_FILELIST_FREE(&hist->_list[_i]);
+			_i++;
+		}
+		else if(_i >= hist->_num || list[_j]._nzb_id < hist->_list[_i]._nzb_id) {
+			_history_move(&_next[_k], &list[_j++]);
+			if(fn)
+				fn(self, USENET_NZB_HISTORY_INSERT, &_next[_k]);
+			_k++;
+		}
+		else if(_history_same_status(&hist->_list[_i], &list[_j])) {
+			_history_move(&_next[_k++], &hist->_list[_i++]);
+			_j++;
+		}
+		else {
+			USENET_FILELIST_FREE(&hist->_list[_i]);
+			_i++;
+			_history_move(&_next[_k], &list[_j++]);
+			if(fn)
+				fn(self, USENET_NZB_HISTORY_UPDATE, &_next[_k]);
+			_k++;
+		}
+	}
+
+	if(hist->_list)
+		free(hist->_list);
+
+	hist->_list = _next;
+	hist->_num = _k;
+
+	return (int) _changes;
+}
+
+/* drop an entry without a callback, the next poll sees it as inserted */
+int usenet_nzb_history_forget(struct usenet_nzb_history* hist, int id)
+{
+	struct usenet_nzb_filellist* _entry = NULL;
+
+	if(hist == NULL)
+		return USENET_ARG_ERROR;
+
+	_entry = usenet_nzb_history_find(hist, id);
+	if(_entry == NULL)
+		return USENET_ERROR;
+
+	USENET_FILELIST_FREE(_entry);
+	memmove(_entry, _entry + 1, (size_t) (hist->_list + hist->_num - (_entry + 1)) * sizeof(struct usenet_nzb_filellist));
+	hist->_num--;
+
+	return USENET_SUCCESS;
+}
+
+/* the cached entry of an id or NULL if the last poll did not see it */
+struct usenet_nzb_filellist* usenet_nzb_history_find(struct usenet_nzb_history* hist, int id)
+{
+	struct usenet_nzb_filellist _key;
+
+	if(hist == NULL || hist->_num == 0)
+		return NULL;
+
+	_key._nzb_id = id;
+	return (struct usenet_nzb_filellist*) bsearch(&_key, hist->_list, hist->_num, sizeof(struct usenet_nzb_filellist), _history_cmp_id);
+}
+
+void usenet_nzb_history_free(struct usenet_nzb_history* hist)
+{
+	size_t _i = 0;
+
+	if(hist == NULL)
+		return;
+
+	for(_i = 0; _i < hist->_num; _i++) {
+		USENET_FILELIST_FREE(&hist->_list[_i]);
+	}
+
+	if(hist->_list)
+		free(hist->_list);
+
+	memset(hist, 0, sizeof(struct usenet_nzb_history));
+}
+
+static int _history_cmp_id(const void* a, const void* b)
+{
+	int _a = ((const struct usenet_nzb_filellist*) a)->_nzb_id;
+	int _b = ((const struct usenet_nzb_filellist*) b)->_nzb_id;
+
+	return (_a > _b) - (_a < _b);
+}
+
+static int _history_same_status(const struct usenet_nzb_filellist* a, const struct usenet_nzb_filellist* b)
+{
+	if(a->_status == NULL || b->_status == NULL)
+		return a->_status == b->_status;
+
+	return strcmp(a->_status, b->_status) == 0;
+}
+
+/* a pass over both sorted lists without touching either */
+static size_t _history_count_changes(struct usenet_nzb_history* hist, struct usenet_nzb_filellist* list, size_t num)
+{
+	size_t _i = 0, _j = 0, _changes = 0;
+
+	while(_i < hist->_num || _j < num) {
+		if(_j > 0 && _j < num && list[_j]._nzb_id == list[_j-1]._nzb_id) {
+			_j++;
+			continue;
+		}
+
+		if(_j >= num || (_i < hist->_num && hist->_list[_i]._nzb_id < list[_j]._nzb_id)) {
+			_i++;
+			_changes++;
+		}
+		else if(_i >= hist->_num || list[_j]._nzb_id < hist->_list[_i]._nzb_id) {
+			_j++;
+			_changes++;
+		}
+		else {
+			if(!_history_same_status(&hist->_list[_i], &list[_j]))
+				_changes++;
+			_i++;
+			_j++;
+		}
+	}
+
+	return _changes;
+}
+
+/* hand the strings over, the source is left empty */
+static void _history_move(struct usenet_nzb_filellist* dest, struct usenet_nzb_filellist* src)
+{
+	*dest = *src;
+	memset(src, 0, sizeof(struct usenet_nzb_filellist));
+}
@@ -17,7 +17,7 @@ if [ ! -d ../bin ]; then
 	mkdir ../bin
 fi
 
-gcc -g -Wall -O0 -o ../bin/client uclient.c utilsint.c jsonint.c unzbget.c nzbgetint.c uxmlrpc.c $jsmn_inc_path/jsmn.c \
+gcc -g -Wall -O0 -o ../bin/client uclient.c utilsint.c jsonint.c rpcint.c procint.c transferint.c sinkint.c sftpint.c sshint.c hashint.c shapeint.c syncint.c unzbget.c nzbgetint.c historyint.c uxmlrpc.c ujsonrpc.c $jsmn_inc_path/jsmn.c \
 	-I$include_path -I/usr/include/libxml2/ -I$thor_inc_path -I$jsmn_inc_path \
 	-L$thor_lib_path -Wl,-rpath=$thor_lib_path \
 	-lcomm -lalist -lm -lconfig -lxmlrpc_util -lxmlrpc_client -lxmlrpc -lcurl -lxml2 -lssh2 -lssl -lcrypto -lpthread
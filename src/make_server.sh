@@ -22,7 +22,7 @@ fi
 
 
 # Make server
-gcc -g -Wall -O0 -o ../bin/server userver.c utilsint.c $jsmn_inc_path/jsmn.c \
+gcc -g -Wall -O0 -o ../bin/server userver.c utilsint.c jsonint.c transferint.c sinkint.c sftpint.c sshint.c hashint.c shapeint.c syncint.c $jsmn_inc_path/jsmn.c \
 	 $thor_lib_path $glist_lib_path \
 	-I$include_path -I$jsmn_inc_path -I/usr/include/libxml2/ -I$thor_inc_path \
 	-lm -lconfig -lcurl -lxml2 -lssh2 -lssl -lcrypto -lpthread
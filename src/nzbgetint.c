@@ -1,10 +1,15 @@
 /*
- * RPC interface for connecting to nzbget
+ * RPC interface for connecting to nzbget. A single client is created for
+ * the process and shared by the calls, its curl transport keeps the
+ * connection to nzbget open between them. With nzbget_transport set to
+ * jsonrpc the calls go to the json rpc interface of nzbget instead.
  */
 
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <signal.h>
+#include <pthread.h>
 
 #include <xmlrpc-c/base.h>
 #include <xmlrpc-c/client.h>
@@ -25,6 +30,13 @@
 #define USENET_NZBGET_EDITQUEUE_METHOD "editqueue"
 
 #define USENET_NZBGET_NUM_GROUPS 10
+#define USENET_NZBGET_MAX_BATCH 4
+#define USENET_NZBGET_BATCH_IDS 16
+#define USENET_NZBGET_INT_SZ 16									/* an int parameter as a string */
+#define USENET_NZBGET_JSON_ID_SZ 12
+#define USENET_NZBGET_JSON_DELETE "[\"HistoryDelete\",0,\"\",["
+#define USENET_NZBGET_JSON_HISTORY_PARAS "[true]"
+#define USENET_NZBGET_JSON_GROUPS_PARAS "[10]"
 
 #define USENET_NZBGET_COPY_ELEMENT(element, value)				\
 	(element) = (char*) malloc(strlen((const char*) (value)) +1);	\
@@ -45,8 +57,58 @@
 		goto clean_up;													\
     }
 
+static pthread_mutex_t _nzb_client_mutex = PTHREAD_MUTEX_INITIALIZER;
+static xmlrpc_client* _nzb_client = NULL;
+static int _nzb_json_flg = 0;										/* calls use the json rpc transport */
+
+static xmlrpc_client* _nzb_get_client(xmlrpc_env* env);
+static int _nzb_json_list(const char* method, const char* params, struct usenet_nzb_filellist** f_list, size_t* num);
+static int _nzb_json_bool(const char* method, const char* params);
+static int _nzb_json_delete(int* ids, size_t num);
+static int _nzb_json_flush(struct usenet_nzb_batch* batch);
 static int _nzb_populate_flist(xmlrpc_env* env, xmlrpc_value* resultp, struct usenet_nzb_filellist* f_list, int ix);
-static int _nzb_populate_flist2(xmlNodePtr member, struct usenet_nzb_filellist* f_list);
+
+/*
+ * Select the transport and create the shared client and the curl handle
+ * of the calls, the calls create them on first use if this was not called.
+ */
+int usenet_nzb_init(struct gapi_login* config)
+{
+    xmlrpc_env env;
+
+	_nzb_json_flg = (config && config->nzbget_transport &&
+					 strcmp(config->nzbget_transport, USENET_NZBGET_TRANSPORT_JSONRPC) == 0);
+	if(_nzb_json_flg) {
+		USENET_LOG_MESSAGE("using the json rpc interface of nzbget");
+		return usenet_ujsonrpc_init();
+	}
+
+    xmlrpc_env_init(&env);
+	if(_nzb_get_client(&env) == NULL) {
+        USENET_LOG_MESSAGE_ARGS("XML-RPC Fault: %s (%d)", env.fault_string, env.fault_code);
+		xmlrpc_env_clean(&env);
+		return USENET_ERROR;
+	}
+    xmlrpc_env_clean(&env);
+
+	return usenet_uxmlrpc_init();
+}
+
+/* close the connections to nzbget */
+int usenet_nzb_cleanup(void)
+{
+	pthread_mutex_lock(&_nzb_client_mutex);
+	if(_nzb_client) {
+		USENET_LOG_MESSAGE("destroying rpc client");
+		xmlrpc_client_destroy(_nzb_client);
+		xmlrpc_client_teardown_global_const();
+	}
+	_nzb_client = NULL;
+	pthread_mutex_unlock(&_nzb_client_mutex);
+
+	usenet_ujsonrpc_cleanup();
+	return usenet_uxmlrpc_cleanup();
+}
 
 int usenet_update_nzb_list(void)
 {
@@ -58,18 +120,17 @@ int usenet_update_nzb_list(void)
     /* Initialize our error-handling environment. */
     xmlrpc_env_init(&env);
 
-    /* Start up our XML-RPC client library. */
-	xmlrpc_client_setup_global_const(&env);
-	die_if_fault_occurred(&env);
-
-	xmlrpc_client_create(&env, XMLRPC_CLIENT_NO_FLAGS, NAME, VERSION, NULL, 0, &client);
+    /* Get the shared XML-RPC client. */
+	client = _nzb_get_client(&env);
     die_if_fault_occurred(&env);
 
     USENET_LOG_MESSAGE_ARGS("Making XMLRPC call to server url %s method %s "
 	   "to request version number ", SERVER_URL, METHOD_NAME);
 
     /* Make the remote procedure call */
+	pthread_mutex_lock(&_nzb_client_mutex);
 	xmlrpc_client_call2f(&env, client, SERVER_URL, METHOD_NAME, &resultp, "(n)");
+	pthread_mutex_unlock(&_nzb_client_mutex);
     die_if_fault_occurred(&env);
 
     /* Get our sum and print it out. */
@@ -88,11 +149,6 @@ int usenet_update_nzb_list(void)
     /* Clean up our error-handling environment. */
     xmlrpc_env_clean(&env);
 
-    /* Shutdown our XML-RPC client library. */
-	xmlrpc_client_destroy(client);
-
-	xmlrpc_client_teardown_global_const();
-
     return USENET_SUCCESS;
 }
 
@@ -102,22 +158,23 @@ int usenet_nzb_scan(void)
 	xmlrpc_client* client;
     xmlrpc_value * resultp;
 
+	if(_nzb_json_flg)
+		return _nzb_json_bool(USENET_NZBGET_SCAN_METHOD, NULL);
+
     /* Initialize our error-handling environment. */
     xmlrpc_env_init(&env);
 
-	xmlrpc_client_setup_global_const(&env);
-	die_if_fault_occurred(&env);
-
-    /* Start up our XML-RPC client library. */
-	USENET_LOG_MESSAGE("initialising rpc client");
-	xmlrpc_client_create(&env, XMLRPC_CLIENT_NO_FLAGS, NAME, VERSION, NULL, 0, &client);
+    /* Get the shared XML-RPC client. */
+	client = _nzb_get_client(&env);
     die_if_fault_occurred(&env);
 
     USENET_LOG_MESSAGE_ARGS("Making XMLRPC call to server url %s method %s "
 	   "to update the list", SERVER_URL, USENET_NZBGET_SCAN_METHOD);
 
     /* Make the remote procedure call */
+	pthread_mutex_lock(&_nzb_client_mutex);
 	xmlrpc_client_call2f(&env, client, SERVER_URL, USENET_NZBGET_SCAN_METHOD, &resultp, "(n)");
+	pthread_mutex_unlock(&_nzb_client_mutex);
     die_if_fault_occurred(&env);
 
 	USENET_LOG_MESSAGE("nzbget updated list");
@@ -128,11 +185,6 @@ int usenet_nzb_scan(void)
     /* Clean up our error-handling environment. */
     xmlrpc_env_clean(&env);
 
-    /* Shutdown our XML-RPC client library. */
-	xmlrpc_client_destroy(client);
-
-	xmlrpc_client_teardown_global_const();
-
     return USENET_SUCCESS;
 }
 
@@ -146,21 +198,21 @@ int usenet_nzb_get_filelist(struct usenet_nzb_filellist** f_list, size_t* num)
 	if(f_list == NULL)
 		return USENET_ERROR;
 
+	if(_nzb_json_flg)
+		return _nzb_json_list(USENET_NZBGET_LISTGROUPS_METHOD, USENET_NZBGET_JSON_GROUPS_PARAS, f_list, num);
+
     /* Initialize our error-handling environment. */
     xmlrpc_env_init(&env);
 
-	xmlrpc_client_setup_global_const(&env);
-	die_if_fault_occurred(&env);
-
-    /* Start up our XML-RPC client library. */
-	USENET_LOG_MESSAGE("initialising rpc client");
-	xmlrpc_client_create(&env, XMLRPC_CLIENT_NO_FLAGS, NAME, VERSION, NULL, 0, &client);
+    /* Get the shared XML-RPC client. */
+	client = _nzb_get_client(&env);
     die_if_fault_occurred(&env);
 
     USENET_LOG_MESSAGE_ARGS("Making XMLRPC call to server url %s method %s "
 	   "to get list", SERVER_URL, USENET_NZBGET_LISTGROUPS_METHOD);
 
     /* Make the remote procedure call */
+	pthread_mutex_lock(&_nzb_client_mutex);
 	xmlrpc_client_call2f(&env,
 						 client,
 						 SERVER_URL,
@@ -168,6 +220,7 @@ int usenet_nzb_get_filelist(struct usenet_nzb_filellist** f_list, size_t* num)
 						 &resultp,
 						 "(i)",
 						 (xmlrpc_int32) USENET_NZBGET_NUM_GROUPS);
+	pthread_mutex_unlock(&_nzb_client_mutex);
 
     die_if_fault_occurred(&env);
 
@@ -193,86 +246,26 @@ clean_up:
 
     /* Clean up our error-handling environment. */
     xmlrpc_env_clean(&env);
-
-    /* Shutdown our XML-RPC client library. */
-	xmlrpc_client_destroy(client);
-
-	xmlrpc_client_teardown_global_const();
     return USENET_SUCCESS;
 }
 
 int usenet_nzb_get_history(struct usenet_nzb_filellist** f_list, size_t* num)
 {
-	int _stat = USENET_SUCCESS, _count = 0, _ix = 0;
-	xmlDocPtr _xmldoc = NULL;
-	xmlNodePtr _root_node = NULL;
-	xmlNodePtr _child_node = NULL;
-	xmlNodePtr _sibling_node = NULL;
-
+	struct usenet_uxmlrpc_result _res;
 	char* _rpc_args[] = {"True"};
 
-	_stat = usenet_uxmlrpc_call(USENET_NZBGET_HISTORY_METHOD, _rpc_args, 1, &_xmldoc);
-	if(_stat != USENET_SUCCESS) {
-		return USENET_ERROR;
-	}
-
-	/* parse xml */
-	/* get root node */
-	_root_node = xmlDocGetRootElement(_xmldoc);
-	if(_root_node == NULL) {
-		USENET_LOG_MESSAGE("unable to get root node");
-		goto cleanup;
-	}
-
-	USENET_LOG_MESSAGE("getting a count of array returned by rpc response");
-
-	/*
-	 * _sibling_node pointer is set to the first value node found.
-	 */
-	usenet_uxmlrpc_get_node_count(_root_node, USENET_NZBGET_XMLRESPONSE_VALUE, &_count, &_sibling_node);
-	if(_count <= 0) {
-		USENET_LOG_MESSAGE_ARGS("rpc response array returned %i", _count);
-		goto cleanup;
-	}
+	if(_nzb_json_flg)
+		return _nzb_json_list(USENET_NZBGET_HISTORY_METHOD, USENET_NZBGET_JSON_HISTORY_PARAS, f_list, num);
 
-	/* alloc memmory to the list and populate it */
-	*num = _count;
-	*f_list = (struct usenet_nzb_filellist*) calloc(sizeof(struct usenet_nzb_filellist), _count);
-
-	/* iterate over the members and get set the values */
-	USENET_LOG_MESSAGE("iterating over the members");
-	while(_sibling_node) {
-		_child_node = xmlFirstElementChild(_sibling_node);
-
-		/* initialise the list */
-		USENET_NZBGET_INIT_LIST(&(*f_list)[_ix]);
-
-		while(_child_node) {
-
-			/*
-			 * if the node is a member call the method and break
-			 * from inner loop.
-			 */
-			if(strcmp((char*) _child_node->name, USENET_NZBGET_XMLRESPONSE_MEMBER) == 0) {
-				_nzb_populate_flist2(_child_node, &(*f_list)[_ix]);
-				_child_node = xmlNextElementSibling(_child_node);
-			}
-			else {
-				_child_node = xmlFirstElementChild(_child_node);
-			}
-		}
-
-		_sibling_node = xmlNextElementSibling(_sibling_node);
-		_ix++;
-	}
+	/* the entries are read as the response arrives */
+	if(usenet_uxmlrpc_call_list(USENET_NZBGET_HISTORY_METHOD, _rpc_args, 1, &_res) != USENET_SUCCESS)
+		return USENET_ERROR;
 
-	USENET_LOG_MESSAGE("history list loaded successfully");
+	*f_list = _res._list;
+	*num = _res._num;
 
-cleanup:
-	/* free xmldoc */
-	if(_xmldoc != NULL)
-		xmlFreeDoc(_xmldoc);
-    return USENET_SUCCESS;
+	USENET_LOG_MESSAGE_ARGS("history list of %lu loaded successfully", _res._num);
+	return USENET_SUCCESS;
 }
 
 /*
@@ -285,16 +278,14 @@ int usenet_nzb_delete_item_from_history(int* ids, size_t num)
 	xmlrpc_client* client;
     xmlrpc_value* resultp, *_ids,  *_id;
 
+	if(_nzb_json_flg)
+		return _nzb_json_delete(ids, num);
 
     /* Initialize our error-handling environment. */
     xmlrpc_env_init(&env);
 
-	xmlrpc_client_setup_global_const(&env);
-	die_if_fault_occurred(&env);
-
-    /* Start up our XML-RPC client library. */
-	USENET_LOG_MESSAGE("initialising rpc client");
-	xmlrpc_client_create(&env, XMLRPC_CLIENT_NO_FLAGS, NAME, VERSION, NULL, 0, &client);
+    /* Get the shared XML-RPC client. */
+	client = _nzb_get_client(&env);
     die_if_fault_occurred(&env);
 
     USENET_LOG_MESSAGE_ARGS("Making XMLRPC call to server url %s method %s "
@@ -314,8 +305,10 @@ int usenet_nzb_delete_item_from_history(int* ids, size_t num)
 	}
 
     /* Make the remote procedure call */
+	pthread_mutex_lock(&_nzb_client_mutex);
 	xmlrpc_client_call2f(&env, client, SERVER_URL, USENET_NZBGET_EDITQUEUE_METHOD, &resultp,
 						 "(sisA)", "HistoryDelete", 0, "", _ids);
+	pthread_mutex_unlock(&_nzb_client_mutex);
     die_if_fault_occurred(&env);
 
 	USENET_LOG_MESSAGE("nzbget item removed from list successfully");
@@ -329,14 +322,317 @@ int usenet_nzb_delete_item_from_history(int* ids, size_t num)
     /* Clean up our error-handling environment. */
     xmlrpc_env_clean(&env);
 
-    /* Shutdown our XML-RPC client library. */
-	xmlrpc_client_destroy(client);
+    return USENET_SUCCESS;
+}
+
 
-	xmlrpc_client_teardown_global_const();
+/* start an empty batch */
+int usenet_nzb_batch_init(struct usenet_nzb_batch* batch)
+{
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
 
-    return USENET_SUCCESS;
+	memset(batch, 0, sizeof(struct usenet_nzb_batch));
+	batch->_delete_result = USENET_SUCCESS;
+	batch->_scan_result = USENET_SUCCESS;
+	batch->_groups_result = USENET_SUCCESS;
+	batch->_history_result = USENET_SUCCESS;
+
+	return USENET_SUCCESS;
+}
+
+/* queue an item for removal from the history, the ids go in one editqueue */
+int usenet_nzb_batch_delete(struct usenet_nzb_batch* batch, int id)
+{
+	size_t _i = 0;
+	int* _ids = NULL;
+
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
+
+	/* an item may fail more than one check */
+	for(_i = 0; _i < batch->_num_delete; _i++) {
+		if(batch->_delete_ids[_i] == id)
+			return USENET_SUCCESS;
+	}
+
+	if(batch->_num_delete == batch->_delete_sz) {
+		_ids = (int*) realloc(batch->_delete_ids, (batch->_delete_sz + USENET_NZBGET_BATCH_IDS) * sizeof(int));
+		if(_ids == NULL)
+			return USENET_ERROR;
+
+		batch->_delete_ids = _ids;
+		batch->_delete_sz += USENET_NZBGET_BATCH_IDS;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("adding id for deletion %i", id);
+	batch->_delete_ids[batch->_num_delete++] = id;
+	return USENET_SUCCESS;
+}
+
+int usenet_nzb_batch_scan(struct usenet_nzb_batch* batch)
+{
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
+
+	batch->_scan_flg = 1;
+	return USENET_SUCCESS;
+}
+
+int usenet_nzb_batch_groups(struct usenet_nzb_batch* batch)
+{
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
+
+	batch->_groups_flg = 1;
+	return USENET_SUCCESS;
 }
 
+int usenet_nzb_batch_history(struct usenet_nzb_batch* batch)
+{
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
+
+	batch->_history_flg = 1;
+	return USENET_SUCCESS;
+}
+
+/*
+ * Send the queued calls in one system.multicall and set the result of
+ * each. Returns USENET_ERROR if the request failed, the results of the
+ * queued calls are set to USENET_ERROR as well.
+ */
+int usenet_nzb_batch_flush(struct usenet_nzb_batch* batch)
+{
+	size_t _num = 0, _ix = 0;
+	int _ret = USENET_SUCCESS;
+	char _groups_buf[USENET_NZBGET_INT_SZ] = {0};
+	char* _history_paras[] = {"True"};
+	char* _groups_paras[] = {_groups_buf};
+	char* _delete_paras[] = {"HistoryDelete", "0", "", NULL};
+	struct usenet_uxmlrpc_call _calls[USENET_NZBGET_MAX_BATCH];
+	struct usenet_uxmlrpc_result _res[USENET_NZBGET_MAX_BATCH];
+
+	if(batch == NULL)
+		return USENET_ARG_ERROR;
+
+	if(_nzb_json_flg)
+		return _nzb_json_flush(batch);
+
+	memset(_calls, 0, sizeof(_calls));
+	snprintf(_groups_buf, sizeof(_groups_buf), "%i", USENET_NZBGET_NUM_GROUPS);
+
+	/* the calls go in this order, the results are read back in the same order */
+	if(batch->_num_delete > 0) {
+		_calls[_num]._method = USENET_NZBGET_EDITQUEUE_METHOD;
+		_calls[_num]._types = "sisA";
+		_calls[_num]._paras = _delete_paras;
+		_calls[_num]._ints = batch->_delete_ids;
+		_calls[_num]._num_ints = batch->_num_delete;
+		_num++;
+	}
+	if(batch->_scan_flg) {
+		_calls[_num]._method = USENET_NZBGET_SCAN_METHOD;
+		_calls[_num]._types = "";
+		_num++;
+	}
+	if(batch->_groups_flg) {
+		_calls[_num]._method = USENET_NZBGET_LISTGROUPS_METHOD;
+		_calls[_num]._types = "i";
+		_calls[_num]._paras = _groups_paras;
+		_num++;
+	}
+	if(batch->_history_flg) {
+		_calls[_num]._method = USENET_NZBGET_HISTORY_METHOD;
+		_calls[_num]._types = "s";
+		_calls[_num]._paras = _history_paras;
+		_num++;
+	}
+
+	if(_num == 0)
+		return USENET_SUCCESS;
+
+	USENET_LOG_MESSAGE_ARGS("sending %lu nzbget calls in one request", _num);
+	_ret = usenet_uxmlrpc_multicall(_calls, _num, _res);
+
+	/* the lists are handed over to the batch */
+	if(batch->_num_delete > 0) {
+		batch->_delete_result = (_res[_ix]._ok == USENET_SUCCESS && _res[_ix]._bool) ? USENET_SUCCESS : USENET_ERROR;
+		if(batch->_delete_result == USENET_SUCCESS)
+			USENET_LOG_MESSAGE_ARGS("nzbget removed %lu items from the history", batch->_num_delete);
+		_ix++;
+	}
+	if(batch->_scan_flg) {
+		batch->_scan_result = (_res[_ix]._ok == USENET_SUCCESS && _res[_ix]._bool) ? USENET_SUCCESS : USENET_ERROR;
+		_ix++;
+	}
+	if(batch->_groups_flg) {
+		batch->_groups_result = _res[_ix]._ok;
+		batch->_groups = _res[_ix]._list;
+		batch->_num_groups = _res[_ix]._num;
+		_res[_ix]._list = NULL;
+		_res[_ix]._num = 0;
+		_ix++;
+	}
+	if(batch->_history_flg) {
+		batch->_history_result = _res[_ix]._ok;
+		batch->_history = _res[_ix]._list;
+		batch->_num_history = _res[_ix]._num;
+		_res[_ix]._list = NULL;
+		_res[_ix]._num = 0;
+		_ix++;
+	}
+
+	usenet_uxmlrpc_free_results(_res, _num);
+
+	/* the calls are sent, the ids of a failed delete are kept for a retry */
+	if(batch->_delete_result == USENET_SUCCESS)
+		batch->_num_delete = 0;
+	batch->_scan_flg = 0;
+	batch->_groups_flg = 0;
+	batch->_history_flg = 0;
+
+	return _ret;
+}
+
+/* free the lists returned and the queued ids */
+void usenet_nzb_batch_free(struct usenet_nzb_batch* batch)
+{
+	size_t _i = 0;
+
+	if(batch == NULL)
+		return;
+
+	for(_i = 0; _i < batch->_num_groups; _i++) {
+		USENET_FILELIST_FREE(&batch->_groups[_i]);
+	}
+	for(_i = 0; _i < batch->_num_history; _i++) {
+		USENET_FILELIST_FREE(&batch->_history[_i]);
+	}
+
+	if(batch->_groups)
+		free(batch->_groups);
+	if(batch->_history)
+		free(batch->_history);
+	if(batch->_delete_ids)
+		free(batch->_delete_ids);
+
+	memset(batch, 0, sizeof(struct usenet_nzb_batch));
+}
+
+/* the shared client, created on first use */
+static xmlrpc_client* _nzb_get_client(xmlrpc_env* env)
+{
+	pthread_mutex_lock(&_nzb_client_mutex);
+	if(_nzb_client == NULL) {
+		USENET_LOG_MESSAGE("initialising rpc client");
+
+		/* Start up our XML-RPC client library. */
+		xmlrpc_client_setup_global_const(env);
+		if(!env->fault_occurred) {
+			xmlrpc_client_create(env, XMLRPC_CLIENT_NO_FLAGS, NAME, VERSION, NULL, 0, &_nzb_client);
+			if(env->fault_occurred) {
+				_nzb_client = NULL;
+				xmlrpc_client_teardown_global_const();
+			}
+		}
+	}
+	pthread_mutex_unlock(&_nzb_client_mutex);
+
+	return _nzb_client;
+}
+
+/* list returned by a json rpc call */
+static int _nzb_json_list(const char* method, const char* params, struct usenet_nzb_filellist** f_list, size_t* num)
+{
+	int _ret = USENET_ERROR;
+	struct usenet_jsonrpc_res _res;
+
+	if(usenet_ujsonrpc_call(method, params, &_res) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	_ret = usenet_ujsonrpc_get_list(&_res, f_list, num);
+	usenet_ujsonrpc_free(&_res);
+
+	return _ret;
+}
+
+/* json rpc call returning a boolean */
+static int _nzb_json_bool(const char* method, const char* params)
+{
+	int _ret = USENET_ERROR;
+	struct usenet_jsonrpc_res _res;
+
+	if(usenet_ujsonrpc_call(method, params, &_res) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	_ret = usenet_ujsonrpc_result_true(&_res);
+	usenet_ujsonrpc_free(&_res);
+
+	return _ret;
+}
+
+/* remove the ids from the history in one editqueue */
+static int _nzb_json_delete(int* ids, size_t num)
+{
+	int _ret = USENET_ERROR;
+	size_t _i = 0, _len = 0, _sz = 0;
+	char* _params = NULL;
+
+	_sz = strlen(USENET_NZBGET_JSON_DELETE) + num * USENET_NZBGET_JSON_ID_SZ + 3;
+	_params = (char*) malloc(_sz);
+	if(_params == NULL)
+		return USENET_ERROR;
+
+	_len = (size_t) snprintf(_params, _sz, "%s", USENET_NZBGET_JSON_DELETE);
+	for(_i = 0; _i < num; _i++)
+		_len += (size_t) snprintf(_params + _len, _sz - _len, "%s%i", (_i > 0 ? "," : ""), ids[_i]);
+	snprintf(_params + _len, _sz - _len, "]]");
+
+	_ret = _nzb_json_bool(USENET_NZBGET_EDITQUEUE_METHOD, _params);
+	if(_ret == USENET_SUCCESS)
+		USENET_LOG_MESSAGE_ARGS("nzbget removed %lu items from the history", num);
+
+	free(_params);
+	return _ret;
+}
+
+/*
+ * nzbget takes system.multicall over xmlrpc only, the queued calls are
+ * sent one after the other on the kept connection.
+ */
+static int _nzb_json_flush(struct usenet_nzb_batch* batch)
+{
+	int _ret = USENET_SUCCESS;
+
+	if(batch->_num_delete > 0) {
+		batch->_delete_result = _nzb_json_delete(batch->_delete_ids, batch->_num_delete);
+		if(batch->_delete_result == USENET_SUCCESS)
+			batch->_num_delete = 0;
+		else
+			_ret = USENET_ERROR;
+	}
+	if(batch->_scan_flg) {
+		batch->_scan_result = _nzb_json_bool(USENET_NZBGET_SCAN_METHOD, NULL);
+		batch->_scan_flg = 0;
+	}
+	if(batch->_groups_flg) {
+		batch->_groups_result = _nzb_json_list(USENET_NZBGET_LISTGROUPS_METHOD,
+											   USENET_NZBGET_JSON_GROUPS_PARAS,
+											   &batch->_groups,
+											   &batch->_num_groups);
+		batch->_groups_flg = 0;
+	}
+	if(batch->_history_flg) {
+		batch->_history_result = _nzb_json_list(USENET_NZBGET_HISTORY_METHOD,
+												USENET_NZBGET_JSON_HISTORY_PARAS,
+												&batch->_history,
+												&batch->_num_history);
+		batch->_history_flg = 0;
+	}
+
+	return _ret;
+}
 
 /*
  * This fuction populates the file list struct.
@@ -440,59 +736,39 @@ static int _nzb_populate_flist(xmlrpc_env* env, xmlrpc_value* resultp, struct us
 	return USENET_SUCCESS;
 }
 
-static int _nzb_populate_flist2(xmlNodePtr member, struct usenet_nzb_filellist* f_list)
+/* set the field of the entry read from a member of the response */
+int usenet_nzb_set_field(struct usenet_nzb_filellist* f_list, const char* name, const char* value)
 {
-	xmlChar* _name = NULL;
-	char* _value = NULL;
-	xmlNodePtr _child_node = NULL;
-
-	/* get the member name */
-	_child_node = xmlFirstElementChild(member);
-	if(_child_node == NULL)
-		return USENET_ERROR;
-
-	_name = xmlNodeGetContent(_child_node);
-	usenet_uxmlrpc_get_member(member, (char*) _name, &_value);
-
-	if(_value == NULL)
-		goto cleanup;
+	if(f_list == NULL || name == NULL || value == NULL)
+		return USENET_ARG_ERROR;
 
-	if(strcmp((char*) _name, "NZBID") == 0) {
-		f_list->_nzb_id = atoi(_value);
+	if(strcmp(name, "NZBID") == 0) {
+		f_list->_nzb_id = atoi(value);
 	}
-	else if(strcmp((char*) _name, "NZBFilename") == 0) {
-		USENET_NZBGET_COPY_ELEMENT(f_list->_nzb_file_name,_value);
+	else if(strcmp(name, "NZBFilename") == 0) {
+		USENET_NZBGET_COPY_ELEMENT(f_list->_nzb_file_name, value);
 	}
-	else if(strcmp((char*) _name, "NZBName") == 0) {
-		USENET_NZBGET_COPY_ELEMENT(f_list->_nzb_name, _value);
+	else if(strcmp(name, "NZBName") == 0) {
+		USENET_NZBGET_COPY_ELEMENT(f_list->_nzb_name, value);
 	}
-	else if(strcmp((char*) _name, "DestDir") == 0) {
-		USENET_NZBGET_COPY_ELEMENT(f_list->_dest_dir, _value);
+	else if(strcmp(name, "DestDir") == 0) {
+		USENET_NZBGET_COPY_ELEMENT(f_list->_dest_dir, value);
 	}
-	else if(strcmp((char*) _name, "FinalDir") == 0) {
-		USENET_NZBGET_COPY_ELEMENT(f_list->_final_dir, _value);
+	else if(strcmp(name, "FinalDir") == 0) {
+		USENET_NZBGET_COPY_ELEMENT(f_list->_final_dir, value);
 	}
-	else if(strcmp((char*) _name, "FileSizeMB") == 0) {
-		f_list->_file_size = atoi(_value);
+	else if(strcmp(name, "FileSizeMB") == 0) {
+		f_list->_file_size = atoi(value);
 	}
-	else if(strcmp((char*) _name, "RemainingSizeMB") == 0) {
-		f_list->_remaining_size = atoi(_value);
+	else if(strcmp(name, "RemainingSizeMB") == 0) {
+		f_list->_remaining_size = atoi(value);
 	}
-	else if(strcmp((char*) _name, "ActiveDownloads") == 0) {
-		f_list->_active_downloads = atoi(_value);
+	else if(strcmp(name, "ActiveDownloads") == 0) {
+		f_list->_active_downloads = atoi(value);
 	}
-	else if(strcmp((char*) _name, "Status") == 0) {
-		USENET_NZBGET_COPY_ELEMENT(f_list->_status, _value);
+	else if(strcmp(name, "Status") == 0) {
+		USENET_NZBGET_COPY_ELEMENT(f_list->_status, value);
 	}
 
-cleanup:
-	if(_value)
-		free(_value);
-
-	if(_name)
-		xmlFree(_name);
-
-	_name = NULL;
-	_value = NULL;
 	return USENET_SUCCESS;
 }
@@ -0,0 +1,294 @@
+/*
+ * Supervision of the child processes started by the client. Children
+ * are tracked through process descriptors registered with the caller's
+ * epoll descriptor and reaped without blocking, the exit status and
+ * resource usage are passed to the exit callback of the child.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <signal.h>
+#include <spawn.h>
+#include <pthread.h>
+#include <sys/epoll.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+
+#include "usenet.h"
+
+extern char** environ;
+
+static int _usenet_proc_pidfd_open(pid_t pid);
+static int _usenet_proc_pidfd_send_signal(int pidfd, int sig);
+static int _usenet_proc_track(struct usenet_proc_supervisor* sup, pid_t pid, usenet_proc_exit_fn fn, void* ext_obj);
+static struct usenet_proc_child* _usenet_proc_find(struct usenet_proc_supervisor* sup, pid_t pid, int pidfd);
+static int _usenet_proc_remove(struct usenet_proc_supervisor* sup, pid_t pid, struct usenet_proc_child* child);
+static int _usenet_proc_report(struct usenet_proc_child* child, pid_t pid, int status, struct rusage* usage);
+
+/* initialise the supervisor, children are registered with the epoll descriptor */
+int usenet_proc_init(struct usenet_proc_supervisor* sup, int epoll_fd)
+{
+	if(sup == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(sup, 0, sizeof(struct usenet_proc_supervisor));
+	sup->_epoll_fd = epoll_fd;
+	pthread_mutex_init(&sup->_mutex, NULL);
+
+	return USENET_SUCCESS;
+}
+
+/* start the program in argv with the default signal mask */
+int usenet_proc_spawn(struct usenet_proc_supervisor* sup, char* const argv[], usenet_proc_exit_fn fn, void* ext_obj, pid_t* pid)
+{
+	int _ret = 0;
+	pid_t _pid = -1;
+	sigset_t _mask;
+	posix_spawnattr_t _attr;
+
+	if(sup == NULL || argv == NULL || argv[0] == NULL)
+		return USENET_ARG_ERROR;
+
+	/* the child can't be reaped before it is tracked */
+	pthread_mutex_lock(&sup->_mutex);
+	if(sup->_num_children >= USENET_PROC_MAX_CHILDREN) {
+		pthread_mutex_unlock(&sup->_mutex);
+		USENET_LOG_MESSAGE_ARGS("unable to spawn %s, too many children", argv[0]);
+		return USENET_ERROR;
+	}
+
+	/* the caller blocks signals for its event loop, don't pass them on */
+	sigemptyset(&_mask);
+	posix_spawnattr_init(&_attr);
+	posix_spawnattr_setsigmask(&_attr, &_mask);
+	posix_spawnattr_setflags(&_attr, POSIX_SPAWN_SETSIGMASK);
+
+	_ret = posix_spawnp(&_pid, argv[0], NULL, &_attr, argv, environ);
+	posix_spawnattr_destroy(&_attr);
+
+	if(_ret == 0)
+		_usenet_proc_track(sup, _pid, fn, ext_obj);
+	pthread_mutex_unlock(&sup->_mutex);
+
+	if(_ret != 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to spawn %s, %s", argv[0], strerror(_ret));
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("spawned %s with pid %i", argv[0], _pid);
+
+	if(pid)
+		*pid = _pid;
+
+	return USENET_SUCCESS;
+}
+
+/*
+ * Handle an epoll event. Returns USENET_SUCCESS if the descriptor
+ * belonged to a child and USENET_ERROR otherwise.
+ */
+int usenet_proc_handle_event(struct usenet_proc_supervisor* sup, int fd)
+{
+	int _status = 0;
+	pid_t _pid = 0;
+	struct rusage _usage;
+	struct usenet_proc_child _child;
+	struct usenet_proc_child* _ptr = NULL;
+
+	pthread_mutex_lock(&sup->_mutex);
+	_ptr = _usenet_proc_find(sup, 0, fd);
+	if(_ptr == NULL) {
+		pthread_mutex_unlock(&sup->_mutex);
+		return USENET_ERROR;
+	}
+
+	_pid = wait4(_ptr->_pid, &_status, WNOHANG, &_usage);
+	if(_pid == _ptr->_pid)
+		_usenet_proc_remove(sup, _pid, &_child);
+	pthread_mutex_unlock(&sup->_mutex);
+
+	/* report outside the lock, the callback may start a new child */
+	if(_pid > 0)
+		_usenet_proc_report(&_child, _pid, _status, &_usage);
+
+	return USENET_SUCCESS;
+}
+
+/* reap every child which has exited, called on SIGCHLD */
+int usenet_proc_reap(struct usenet_proc_supervisor* sup)
+{
+	int _status = 0;
+	pid_t _pid = 0;
+	struct rusage _usage;
+	struct usenet_proc_child _child;
+
+	while(1) {
+		pthread_mutex_lock(&sup->_mutex);
+		_pid = wait4(-1, &_status, WNOHANG, &_usage);
+		if(_pid > 0 && _usenet_proc_remove(sup, _pid, &_child) != USENET_SUCCESS) {
+			USENET_LOG_MESSAGE_ARGS("reaped untracked process %i", _pid);
+			memset(&_child, 0, sizeof(struct usenet_proc_child));
+		}
+		pthread_mutex_unlock(&sup->_mutex);
+
+		if(_pid <= 0)
+			break;
+
+		_usenet_proc_report(&_child, _pid, _status, &_usage);
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* signal a child, only the children tracked by the supervisor are signalled */
+int usenet_proc_kill(struct usenet_proc_supervisor* sup, pid_t pid, int sig)
+{
+	int _ret = USENET_ERROR;
+	struct usenet_proc_child* _child = NULL;
+
+	pthread_mutex_lock(&sup->_mutex);
+	_child = _usenet_proc_find(sup, pid, -1);
+
+	/* the descriptor can't refer to a recycled pid */
+	if(_child && _child->_pidfd >= 0)
+		_ret = _usenet_proc_pidfd_send_signal(_child->_pidfd, sig);
+	else if(_child)
+		_ret = (kill(pid, sig) == 0 ? USENET_SUCCESS : USENET_ERROR);
+	pthread_mutex_unlock(&sup->_mutex);
+
+	if(_child == NULL)
+		USENET_LOG_MESSAGE_ARGS("process %i is not a child, ignoring", pid);
+
+	return _ret;
+}
+
+/* release the descriptors, the children are left running */
+int usenet_proc_destroy(struct usenet_proc_supervisor* sup)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < sup->_num_children; _i++) {
+		if(sup->_children[_i]._pidfd >= 0)
+			close(sup->_children[_i]._pidfd);
+	}
+
+	sup->_num_children = 0;
+	pthread_mutex_destroy(&sup->_mutex);
+	return USENET_SUCCESS;
+}
+
+static int _usenet_proc_pidfd_open(pid_t pid)
+{
+#ifdef SYS_pidfd_open
+	return (int) syscall(SYS_pidfd_open, pid, 0);
+#else
+	errno = ENOSYS;
+	return -1;
+#endif
+}
+
+static int _usenet_proc_pidfd_send_signal(int pidfd, int sig)
+{
+#ifdef SYS_pidfd_send_signal
+	if(syscall(SYS_pidfd_send_signal, pidfd, sig, NULL, 0) == 0)
+		return USENET_SUCCESS;
+#endif
+	return USENET_ERROR;
+}
+
+/* add the child to the table and watch its descriptor */
+static int _usenet_proc_track(struct usenet_proc_supervisor* sup, pid_t pid, usenet_proc_exit_fn fn, void* ext_obj)
+{
+	struct epoll_event _ev = {0};
+	struct usenet_proc_child* _child = &sup->_children[sup->_num_children++];
+
+	_child->_pid = pid;
+	_child->_exit_fn = fn;
+	_child->_ext_obj = ext_obj;
+	clock_gettime(CLOCK_MONOTONIC, &_child->_start);
+
+	_child->_pidfd = _usenet_proc_pidfd_open(pid);
+	if(_child->_pidfd < 0) {
+		USENET_LOG_MESSAGE_ARGS("no process descriptor for %i, %s", pid, strerror(errno));
+		return USENET_SUCCESS;
+	}
+
+	_ev.events = EPOLLIN;
+	_ev.data.fd = _child->_pidfd;
+	if(sup->_epoll_fd >= 0 && epoll_ctl(sup->_epoll_fd, EPOLL_CTL_ADD, _child->_pidfd, &_ev)) {
+		USENET_LOG_MESSAGE_ARGS("unable to watch process %i, %s", pid, strerror(errno));
+		close(_child->_pidfd);
+		_child->_pidfd = -1;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* find the child by pid or by descriptor */
+static struct usenet_proc_child* _usenet_proc_find(struct usenet_proc_supervisor* sup, pid_t pid, int pidfd)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < sup->_num_children; _i++) {
+		if((pid > 0 && sup->_children[_i]._pid == pid) ||
+		   (pidfd >= 0 && sup->_children[_i]._pidfd == pidfd))
+			return &sup->_children[_i];
+	}
+
+	return NULL;
+}
+
+/* remove the reaped child from the table, caller holds the mutex */
+static int _usenet_proc_remove(struct usenet_proc_supervisor* sup, pid_t pid, struct usenet_proc_child* child)
+{
+	struct usenet_proc_child* _ptr = NULL;
+
+	_ptr = _usenet_proc_find(sup, pid, -1);
+	if(_ptr == NULL)
+		return USENET_ERROR;
+
+	*child = *_ptr;
+	*_ptr = sup->_children[--sup->_num_children];
+
+	if(child->_pidfd >= 0) {
+		if(sup->_epoll_fd >= 0)
+			epoll_ctl(sup->_epoll_fd, EPOLL_CTL_DEL, child->_pidfd, NULL);
+		close(child->_pidfd);
+		child->_pidfd = -1;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* log the exit status and resource usage and call the exit callback */
+static int _usenet_proc_report(struct usenet_proc_child* child, pid_t pid, int status, struct rusage* usage)
+{
+	struct timespec _now;
+	struct usenet_proc_stat _stat = {0};
+
+	_stat._pid = pid;
+	_stat._status = status;
+	_stat._cpu_time = (double) (usage->ru_utime.tv_sec + usage->ru_stime.tv_sec) +
+		(double) (usage->ru_utime.tv_usec + usage->ru_stime.tv_usec) / 1000000.0;
+	_stat._max_rss = usage->ru_maxrss;
+
+	if(child->_pid == pid) {
+		clock_gettime(CLOCK_MONOTONIC, &_now);
+		_stat._wall_time = (double) (_now.tv_sec - child->_start.tv_sec) +
+			(double) (_now.tv_nsec - child->_start.tv_nsec) / 1000000000.0;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("process %i finished with status %i, cpu %.2fs, max rss %likB, wall %.2fs",
+							pid,
+							WIFEXITED(status) ? WEXITSTATUS(status) : -WTERMSIG(status),
+							_stat._cpu_time,
+							_stat._max_rss,
+							_stat._wall_time);
+
+	if(child->_pid == pid && child->_exit_fn)
+		child->_exit_fn(child->_ext_obj, &_stat);
+
+	return USENET_SUCCESS;
+}
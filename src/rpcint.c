@@ -0,0 +1,175 @@
+/*
+ * Table driven dispatch of the remote procedure calls broadcast between
+ * the client processes. Handlers are registered once against a name and
+ * an opcode, json messages are resolved by name and binary messages by
+ * opcode.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include "usenet.h"
+#include "jsmn.h"
+
+#define USENET_RPC_FNV_OFFSET 2166136261u
+#define USENET_RPC_FNV_PRIME 16777619u
+
+static inline __attribute__ ((always_inline)) unsigned int _usenet_rpc_hash(const char* name, size_t len);
+static int _usenet_rpc_call(struct usenet_rpc_table* table, struct usenet_rpc_call* call);
+
+/* initialise the table */
+int usenet_rpc_init(struct usenet_rpc_table* table, void* ext_obj)
+{
+	if(table == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(table, 0, sizeof(struct usenet_rpc_table));
+	table->_ext_obj = ext_obj;
+
+	return USENET_SUCCESS;
+}
+
+/* bind the handler to the name and opcode */
+int usenet_rpc_register(struct usenet_rpc_table* table, const char* name, unsigned char opcode, usenet_rpc_fn fn)
+{
+	int _i = 0;
+	unsigned int _hash = 0, _ix = 0;
+
+	if(table == NULL || fn == NULL || opcode == 0 || opcode >= USENET_RPC_MAX_OPCODE)
+		return USENET_ARG_ERROR;
+
+	table->_handlers[opcode] = fn;
+
+	/* binary only rpc */
+	if(name == NULL)
+		return USENET_SUCCESS;
+
+	_hash = _usenet_rpc_hash(name, strlen(name));
+
+	/* linear probe for a free or matching slot */
+	for(_i = 0; _i < USENET_RPC_NAME_TABLE_SZ; _i++) {
+		_ix = (_hash + _i) & (USENET_RPC_NAME_TABLE_SZ - 1);
+
+		if(table->_names[_ix]._name == NULL ||
+		   strcmp(table->_names[_ix]._name, name) == 0) {
+			table->_names[_ix]._hash = _hash;
+			table->_names[_ix]._opcode = opcode;
+			table->_names[_ix]._name = name;
+			return USENET_SUCCESS;
+		}
+	}
+
+	USENET_LOG_MESSAGE_ARGS("rpc table is full, unable to register %s", name);
+	return USENET_ERROR;
+}
+
+/*
+ * Returns the opcode of the name, the name doesn't need to be NULL
+ * terminated. Zero is returned if the name was not registered.
+ */
+int usenet_rpc_lookup(struct usenet_rpc_table* table, const char* name, size_t len)
+{
+	int _i = 0;
+	unsigned int _hash = 0, _ix = 0;
+
+	if(table == NULL || name == NULL)
+		return 0;
+
+	_hash = _usenet_rpc_hash(name, len);
+	for(_i = 0; _i < USENET_RPC_NAME_TABLE_SZ; _i++) {
+		_ix = (_hash + _i) & (USENET_RPC_NAME_TABLE_SZ - 1);
+
+		/* empty slot terminates the probe */
+		if(table->_names[_ix]._name == NULL)
+			break;
+
+		if(table->_names[_ix]._hash == _hash &&
+		   strncmp(table->_names[_ix]._name, name, len) == 0 &&
+		   table->_names[_ix]._name[len] == '\0')
+			return table->_names[_ix]._opcode;
+	}
+
+	return 0;
+}
+
+/* parse the json message and call the handler bound to the rpc name */
+int usenet_rpc_dispatch_json(struct usenet_rpc_table* table, const char* msg)
+{
+	int _num = 0, _ret = USENET_SUCCESS;
+	jsmntok_t* _tok = NULL, *_rpc_tok = NULL;
+	struct usenet_rpc_call _call = {0};
+
+	if(table == NULL || msg == NULL)
+		return USENET_ARG_ERROR;
+
+	if(usjson_parse_message(msg, &_tok, &_num) != USENET_SUCCESS) {
+		if(_tok)
+			free(_tok);
+		return USENET_ERROR;
+	}
+
+	/* only the token is needed, the value is hashed in place */
+	if(usjson_get_token(msg, _tok, _num, USENET_JSON_FN_HEADER, NULL, &_rpc_tok) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("json parser error");
+		_ret = USENET_ERROR;
+		goto clean_up;
+	}
+
+	_call._opcode = usenet_rpc_lookup(table, msg + _rpc_tok->start, _rpc_tok->end - _rpc_tok->start);
+	_call._json = msg;
+	_call._tok = _tok;
+	_call._num_tok = _num;
+
+	_ret = _usenet_rpc_call(table, &_call);
+
+clean_up:
+	if(_tok)
+		free(_tok);
+
+	return _ret;
+}
+
+/* decode the binary payload and call the handler bound to the opcode */
+int usenet_rpc_dispatch_bin(struct usenet_rpc_table* table, const char* buff, size_t sz)
+{
+	struct usenet_rpc_call _call = {0};
+
+	if(table == NULL)
+		return USENET_ARG_ERROR;
+
+	if(usenet_bin_decode(buff, sz, &_call._payload) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to decode binary payload");
+		return USENET_ERROR;
+	}
+
+	_call._opcode = _call._payload._opcode;
+	return _usenet_rpc_call(table, &_call);
+}
+
+/* call the handler of the opcode */
+static int _usenet_rpc_call(struct usenet_rpc_table* table, struct usenet_rpc_call* call)
+{
+	if(call->_opcode == 0 ||
+	   call->_opcode >= USENET_RPC_MAX_OPCODE ||
+	   table->_handlers[call->_opcode] == NULL) {
+		USENET_LOG_MESSAGE_ARGS("no handler registered for rpc opcode %i", call->_opcode);
+		return USENET_ERROR;
+	}
+
+	return table->_handlers[call->_opcode](table->_ext_obj, call);
+}
+
+/* FNV-1a hash of the name */
+static inline __attribute__ ((always_inline)) unsigned int _usenet_rpc_hash(const char* name, size_t len)
+{
+	size_t _i = 0;
+	unsigned int _hash = USENET_RPC_FNV_OFFSET;
+
+	for(_i = 0; _i < len; _i++) {
+		_hash ^= (unsigned char) name[_i];
+		_hash *= USENET_RPC_FNV_PRIME;
+	}
+
+	return _hash;
+}
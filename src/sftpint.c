@@ -0,0 +1,748 @@
+/*
+ * Resumable transfers over sftp. The size of the remote partial file and
+ * a local checkpoint decide where to continue, the tail of the prefix
+ * already on the server is read back and compared before appending.
+ * Large files can be split into segments written in parallel, each over
+ * its own session so the ciphers run on several cores.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+#include "usenet.h"
+
+/* checkpoint of an interrupted transfer */
+struct _usenet_sftp_ckpt
+{
+	long long _size;												/* size of the source when it was written */
+	long long _mtime;												/* modification time of the source */
+	long long _offset;												/* bytes confirmed written to the server */
+};
+
+/* range of the source written by one stream */
+struct _usenet_sftp_segment
+{
+	struct gapi_login* _config;
+	const char* _target;
+	int _fd;
+	long long _start;
+	long long _end;
+	volatile size_t _sent;											/* bytes of the range written */
+	volatile int _done_flg;
+	volatile int* _stop_flg;										/* shared, set to cancel every stream */
+	int _verify_flg;												/* hash the range and check the remote range */
+	int _num_streams;												/* the transfer rate is split over the streams */
+	int _result;
+	pthread_t _thread;
+};
+
+static int _usenet_sftp_streams(struct gapi_login* config, const struct stat* fstat);
+static int _usenet_sftp_segmented(struct gapi_login* config,
+								  int fd,
+								  const char* source,
+								  const char* target,
+								  const struct stat* fstat,
+								  int num_streams,
+								  int (*prog)(void*, float),
+								  void* ext_obj,
+								  struct usenet_transfer_stat* stat);
+static void* _usenet_sftp_segment_worker(void* obj);
+static int _usenet_sftp_hash_prefix(int fd, char* buf, size_t sz, long long offset, struct usenet_hash* hash);
+static int _usenet_sftp_ckpt_path(struct gapi_login* config, const char* target, char* path, size_t sz);
+static int _usenet_sftp_ckpt_load(const char* path, struct _usenet_sftp_ckpt* ckpt);
+static int _usenet_sftp_ckpt_save(const char* path, const struct _usenet_sftp_ckpt* ckpt);
+static long long _usenet_sftp_resume_offset(LIBSSH2_SFTP* sftp,
+											int fd,
+											const char* target,
+											const struct stat* fstat,
+											const struct _usenet_sftp_ckpt* ckpt);
+static int _usenet_sftp_verify_prefix(LIBSSH2_SFTP* sftp, int fd, const char* target, long long offset);
+static int _usenet_sftp_replace(LIBSSH2_SFTP* sftp, const char* from, const char* to);
+
+/* copy the source to the target over sftp, continuing an interrupted copy */
+int usenet_sftp_transfer_file(struct gapi_login* config,
+							  const char* source,
+							  const char* target,
+							  int (*prog)(void*, float),
+							  void* ext_obj,
+							  struct usenet_transfer_stat* stat)
+{
+	int _fd = -1, _ret = USENET_ERROR, _ckpt_flg = 0, _num = 0, _verify_flg = 0;
+	ssize_t _nread = 0, _rc = 0;
+	size_t _off = 0, _sz = 0, _sent = 0, _since_ckpt = 0;
+	long long _offset = 0;
+	double _secs = 0.0, _mbps = 0.0;
+	char* _buf = NULL;
+	char _ckpt_path[USENET_TRANSFER_PATH_SZ] = {0};
+	char _local[USENET_HASH_HEX_SZ] = {0}, _remote[USENET_HASH_HEX_SZ] = {0};
+	struct usenet_hash _hash = {0};
+	struct usenet_shape_bucket _bucket;
+	struct stat _fstat = {0};
+	struct timespec _start;
+	struct _usenet_sftp_ckpt _ckpt = {0};
+	struct usenet_ssh_conn* _conn = NULL;
+	LIBSSH2_SFTP* _sftp = NULL;
+	LIBSSH2_SFTP_HANDLE* _handle = NULL;
+
+	if(config == NULL || source == NULL || target == NULL)
+		return USENET_ARG_ERROR;
+
+	_fd = usenet_transfer_open_source(config, source, &_fstat);
+	if(_fd < 0)
+		return USENET_ERROR;
+	clock_gettime(CLOCK_MONOTONIC, &_start);
+
+	/* large files go over several streams, these are not resumed */
+	_num = _usenet_sftp_streams(config, &_fstat);
+	if(_num > 1) {
+		_ret = _usenet_sftp_segmented(config, _fd, source, target, &_fstat, _num, prog, ext_obj, stat);
+		close(_fd);
+		return _ret;
+	}
+
+	_sz = USENET_TRANSFER_BUFFER_SIZE(config);
+	if(posix_memalign((void**) &_buf, USENET_TRANSFER_ALIGN, _sz) != 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to allocate %lu byte transfer buffer", _sz);
+		_buf = NULL;
+		goto cleanup;
+	}
+
+	/* a checkpoint only applies to the same version of the source */
+	_ckpt_flg = (_usenet_sftp_ckpt_path(config, target, _ckpt_path, USENET_TRANSFER_PATH_SZ) == USENET_SUCCESS);
+	if(!_ckpt_flg ||
+	   _usenet_sftp_ckpt_load(_ckpt_path, &_ckpt) != USENET_SUCCESS ||
+	   _ckpt._size != (long long) _fstat.st_size ||
+	   _ckpt._mtime != (long long) _fstat.st_mtime)
+		_ckpt._offset = -1;
+
+	_ckpt._size = (long long) _fstat.st_size;
+	_ckpt._mtime = (long long) _fstat.st_mtime;
+
+	_conn = usenet_ssh_acquire(config, 0);
+	if(_conn == NULL)
+		goto cleanup;
+
+	_sftp = libssh2_sftp_init(usenet_ssh_get_session(_conn));
+	if(_sftp == NULL) {
+		USENET_LOG_MESSAGE("unable to start the sftp subsystem");
+		goto cleanup;
+	}
+
+	_offset = _usenet_sftp_resume_offset(_sftp, _fd, target, &_fstat, &_ckpt);
+
+	usenet_shape_init(&_bucket, config, 1);
+	_verify_flg = USENET_TRANSFER_VERIFY_FLG(config);
+	if(_verify_flg && usenet_hash_init(&_hash) != USENET_SUCCESS)
+		goto cleanup;
+
+	/* an existing copy which can't be resumed is patched block by block */
+	if(_offset == 0 && USENET_TRANSFER_DELTA_FLG(config)) {
+		if(usenet_sync_delta(config, _conn, _sftp, _fd, &_fstat, target, (_verify_flg ? &_hash : NULL), &_sent) == USENET_SUCCESS)
+			goto verify;
+
+		/* start over with a full copy */
+		_sent = 0;
+		usenet_hash_free(&_hash);
+		if(_verify_flg && usenet_hash_init(&_hash) != USENET_SUCCESS)
+			goto cleanup;
+	}
+
+	/* open the remote file, truncate unless continuing */
+	_handle = libssh2_sftp_open(_sftp,
+								target,
+								LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | (_offset > 0 ? 0 : LIBSSH2_FXF_TRUNC),
+								_fstat.st_mode & 0777);
+	if(_handle == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to open the remote file %s, sftp error %lu", target, libssh2_sftp_last_error(_sftp));
+		goto cleanup;
+	}
+
+	if(_offset > 0) {
+		USENET_LOG_MESSAGE_ARGS("resuming %s at %lli of %lli bytes", target, _offset, (long long) _fstat.st_size);
+		libssh2_sftp_seek64(_handle, (libssh2_uint64_t) _offset);
+
+		/* the prefix sent before was not hashed, read it once here */
+		if(_verify_flg && _usenet_sftp_hash_prefix(_fd, _buf, _sz, _offset, &_hash) != USENET_SUCCESS)
+			goto cleanup;
+	}
+
+	while(1) {
+		_nread = usenet_transfer_read(_fd, _buf, _sz, (off_t) (_offset + (long long) _sent));
+		if(_nread < 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to read the source file, %s", strerror(errno));
+			goto cleanup;
+		}
+		if(_nread == 0)
+			break;
+
+		/* sftp writes may be partial */
+		for(_off = 0; _off < (size_t) _nread; _off += (size_t) _rc) {
+			_rc = libssh2_sftp_write(_handle, _buf + _off, (size_t) _nread - _off);
+			if(_rc < 0) {
+				USENET_LOG_MESSAGE_ARGS("errors occured writing to %s", target);
+				goto cleanup;
+			}
+		}
+
+		if(_verify_flg)
+			usenet_hash_update(&_hash, _buf, (size_t) _nread);
+		usenet_shape_take(&_bucket, config, (size_t) _nread);
+		usenet_transfer_release_pages(_fd, (off_t) (_offset + (long long) _sent), (size_t) _nread);
+		_sent += (size_t) _nread;
+		_since_ckpt += (size_t) _nread;
+
+		/* record how far the server has got */
+		if(_ckpt_flg && _since_ckpt >= USENET_TRANSFER_CHECKPOINT_SZ) {
+			_ckpt._offset = _offset + (long long) _sent;
+			_usenet_sftp_ckpt_save(_ckpt_path, &_ckpt);
+			_since_ckpt = 0;
+		}
+
+		if(prog != NULL && _fstat.st_size > 0 &&
+		   prog(ext_obj, (float) (_offset + (long long) _sent) / (float) _fstat.st_size) != USENET_SUCCESS) {
+			USENET_LOG_MESSAGE_ARGS("transfer of %s cancelled", source);
+			goto cleanup;
+		}
+	}
+
+	/* close the handle here so that the result of the close counts */
+	_rc = libssh2_sftp_close(_handle);
+	_handle = NULL;
+	if(_rc != 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to close the remote file %s", target);
+		goto cleanup;
+	}
+
+verify:
+	/* compare with the hash of the copy on the server */
+	if(_verify_flg) {
+		usenet_hash_final(&_hash, _local, USENET_HASH_HEX_SZ);
+		if(usenet_hash_remote(_conn, target, 0, 0, _remote, USENET_HASH_HEX_SZ) != USENET_SUCCESS ||
+		   strcmp(_local, _remote) != 0) {
+			USENET_LOG_MESSAGE_ARGS("remote copy of %s failed verification, sent %s, remote %s", source, _local, _remote);
+
+			/* don't resume on top of a corrupt copy */
+			_sent = 0;
+			if(_ckpt_flg)
+				unlink(_ckpt_path);
+			goto cleanup;
+		}
+		USENET_LOG_MESSAGE_ARGS("verified %s, sha256 %s", target, _local);
+	}
+
+	/* the transfer is complete, the checkpoint is not needed */
+	if(_ckpt_flg)
+		unlink(_ckpt_path);
+
+	_secs = usenet_utils_elapsed(&_start);
+	_mbps = (_secs > 0.0 ? (double) _sent / (1000.0 * 1000.0) / _secs : 0.0);
+	USENET_LOG_MESSAGE_ARGS("transferred %lu bytes of %s in %.2fs, %.2f MB/s, resumed at %lli",
+							_sent, source, _secs, _mbps, _offset);
+
+	if(stat) {
+		stat->_bytes = _sent;
+		stat->_seconds = _secs;
+		stat->_mbps = _mbps;
+	}
+
+	_ret = USENET_SUCCESS;
+
+cleanup:
+	/* keep the progress of a failed transfer for the next attempt */
+	if(_ret != USENET_SUCCESS && _ckpt_flg && _sent > 0) {
+		_ckpt._offset = _offset + (long long) _sent;
+		_usenet_sftp_ckpt_save(_ckpt_path, &_ckpt);
+	}
+
+	if(_handle)
+		libssh2_sftp_close(_handle);
+	if(_sftp)
+		libssh2_sftp_shutdown(_sftp);
+	if(_conn)
+		usenet_ssh_release(_conn, _ret != USENET_SUCCESS);
+	if(_buf)
+		free(_buf);
+	if(_fd >= 0)
+		close(_fd);
+	usenet_hash_free(&_hash);
+
+	return _ret;
+}
+
+/*
+ * Number of streams for the file, 1 if it is not split. Every worker may
+ * split a file at once, the streams of all of them fit in the session cache.
+ */
+static int _usenet_sftp_streams(struct gapi_login* config, const struct stat* fstat)
+{
+	int _num = config->transfer_streams, _workers = 0;
+	long long _threshold = 0;
+
+	_workers = (config->transfer_workers > 0 ? config->transfer_workers : USENET_TRANSFER_DEF_WORKERS);
+	if(_workers > USENET_TRANSFER_MAX_WORKERS)
+		_workers = USENET_TRANSFER_MAX_WORKERS;
+
+	if(_num > USENET_TRANSFER_MAX_STREAMS)
+		_num = USENET_TRANSFER_MAX_STREAMS;
+	if(_num > USENET_SSH_MAX_SESSIONS / _workers)
+		_num = USENET_SSH_MAX_SESSIONS / _workers;
+	if(_num <= 1)
+		return 1;
+
+	_threshold = (long long) (config->segment_threshold_mb > 0 ? config->segment_threshold_mb : USENET_TRANSFER_DEF_SEGMENT_MB) * 1024 * 1024;
+	return ((long long) fstat->st_size >= _threshold ? _num : 1);
+}
+
+/*
+ * Split the source into buffer aligned ranges written in parallel at
+ * their offsets, progress is summed over the streams on this thread.
+ * The ranges go to a part file which is renamed to the target once
+ * every stream finished and its size matches, so a copy cut short
+ * never leaves a target with holes. No session is held while the
+ * streams run.
+ */
+static int _usenet_sftp_segmented(struct gapi_login* config,
+								  int fd,
+								  const char* source,
+								  const char* target,
+								  const struct stat* fstat,
+								  int num_streams,
+								  int (*prog)(void*, float),
+								  void* ext_obj,
+								  struct usenet_transfer_stat* stat)
+{
+	int _i = 0, _num = 0, _started = 0, _running = 0, _ret = USENET_ERROR;
+	volatile int _stop_flg = 0;
+	size_t _sent = 0, _sz = 0;
+	long long _seg_sz = 0;
+	double _secs = 0.0, _mbps = 0.0;
+	struct timespec _start, _tick = {0, 100 * 1000 * 1000};
+	struct _usenet_sftp_segment _segs[USENET_TRANSFER_MAX_STREAMS];
+	struct usenet_ssh_conn* _conn = NULL;
+	LIBSSH2_SFTP* _sftp = NULL;
+	LIBSSH2_SFTP_HANDLE* _handle = NULL;
+	LIBSSH2_SFTP_ATTRIBUTES _attrs = {0};
+	char _part[USENET_TRANSFER_PATH_SZ] = {0};
+
+	clock_gettime(CLOCK_MONOTONIC, &_start);
+	memset(_segs, 0, sizeof(_segs));
+
+	if(snprintf(_part, USENET_TRANSFER_PATH_SZ, "%s%s", target, USENET_TRANSFER_PART_SUFFIX) >= USENET_TRANSFER_PATH_SZ) {
+		USENET_LOG_MESSAGE_ARGS("remote path %s is too long", target);
+		return USENET_ERROR;
+	}
+
+	/* create or truncate the part file before the streams write into it, a failed copy left one behind */
+	_conn = usenet_ssh_acquire(config, 0);
+	if(_conn == NULL)
+		return USENET_ERROR;
+
+	_sftp = libssh2_sftp_init(usenet_ssh_get_session(_conn));
+	if(_sftp == NULL) {
+		USENET_LOG_MESSAGE("unable to start the sftp subsystem");
+		goto cleanup;
+	}
+
+	_handle = libssh2_sftp_open(_sftp,
+								_part,
+								LIBSSH2_FXF_WRITE | LIBSSH2_FXF_CREAT | LIBSSH2_FXF_TRUNC,
+								fstat->st_mode & 0777);
+	if(_handle == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to open the remote file %s, sftp error %lu", _part, libssh2_sftp_last_error(_sftp));
+		goto cleanup;
+	}
+	libssh2_sftp_close(_handle);
+	_handle = NULL;
+
+	/* the streams take sessions of their own, the setup session goes back to the cache */
+	libssh2_sftp_shutdown(_sftp);
+	_sftp = NULL;
+	usenet_ssh_release(_conn, 0);
+	_conn = NULL;
+
+	/*
+	 * Segments end on a buffer boundary. Rounding up may leave fewer
+	 * ranges than streams, no stream is started for an empty range.
+	 */
+	_sz = USENET_TRANSFER_BUFFER_SIZE(config);
+	_seg_sz = ((long long) fstat->st_size / num_streams + (long long) _sz - 1) / (long long) _sz * (long long) _sz;
+	if(_seg_sz <= 0)
+		_seg_sz = (long long) _sz;
+
+	_num = (int) (((long long) fstat->st_size + _seg_sz - 1) / _seg_sz);
+	if(_num > num_streams)
+		_num = num_streams;
+
+	for(_i = 0; _i < _num; _i++) {
+		_segs[_i]._config = config;
+		_segs[_i]._target = _part;
+		_segs[_i]._fd = fd;
+		_segs[_i]._stop_flg = &_stop_flg;
+		_segs[_i]._verify_flg = USENET_TRANSFER_VERIFY_FLG(config);
+		_segs[_i]._num_streams = _num;
+		_segs[_i]._result = USENET_ERROR;
+		_segs[_i]._start = _seg_sz * _i;
+		_segs[_i]._end = _seg_sz * (_i + 1);
+		if(_i == _num - 1 || _segs[_i]._end > (long long) fstat->st_size)
+			_segs[_i]._end = (long long) fstat->st_size;
+
+		if(pthread_create(&_segs[_i]._thread, NULL, _usenet_sftp_segment_worker, &_segs[_i]) != 0) {
+			USENET_LOG_MESSAGE("unable to start a transfer stream");
+			_stop_flg = 1;
+			break;
+		}
+		_started++;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("writing %s over %i streams", target, _started);
+
+	/* report the progress until every stream has finished */
+	do {
+		nanosleep(&_tick, NULL);
+
+		for(_i = 0, _running = 0, _sent = 0; _i < _started; _i++) {
+			_sent += _segs[_i]._sent;
+			_running += !_segs[_i]._done_flg;
+		}
+
+		if(!_stop_flg && prog != NULL && fstat->st_size > 0 &&
+		   prog(ext_obj, (float) _sent / (float) fstat->st_size) != USENET_SUCCESS) {
+			USENET_LOG_MESSAGE_ARGS("transfer of %s cancelled", source);
+			_stop_flg = 1;
+		}
+	} while(_running > 0);
+
+	for(_i = 0, _sent = 0; _i < _started; _i++) {
+		pthread_join(_segs[_i]._thread, NULL);
+		_sent += _segs[_i]._sent;
+		if(_segs[_i]._result != USENET_SUCCESS)
+			_stop_flg = 1;
+	}
+
+	if(_stop_flg || _started < _num)
+		goto cleanup;
+
+	/* every range must have landed */
+	_conn = usenet_ssh_acquire(config, 0);
+	if(_conn == NULL)
+		goto cleanup;
+
+	_sftp = libssh2_sftp_init(usenet_ssh_get_session(_conn));
+	if(_sftp == NULL) {
+		USENET_LOG_MESSAGE("unable to start the sftp subsystem");
+		goto cleanup;
+	}
+
+	if(libssh2_sftp_stat(_sftp, _part, &_attrs) != 0 ||
+	   !(_attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ||
+	   _attrs.filesize != (libssh2_uint64_t) fstat->st_size) {
+		USENET_LOG_MESSAGE_ARGS("size of the remote file %s does not match the source", _part);
+		goto cleanup;
+	}
+
+	if(_usenet_sftp_replace(_sftp, _part, target) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE_ARGS("unable to rename %s to %s, sftp error %lu", _part, target, libssh2_sftp_last_error(_sftp));
+		goto cleanup;
+	}
+
+	_secs = usenet_utils_elapsed(&_start);
+	_mbps = (_secs > 0.0 ? (double) _sent / (1000.0 * 1000.0) / _secs : 0.0);
+	USENET_LOG_MESSAGE_ARGS("transferred %lu bytes of %s in %.2fs, %.2f MB/s over %i streams",
+							_sent, source, _secs, _mbps, _num);
+
+	if(stat) {
+		stat->_bytes = _sent;
+		stat->_seconds = _secs;
+		stat->_mbps = _mbps;
+	}
+
+	_ret = USENET_SUCCESS;
+
+cleanup:
+	if(_sftp)
+		libssh2_sftp_shutdown(_sftp);
+	if(_conn)
+		usenet_ssh_release(_conn, _sftp == NULL);
+
+	return _ret;
+}
+
+/* write one range of the source over a session of its own */
+static void* _usenet_sftp_segment_worker(void* obj)
+{
+	struct _usenet_sftp_segment* _seg = (struct _usenet_sftp_segment*) obj;
+	ssize_t _nread = 0, _rc = 0;
+	size_t _off = 0, _sz = 0, _len = 0;
+	long long _pos = _seg->_start;
+	char* _buf = NULL;
+	char _local[USENET_HASH_HEX_SZ] = {0}, _remote[USENET_HASH_HEX_SZ] = {0};
+	struct usenet_hash _hash = {0};
+	struct usenet_shape_bucket _bucket;
+	struct usenet_ssh_conn* _conn = NULL;
+	LIBSSH2_SFTP* _sftp = NULL;
+	LIBSSH2_SFTP_HANDLE* _handle = NULL;
+
+	usenet_shape_init(&_bucket, _seg->_config, _seg->_num_streams);
+	_sz = USENET_TRANSFER_BUFFER_SIZE(_seg->_config);
+	if(posix_memalign((void**) &_buf, USENET_TRANSFER_ALIGN, _sz) != 0) {
+		_buf = NULL;
+		goto cleanup;
+	}
+
+	if(_seg->_verify_flg && usenet_hash_init(&_hash) != USENET_SUCCESS)
+		goto cleanup;
+
+	_conn = usenet_ssh_acquire(_seg->_config, 0);
+	if(_conn == NULL)
+		goto cleanup;
+
+	_sftp = libssh2_sftp_init(usenet_ssh_get_session(_conn));
+	if(_sftp == NULL)
+		goto cleanup;
+
+	_handle = libssh2_sftp_open(_sftp, _seg->_target, LIBSSH2_FXF_WRITE, 0);
+	if(_handle == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to open the remote file %s, sftp error %lu", _seg->_target, libssh2_sftp_last_error(_sftp));
+		goto cleanup;
+	}
+	libssh2_sftp_seek64(_handle, (libssh2_uint64_t) _pos);
+
+	while(_pos < _seg->_end && !*_seg->_stop_flg) {
+		_len = (size_t) (_seg->_end - _pos < (long long) _sz ? _seg->_end - _pos : (long long) _sz);
+
+		/* the descriptor is shared, read at the offset */
+		_nread = usenet_transfer_read(_seg->_fd, _buf, _len, (off_t) _pos);
+		if(_nread <= 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to read the source at %lli", _pos);
+			goto cleanup;
+		}
+
+		for(_off = 0; _off < (size_t) _nread; _off += (size_t) _rc) {
+			_rc = libssh2_sftp_write(_handle, _buf + _off, (size_t) _nread - _off);
+			if(_rc < 0) {
+				USENET_LOG_MESSAGE_ARGS("errors occured writing to %s at %lli", _seg->_target, _pos + (long long) _off);
+				goto cleanup;
+			}
+		}
+
+		if(_seg->_verify_flg)
+			usenet_hash_update(&_hash, _buf, (size_t) _nread);
+		usenet_shape_take(&_bucket, _seg->_config, (size_t) _nread);
+		usenet_transfer_release_pages(_seg->_fd, (off_t) _pos, (size_t) _nread);
+		_pos += _nread;
+		_seg->_sent += (size_t) _nread;
+	}
+
+	if(_pos < _seg->_end)
+		goto cleanup;
+
+	/* a failed close may lose the written data */
+	_rc = libssh2_sftp_close(_handle);
+	_handle = NULL;
+	if(_rc != 0)
+		goto cleanup;
+
+	/* check the range on the server over this session */
+	if(_seg->_verify_flg && _seg->_end > _seg->_start) {
+		usenet_hash_final(&_hash, _local, USENET_HASH_HEX_SZ);
+		if(usenet_hash_remote(_conn, _seg->_target, _seg->_start, _seg->_end - _seg->_start, _remote, USENET_HASH_HEX_SZ) != USENET_SUCCESS ||
+		   strcmp(_local, _remote) != 0) {
+			USENET_LOG_MESSAGE_ARGS("range %lli-%lli of %s failed verification", _seg->_start, _seg->_end, _seg->_target);
+			goto cleanup;
+		}
+	}
+
+	_seg->_result = USENET_SUCCESS;
+
+cleanup:
+	if(_handle)
+		libssh2_sftp_close(_handle);
+	if(_sftp)
+		libssh2_sftp_shutdown(_sftp);
+	if(_conn)
+		usenet_ssh_release(_conn, _seg->_result != USENET_SUCCESS);
+	if(_buf)
+		free(_buf);
+	usenet_hash_free(&_hash);
+
+	_seg->_done_flg = 1;
+	return NULL;
+}
+
+/* hash the part of the source already on the server */
+static int _usenet_sftp_hash_prefix(int fd, char* buf, size_t sz, long long offset, struct usenet_hash* hash)
+{
+	ssize_t _nread = 0;
+	long long _pos = 0;
+
+	while(_pos < offset) {
+		_nread = usenet_transfer_read(fd, buf, (size_t) (offset - _pos < (long long) sz ? offset - _pos : (long long) sz), (off_t) _pos);
+		if(_nread <= 0)
+			return USENET_ERROR;
+
+		usenet_hash_update(hash, buf, (size_t) _nread);
+		_pos += _nread;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* the checkpoint is named after the target so a renamed source still matches */
+static int _usenet_sftp_ckpt_path(struct gapi_login* config, const char* target, char* path, size_t sz)
+{
+	unsigned int _hash = 2166136261u;
+	const char* _ptr = NULL;
+
+	if(config->checkpoint_dir == NULL)
+		return USENET_ERROR;
+
+	/* fnv-1a of the full target path */
+	for(_ptr = target; *_ptr; _ptr++) {
+		_hash ^= (unsigned char) *_ptr;
+		_hash *= 16777619u;
+	}
+
+	_ptr = strrchr(target, '/');
+	snprintf(path, sz, "%s/%08x_%s.ckpt", config->checkpoint_dir, _hash, (_ptr ? _ptr + 1 : target));
+	return USENET_SUCCESS;
+}
+
+static int _usenet_sftp_ckpt_load(const char* path, struct _usenet_sftp_ckpt* ckpt)
+{
+	int _num = 0;
+	FILE* _fp = NULL;
+
+	_fp = fopen(path, "r");
+	if(_fp == NULL)
+		return USENET_ERROR;
+
+	_num = fscanf(_fp, "%lld %lld %lld", &ckpt->_size, &ckpt->_mtime, &ckpt->_offset);
+	fclose(_fp);
+
+	return _num == 3 ? USENET_SUCCESS : USENET_ERROR;
+}
+
+/* write to a temporary file and rename, a crash leaves the old checkpoint */
+static int _usenet_sftp_ckpt_save(const char* path, const struct _usenet_sftp_ckpt* ckpt)
+{
+	FILE* _fp = NULL;
+	char _tmp[USENET_TRANSFER_PATH_SZ] = {0};
+
+	snprintf(_tmp, USENET_TRANSFER_PATH_SZ, "%s.tmp", path);
+	_fp = fopen(_tmp, "w");
+	if(_fp == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to write checkpoint %s, %s", _tmp, strerror(errno));
+		return USENET_ERROR;
+	}
+
+	fprintf(_fp, "%lld %lld %lld\n", ckpt->_size, ckpt->_mtime, ckpt->_offset);
+	fflush(_fp);
+	fsync(fileno(_fp));
+	fclose(_fp);
+
+	return rename(_tmp, path) == 0 ? USENET_SUCCESS : USENET_ERROR;
+}
+
+/*
+ * Work out where to continue. The remote size bounds the offset, the
+ * checkpoint bounds it further when it belongs to this source. The
+ * offset is only used if the end of the remote prefix matches.
+ */
+static long long _usenet_sftp_resume_offset(LIBSSH2_SFTP* sftp,
+											int fd,
+											const char* target,
+											const struct stat* fstat,
+											const struct _usenet_sftp_ckpt* ckpt)
+{
+	long long _offset = 0;
+	LIBSSH2_SFTP_ATTRIBUTES _attrs = {0};
+
+	if(libssh2_sftp_stat(sftp, target, &_attrs) != 0 || !(_attrs.flags & LIBSSH2_SFTP_ATTR_SIZE))
+		return 0;
+
+	_offset = (long long) _attrs.filesize;
+	if(_offset > (long long) fstat->st_size)
+		return 0;
+
+	if(ckpt->_offset >= 0 && ckpt->_offset < _offset)
+		_offset = ckpt->_offset;
+
+	if(_offset > 0 && _usenet_sftp_verify_prefix(sftp, fd, target, _offset) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE_ARGS("remote copy of %s differs from the source, starting over", target);
+		return 0;
+	}
+
+	return _offset;
+}
+
+/* compare the last window before the offset with the source */
+static int _usenet_sftp_verify_prefix(LIBSSH2_SFTP* sftp, int fd, const char* target, long long offset)
+{
+	int _ret = USENET_ERROR;
+	ssize_t _rc = 0;
+	size_t _len = 0, _got = 0;
+	long long _start = 0;
+	char* _local = NULL, *_remote = NULL;
+	LIBSSH2_SFTP_HANDLE* _handle = NULL;
+
+	_start = (offset > USENET_TRANSFER_VERIFY_SZ ? offset - USENET_TRANSFER_VERIFY_SZ : 0);
+	_len = (size_t) (offset - _start);
+
+	_local = (char*) malloc(_len);
+	_remote = (char*) malloc(_len);
+	if(_local == NULL || _remote == NULL)
+		goto clean_up;
+
+	if(usenet_transfer_read(fd, _local, _len, (off_t) _start) != (ssize_t) _len)
+		goto clean_up;
+
+	_handle = libssh2_sftp_open(sftp, target, LIBSSH2_FXF_READ, 0);
+	if(_handle == NULL)
+		goto clean_up;
+
+	libssh2_sftp_seek64(_handle, (libssh2_uint64_t) _start);
+	while(_got < _len) {
+		_rc = libssh2_sftp_read(_handle, _remote + _got, _len - _got);
+		if(_rc <= 0)
+			goto clean_up;
+		_got += (size_t) _rc;
+	}
+
+	_ret = (memcmp(_local, _remote, _len) == 0 ? USENET_SUCCESS : USENET_ERROR);
+
+clean_up:
+	if(_handle)
+		libssh2_sftp_close(_handle);
+	if(_local)
+		free(_local);
+	if(_remote)
+		free(_remote);
+
+	return _ret;
+}
+
+/* rename over the target, sftp v3 servers refuse to replace a file so the old one is removed first */
+static int _usenet_sftp_replace(LIBSSH2_SFTP* sftp, const char* from, const char* to)
+{
+	const long _flags = LIBSSH2_SFTP_RENAME_OVERWRITE | LIBSSH2_SFTP_RENAME_ATOMIC | LIBSSH2_SFTP_RENAME_NATIVE;
+
+	if(libssh2_sftp_rename_ex(sftp, from, (unsigned) strlen(from), to, (unsigned) strlen(to), _flags) == 0)
+		return USENET_SUCCESS;
+
+	if(libssh2_sftp_unlink(sftp, to) != 0)
+		return USENET_ERROR;
+
+	if(libssh2_sftp_rename_ex(sftp, from, (unsigned) strlen(from), to, (unsigned) strlen(to), _flags) != 0)
+		return USENET_ERROR;
+
+	return USENET_SUCCESS;
+}
@@ -0,0 +1,196 @@
+/*
+ * Bandwidth shaping of the transfers. Every transfer charges the bytes it
+ * writes to its own token bucket and to a bucket shared by all transfers,
+ * and sleeps off the deficit of the slower one. The shared rate follows a
+ * time of day schedule so copies can run flat out when the line is idle.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "usenet.h"
+
+/* window of the schedule in minutes of the day, may wrap midnight */
+struct _usenet_shape_window
+{
+	int _from;
+	int _to;
+	int _rate_kb;
+};
+
+static pthread_mutex_t _usenet_shape_mutex = PTHREAD_MUTEX_INITIALIZER;
+static int _usenet_shape_init_flg = 0;
+static time_t _usenet_shape_checked = 0;
+static size_t _usenet_shape_num_windows = 0;
+static struct _usenet_shape_window _usenet_shape_windows[USENET_SHAPE_MAX_WINDOWS];
+static struct usenet_shape_bucket _usenet_shape_global;
+static struct usenet_shape_stat _usenet_shape_stat;
+
+static int _usenet_shape_configure(struct gapi_login* config);
+static int _usenet_shape_global_rate(struct gapi_login* config, time_t now);
+static double _usenet_shape_charge(struct usenet_shape_bucket* bucket, const struct timespec* now, size_t bytes);
+
+/* initialise the bucket of a transfer, the per transfer cap is split over its streams */
+int usenet_shape_init(struct usenet_shape_bucket* bucket, struct gapi_login* config, int streams)
+{
+	if(bucket == NULL || config == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(bucket, 0, sizeof(struct usenet_shape_bucket));
+	if(config->transfer_file_rate_kb > 0)
+		bucket->_rate = (double) config->transfer_file_rate_kb * 1024.0 / (double) (streams > 0 ? streams : 1);
+
+	clock_gettime(CLOCK_MONOTONIC, &bucket->_last);
+	return USENET_SUCCESS;
+}
+
+/*
+ * Charge the bytes written to the transfer and to the global bucket and
+ * wait until both are back in credit.
+ */
+int usenet_shape_take(struct usenet_shape_bucket* bucket, struct gapi_login* config, size_t bytes)
+{
+	double _wait = 0.0, _global_wait = 0.0;
+	time_t _sec = 0;
+	struct timespec _now, _ts;
+
+	if(bucket == NULL || config == NULL)
+		return USENET_ARG_ERROR;
+
+	/* no shaping configured */
+	if(bucket->_rate <= 0.0 && config->transfer_rate_kb <= 0 && config->transfer_schedule == NULL)
+		return USENET_SUCCESS;
+
+	clock_gettime(CLOCK_MONOTONIC, &_now);
+	_wait = _usenet_shape_charge(bucket, &_now, bytes);
+
+	pthread_mutex_lock(&_usenet_shape_mutex);
+	if(!_usenet_shape_init_flg)
+		_usenet_shape_configure(config);
+
+	/* the schedule is looked at once a second */
+	time(&_sec);
+	if(_sec != _usenet_shape_checked) {
+		_usenet_shape_checked = _sec;
+		_usenet_shape_global._rate = (double) _usenet_shape_global_rate(config, _sec) * 1024.0;
+		_usenet_shape_stat._global_rate = _usenet_shape_global._rate;
+	}
+
+	_global_wait = _usenet_shape_charge(&_usenet_shape_global, &_now, bytes);
+
+	_usenet_shape_stat._bytes += bytes;
+	if(_global_wait > _wait)
+		_wait = _global_wait;
+	if(_wait > 0.0) {
+		_usenet_shape_stat._throttled++;
+		_usenet_shape_stat._wait_seconds += _wait;
+		if(_global_wait >= _wait)
+			_usenet_shape_stat._global_waits++;
+	}
+	pthread_mutex_unlock(&_usenet_shape_mutex);
+
+	if(_wait <= 0.0)
+		return USENET_SUCCESS;
+
+	_ts.tv_sec = (time_t) _wait;
+	_ts.tv_nsec = (long) ((_wait - (double) _ts.tv_sec) * 1000000000.0);
+	/* a signal resumes the sleep with the time left */
+	while(nanosleep(&_ts, &_ts) != 0 && errno == EINTR)
+		;
+
+	return USENET_SUCCESS;
+}
+
+/* copy of the counters */
+int usenet_shape_get_stat(struct usenet_shape_stat* stat)
+{
+	if(stat == NULL)
+		return USENET_ARG_ERROR;
+
+	pthread_mutex_lock(&_usenet_shape_mutex);
+	*stat = _usenet_shape_stat;
+	pthread_mutex_unlock(&_usenet_shape_mutex);
+
+	return USENET_SUCCESS;
+}
+
+/* parse the schedule, windows are HH:MM-HH:MM=KB separated by commas */
+static int _usenet_shape_configure(struct gapi_login* config)
+{
+	int _fh = 0, _fm = 0, _th = 0, _tm = 0, _kb = 0, _n = 0;
+	const char* _ptr = config->transfer_schedule;
+
+	_usenet_shape_init_flg = 1;
+	_usenet_shape_num_windows = 0;
+	clock_gettime(CLOCK_MONOTONIC, &_usenet_shape_global._last);
+
+	while(_ptr && *_ptr && _usenet_shape_num_windows < USENET_SHAPE_MAX_WINDOWS) {
+		if(sscanf(_ptr, " %d:%d-%d:%d=%d%n", &_fh, &_fm, &_th, &_tm, &_kb, &_n) != 5) {
+			USENET_LOG_MESSAGE_ARGS("invalid transfer schedule at %s", _ptr);
+			break;
+		}
+
+		_usenet_shape_windows[_usenet_shape_num_windows]._from = _fh * 60 + _fm;
+		_usenet_shape_windows[_usenet_shape_num_windows]._to = _th * 60 + _tm;
+		_usenet_shape_windows[_usenet_shape_num_windows]._rate_kb = _kb;
+		_usenet_shape_num_windows++;
+
+		_ptr = strchr(_ptr + _n, ',');
+		if(_ptr)
+			_ptr++;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("transfer shaping, global %i KB/s, per transfer %i KB/s, %lu schedule windows",
+							config->transfer_rate_kb,
+							config->transfer_file_rate_kb,
+							_usenet_shape_num_windows);
+	return USENET_SUCCESS;
+}
+
+/* rate of the window covering the time, the configured rate outside the windows */
+static int _usenet_shape_global_rate(struct gapi_login* config, time_t now)
+{
+	int _min = 0;
+	size_t _i = 0;
+	struct tm _tm;
+	struct _usenet_shape_window* _win = NULL;
+
+	localtime_r(&now, &_tm);
+	_min = _tm.tm_hour * 60 + _tm.tm_min;
+
+	for(_i = 0; _i < _usenet_shape_num_windows; _i++) {
+		_win = &_usenet_shape_windows[_i];
+		if((_win->_from <= _win->_to && _min >= _win->_from && _min < _win->_to) ||
+		   (_win->_from > _win->_to && (_min >= _win->_from || _min < _win->_to)))
+			return _win->_rate_kb;
+	}
+
+	return config->transfer_rate_kb;
+}
+
+/* refill the bucket and take the bytes, returns the seconds until it is in credit */
+static double _usenet_shape_charge(struct usenet_shape_bucket* bucket, const struct timespec* now, size_t bytes)
+{
+	double _elapsed = 0.0;
+
+	_elapsed = (double) (now->tv_sec - bucket->_last.tv_sec) +
+		(double) (now->tv_nsec - bucket->_last.tv_nsec) / 1000000000.0;
+	bucket->_last = *now;
+
+	if(bucket->_rate <= 0.0) {
+		bucket->_tokens = 0.0;
+		return 0.0;
+	}
+
+	/* a short burst is allowed after an idle period */
+	bucket->_tokens += _elapsed * bucket->_rate;
+	if(bucket->_tokens > bucket->_rate * USENET_SHAPE_BURST_SEC)
+		bucket->_tokens = bucket->_rate * USENET_SHAPE_BURST_SEC;
+
+	bucket->_tokens -= (double) bytes;
+	return bucket->_tokens < 0.0 ? -bucket->_tokens / bucket->_rate : 0.0;
+}
@@ -0,0 +1,277 @@
+/*
+ * Destinations of the transfer engine. The scp sink writes to a channel
+ * of a cached ssh session without blocking, the local sink writes to a
+ * file and the null sink drops the data, the last two let the copy path
+ * be measured without a server.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/select.h>
+
+#include <libssh2.h>
+#include "usenet.h"
+
+static int _usenet_sink_scp_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat);
+static ssize_t _usenet_sink_scp_write(struct usenet_transfer_sink* sink, const char* data, size_t len);
+static int _usenet_sink_scp_wait(struct usenet_transfer_sink* sink);
+static int _usenet_sink_scp_finish(struct usenet_transfer_sink* sink);
+static void _usenet_sink_scp_close(struct usenet_transfer_sink* sink, int failed);
+static int _usenet_sink_local_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat);
+static ssize_t _usenet_sink_local_write(struct usenet_transfer_sink* sink, const char* data, size_t len);
+static int _usenet_sink_local_finish(struct usenet_transfer_sink* sink);
+static void _usenet_sink_local_close(struct usenet_transfer_sink* sink, int failed);
+static int _usenet_sink_null_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat);
+static ssize_t _usenet_sink_null_write(struct usenet_transfer_sink* sink, const char* data, size_t len);
+static int _usenet_sink_none(struct usenet_transfer_sink* sink);
+static void _usenet_sink_null_close(struct usenet_transfer_sink* sink, int failed);
+static int _usenet_sink_wait_socket(int sock, LIBSSH2_SESSION* session);
+
+/* pick the sink of the transfer mode, scp if not set */
+int usenet_transfer_sink_init(struct usenet_transfer_sink* sink, struct gapi_login* config)
+{
+	if(sink == NULL || config == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(sink, 0, sizeof(struct usenet_transfer_sink));
+	sink->_fd = -1;
+
+	if(config->transfer_mode && strcmp(config->transfer_mode, USENET_TRANSFER_MODE_LOCAL) == 0) {
+		sink->_name = USENET_TRANSFER_MODE_LOCAL;
+		sink->_open = _usenet_sink_local_open;
+		sink->_write = _usenet_sink_local_write;
+		sink->_wait = _usenet_sink_none;
+		sink->_finish = _usenet_sink_local_finish;
+		sink->_close = _usenet_sink_local_close;
+	}
+	else if(config->transfer_mode && strcmp(config->transfer_mode, USENET_TRANSFER_MODE_NULL) == 0) {
+		sink->_name = USENET_TRANSFER_MODE_NULL;
+		sink->_open = _usenet_sink_null_open;
+		sink->_write = _usenet_sink_null_write;
+		sink->_wait = _usenet_sink_none;
+		sink->_finish = _usenet_sink_none;
+		sink->_close = _usenet_sink_null_close;
+	}
+	else {
+		sink->_name = USENET_TRANSFER_MODE_SCP;
+		sink->_remote_flg = 1;
+		sink->_open = _usenet_sink_scp_open;
+		sink->_write = _usenet_sink_scp_write;
+		sink->_wait = _usenet_sink_scp_wait;
+		sink->_finish = _usenet_sink_scp_finish;
+		sink->_close = _usenet_sink_scp_close;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/*
+ * Open the scp channel on a cached session. A cached session may have been
+ * dropped by the server, if the channel can't be opened the transfer is
+ * retried once on a new session.
+ */
+static int _usenet_sink_scp_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat)
+{
+	int _attempt = 0, _sock = -1;
+	LIBSSH2_SESSION* _session = NULL;
+	LIBSSH2_CHANNEL* _channel = NULL;
+
+	for(_attempt = 0; _attempt < USENET_SSH_MAX_ATTEMPTS; _attempt++) {
+		sink->_conn = usenet_ssh_acquire(config, _attempt > 0);
+		if(sink->_conn == NULL)
+			return USENET_ERROR;
+
+		_session = usenet_ssh_get_session(sink->_conn);
+		_sock = usenet_ssh_get_socket(sink->_conn);
+
+		/* the channel is written without blocking from here on */
+		libssh2_session_set_blocking(_session, 0);
+		time(&sink->_progress);
+
+		USENET_LOG_MESSAGE_ARGS("creating channel for target %s", target);
+		while((_channel = libssh2_scp_send64(_session,
+											 target,
+											 fstat->st_mode & 0777,
+											 (libssh2_int64_t) fstat->st_size,
+											 0, 0)) == NULL &&
+			  libssh2_session_last_errno(_session) == LIBSSH2_ERROR_EAGAIN) {
+			_usenet_sink_wait_socket(_sock, _session);
+			if(time(NULL) - sink->_progress >= USENET_TRANSFER_IDLE_SEC)
+				break;
+		}
+
+		if(_channel) {
+			sink->_channel = _channel;
+			return USENET_SUCCESS;
+		}
+
+		USENET_LOG_MESSAGE("errors occured while creating a channel, reconnecting");
+		usenet_ssh_release(sink->_conn, 1);
+		sink->_conn = NULL;
+	}
+
+	return USENET_ERROR;
+}
+
+static ssize_t _usenet_sink_scp_write(struct usenet_transfer_sink* sink, const char* data, size_t len)
+{
+	ssize_t _rc = 0;
+
+	_rc = libssh2_channel_write((LIBSSH2_CHANNEL*) sink->_channel, data, len);
+	if(_rc == LIBSSH2_ERROR_EAGAIN)
+		return USENET_TRANSFER_AGAIN;
+	if(_rc < 0) {
+		USENET_LOG_MESSAGE("errors occured writing to channel");
+		return USENET_ERROR;
+	}
+
+	if(_rc > 0)
+		time(&sink->_progress);
+
+	return _rc;
+}
+
+/* wait for the socket, fails once the channel has not moved for the idle time */
+static int _usenet_sink_scp_wait(struct usenet_transfer_sink* sink)
+{
+	_usenet_sink_wait_socket(usenet_ssh_get_socket(sink->_conn), usenet_ssh_get_session(sink->_conn));
+
+	if(time(NULL) - sink->_progress >= USENET_TRANSFER_IDLE_SEC) {
+		USENET_LOG_MESSAGE_ARGS("no progress on the channel for %i seconds, giving up", USENET_TRANSFER_IDLE_SEC);
+		return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* send ending characters and wait for the server to close the channel */
+static int _usenet_sink_scp_finish(struct usenet_transfer_sink* sink)
+{
+	LIBSSH2_CHANNEL* _channel = (LIBSSH2_CHANNEL*) sink->_channel;
+
+	time(&sink->_progress);
+	while(libssh2_channel_send_eof(_channel) == LIBSSH2_ERROR_EAGAIN) {
+		if(_usenet_sink_scp_wait(sink) != USENET_SUCCESS)
+			return USENET_ERROR;
+	}
+
+	time(&sink->_progress);
+	while(libssh2_channel_wait_eof(_channel) == LIBSSH2_ERROR_EAGAIN) {
+		if(_usenet_sink_scp_wait(sink) != USENET_SUCCESS)
+			return USENET_ERROR;
+	}
+
+	time(&sink->_progress);
+	while(libssh2_channel_wait_closed(_channel) == LIBSSH2_ERROR_EAGAIN) {
+		if(_usenet_sink_scp_wait(sink) != USENET_SUCCESS)
+			return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* free the channel, a failed session is not put back in the cache */
+static void _usenet_sink_scp_close(struct usenet_transfer_sink* sink, int failed)
+{
+	USENET_LOG_MESSAGE("ssh cleanup...");
+
+	/* a channel which can't be freed takes the session down with it */
+	if(sink->_channel) {
+		time(&sink->_progress);
+		while(libssh2_channel_free((LIBSSH2_CHANNEL*) sink->_channel) == LIBSSH2_ERROR_EAGAIN) {
+			if(_usenet_sink_scp_wait(sink) != USENET_SUCCESS) {
+				failed = 1;
+				break;
+			}
+		}
+	}
+	sink->_channel = NULL;
+
+	if(sink->_conn)
+		usenet_ssh_release(sink->_conn, failed);
+	sink->_conn = NULL;
+}
+
+static int _usenet_sink_local_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat)
+{
+	sink->_fd = open(target, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, fstat->st_mode & 0777);
+	if(sink->_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to open %s, %s", target, strerror(errno));
+		return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+static ssize_t _usenet_sink_local_write(struct usenet_transfer_sink* sink, const char* data, size_t len)
+{
+	ssize_t _rc = 0;
+
+	while((_rc = write(sink->_fd, data, len)) < 0 && errno == EINTR)
+		;
+
+	if(_rc < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to write the local copy, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+
+	return _rc;
+}
+
+/* the copy only counts once it is on disk */
+static int _usenet_sink_local_finish(struct usenet_transfer_sink* sink)
+{
+	return fdatasync(sink->_fd) == 0 ? USENET_SUCCESS : USENET_ERROR;
+}
+
+static void _usenet_sink_local_close(struct usenet_transfer_sink* sink, int failed)
+{
+	if(sink->_fd >= 0)
+		close(sink->_fd);
+	sink->_fd = -1;
+}
+
+static int _usenet_sink_null_open(struct usenet_transfer_sink* sink, struct gapi_login* config, const char* target, const struct stat* fstat)
+{
+	return USENET_SUCCESS;
+}
+
+static ssize_t _usenet_sink_null_write(struct usenet_transfer_sink* sink, const char* data, size_t len)
+{
+	return (ssize_t) len;
+}
+
+static int _usenet_sink_none(struct usenet_transfer_sink* sink)
+{
+	return USENET_SUCCESS;
+}
+
+static void _usenet_sink_null_close(struct usenet_transfer_sink* sink, int failed)
+{
+}
+
+/* wait until the socket is ready in the direction the session is blocked on */
+static int _usenet_sink_wait_socket(int sock, LIBSSH2_SESSION* session)
+{
+	int _dir = 0;
+	fd_set _rfds, _wfds;
+	struct timeval _timeout = {USENET_TRANSFER_WAIT_SEC, 0};
+
+	FD_ZERO(&_rfds);
+	FD_ZERO(&_wfds);
+
+	_dir = libssh2_session_block_directions(session);
+	if(_dir & LIBSSH2_SESSION_BLOCK_INBOUND)
+		FD_SET(sock, &_rfds);
+	if(_dir & LIBSSH2_SESSION_BLOCK_OUTBOUND)
+		FD_SET(sock, &_wfds);
+
+	return select(sock + 1, &_rfds, &_wfds, NULL, &_timeout);
+}
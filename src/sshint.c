@@ -0,0 +1,410 @@
+/*
+ * Cache of authenticated ssh sessions to the remote server. Transfers
+ * take a session from the cache and give it back when done, so the
+ * handshake and key exchange only happen when no idle session is left.
+ * Idle sessions are kept alive and evicted after the idle timeout.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <errno.h>
+#include <pthread.h>
+
+#include <libssh2.h>
+#include "thcon.h"
+#include "usenet.h"
+
+/* cached session */
+struct usenet_ssh_conn
+{
+	int _used_flg;													/* slot holds a session */
+	int _busy_flg;													/* taken by a transfer */
+	int _thcon_flg;													/* connection object initialised */
+	int _sock;
+	time_t _last_used;
+	thcon _thcon;
+	LIBSSH2_SESSION* _session;
+};
+
+static pthread_once_t _usenet_ssh_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _usenet_ssh_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t _usenet_ssh_cond = PTHREAD_COND_INITIALIZER;		/* a session was given back */
+static struct usenet_ssh_conn _usenet_ssh_conns[USENET_SSH_MAX_SESSIONS];
+
+static void _usenet_ssh_global_init(void);
+static int _usenet_ssh_connect(struct gapi_login* config, struct usenet_ssh_conn* conn);
+static void _usenet_ssh_close(struct usenet_ssh_conn* conn);
+
+/*
+ * Take a session from the cache, a new one is opened if none is idle
+ * or fresh is set. An idle session is closed to make room for a fresh
+ * one, if every session is busy the call waits up to
+ * USENET_SSH_ACQUIRE_WAIT_SEC for one to be given back. Returns NULL if
+ * the connection can't be made.
+ */
+struct usenet_ssh_conn* usenet_ssh_acquire(struct gapi_login* config, int fresh)
+{
+	size_t _i = 0;
+	int _rc = 0, _evict = 0;
+	struct timespec _until;
+	struct usenet_ssh_conn* _conn = NULL;
+
+	if(config == NULL)
+		return NULL;
+
+	pthread_once(&_usenet_ssh_once, _usenet_ssh_global_init);
+
+	clock_gettime(CLOCK_REALTIME, &_until);
+	_until.tv_sec += USENET_SSH_ACQUIRE_WAIT_SEC;
+
+	pthread_mutex_lock(&_usenet_ssh_mutex);
+	while(_conn == NULL && _rc != ETIMEDOUT) {
+		for(_i = 0; _i < USENET_SSH_MAX_SESSIONS && !fresh; _i++) {
+			if(_usenet_ssh_conns[_i]._used_flg && !_usenet_ssh_conns[_i]._busy_flg) {
+				_conn = &_usenet_ssh_conns[_i];
+				break;
+			}
+		}
+
+		/* reserve an empty slot, the handshake is done outside the lock */
+		for(_i = 0; _i < USENET_SSH_MAX_SESSIONS && _conn == NULL; _i++) {
+			if(!_usenet_ssh_conns[_i]._used_flg) {
+				_conn = &_usenet_ssh_conns[_i];
+				_conn->_used_flg = 1;
+				_conn->_session = NULL;
+			}
+		}
+
+		/* the cache is full, an idle session gives up its slot */
+		for(_i = 0; _i < USENET_SSH_MAX_SESSIONS && _conn == NULL; _i++) {
+			if(!_usenet_ssh_conns[_i]._busy_flg) {
+				_conn = &_usenet_ssh_conns[_i];
+				_evict = 1;
+			}
+		}
+
+		if(_conn == NULL)
+			_rc = pthread_cond_timedwait(&_usenet_ssh_cond, &_usenet_ssh_mutex, &_until);
+	}
+
+	if(_conn)
+		_conn->_busy_flg = 1;
+	pthread_mutex_unlock(&_usenet_ssh_mutex);
+
+	if(_conn == NULL) {
+		USENET_LOG_MESSAGE("no ssh session was given back in time");
+		return NULL;
+	}
+
+	if(_evict) {
+		USENET_LOG_MESSAGE("closing an idle ssh session to make room");
+		_usenet_ssh_close(_conn);
+	}
+
+	if(_conn->_session) {
+		USENET_LOG_MESSAGE("reusing cached ssh session");
+		return _conn;
+	}
+
+	if(_usenet_ssh_connect(config, _conn) != USENET_SUCCESS) {
+		usenet_ssh_release(_conn, 1);
+		return NULL;
+	}
+
+	return _conn;
+}
+
+/* give the session back, a broken session is closed instead of cached */
+int usenet_ssh_release(struct usenet_ssh_conn* conn, int broken)
+{
+	if(conn == NULL)
+		return USENET_ARG_ERROR;
+
+	if(broken)
+		_usenet_ssh_close(conn);
+	else
+		libssh2_session_set_blocking(conn->_session, 1);
+
+	pthread_mutex_lock(&_usenet_ssh_mutex);
+	time(&conn->_last_used);
+	conn->_busy_flg = 0;
+	if(broken)
+		conn->_used_flg = 0;
+	pthread_cond_signal(&_usenet_ssh_cond);
+	pthread_mutex_unlock(&_usenet_ssh_mutex);
+
+	return USENET_SUCCESS;
+}
+
+struct _LIBSSH2_SESSION* usenet_ssh_get_session(struct usenet_ssh_conn* conn)
+{
+	return conn->_session;
+}
+
+int usenet_ssh_get_socket(struct usenet_ssh_conn* conn)
+{
+	return conn->_sock;
+}
+
+/*
+ * Send keepalives on the idle sessions and close the ones idle for
+ * longer than ssh_idle_timeout or failing the keepalive.
+ */
+int usenet_ssh_maintain(struct gapi_login* config)
+{
+	size_t _i = 0, _num = 0;
+	int _rc = 0, _next = 0, _timeout = 0;
+	time_t _now;
+	struct usenet_ssh_conn* _conn = NULL;
+	struct usenet_ssh_conn* _idle[USENET_SSH_MAX_SESSIONS];
+	int _closed[USENET_SSH_MAX_SESSIONS] = {0};
+
+	_timeout = (config->ssh_idle_timeout > 0 ? config->ssh_idle_timeout : USENET_SSH_DEF_IDLE_TIMEOUT);
+	time(&_now);
+
+	/* take the idle sessions so the network calls are made outside the lock */
+	pthread_mutex_lock(&_usenet_ssh_mutex);
+	for(_i = 0; _i < USENET_SSH_MAX_SESSIONS; _i++) {
+		_conn = &_usenet_ssh_conns[_i];
+		if(!_conn->_used_flg || _conn->_busy_flg || _conn->_session == NULL)
+			continue;
+
+		_conn->_busy_flg = 1;
+		_idle[_num++] = _conn;
+	}
+	pthread_mutex_unlock(&_usenet_ssh_mutex);
+
+	for(_i = 0; _i < _num; _i++) {
+		_conn = _idle[_i];
+		if(difftime(_now, _conn->_last_used) > _timeout) {
+			USENET_LOG_MESSAGE_ARGS("evicting ssh session idle for %is", (int) difftime(_now, _conn->_last_used));
+			_usenet_ssh_close(_conn);
+			_closed[_i] = 1;
+			continue;
+		}
+
+		/* a full socket buffer is left for the next round instead of blocking the caller */
+		libssh2_session_set_blocking(_conn->_session, 0);
+		_rc = libssh2_keepalive_send(_conn->_session, &_next);
+		libssh2_session_set_blocking(_conn->_session, 1);
+
+		if(_rc != 0 && _rc != LIBSSH2_ERROR_EAGAIN) {
+			USENET_LOG_MESSAGE("ssh keepalive failed, closing session");
+			_usenet_ssh_close(_conn);
+			_closed[_i] = 1;
+		}
+	}
+
+	/* put the sessions back, the time of last use is left as it was */
+	pthread_mutex_lock(&_usenet_ssh_mutex);
+	for(_i = 0; _i < _num; _i++) {
+		_idle[_i]->_busy_flg = 0;
+		if(_closed[_i])
+			_idle[_i]->_used_flg = 0;
+	}
+	if(_num > 0)
+		pthread_cond_broadcast(&_usenet_ssh_cond);
+	pthread_mutex_unlock(&_usenet_ssh_mutex);
+
+	return USENET_SUCCESS;
+}
+
+/*
+ * Run the command on the server and collect its output, the output is
+ * allocated and terminated, the caller frees it. Returns the exit status
+ * of the command or -1 if it could not be run. The session is left in
+ * blocking mode.
+ */
+int usenet_ssh_exec(struct usenet_ssh_conn* conn, const char* cmd, char** out, size_t* len)
+{
+	int _status = -1;
+	ssize_t _rc = 0;
+	size_t _sz = USENET_SSH_EXEC_BUF_SZ, _len = 0;
+	char* _buf = NULL, *_tmp = NULL;
+	LIBSSH2_CHANNEL* _channel = NULL;
+
+	if(conn == NULL || cmd == NULL)
+		return -1;
+
+	libssh2_session_set_blocking(conn->_session, 1);
+
+	_channel = libssh2_channel_open_session(conn->_session);
+	if(_channel == NULL) {
+		USENET_LOG_MESSAGE("unable to open a channel for the remote command");
+		return -1;
+	}
+
+	if(libssh2_channel_exec(_channel, cmd) != 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to run %s", cmd);
+		goto clean_up;
+	}
+
+	_buf = (char*) malloc(_sz);
+	while(_buf) {
+		/* keep room for the terminator */
+		if(_len + 1 >= _sz) {
+			_tmp = (char*) realloc(_buf, _sz * 2);
+			if(_tmp == NULL)
+				break;
+			_buf = _tmp;
+			_sz *= 2;
+		}
+
+		_rc = libssh2_channel_read(_channel, _buf + _len, _sz - _len - 1);
+		if(_rc <= 0)
+			break;
+		_len += (size_t) _rc;
+	}
+
+	libssh2_channel_close(_channel);
+	libssh2_channel_wait_closed(_channel);
+	_status = libssh2_channel_get_exit_status(_channel);
+
+	if(_buf)
+		_buf[_len] = '\0';
+
+clean_up:
+	libssh2_channel_free(_channel);
+
+	if(out)
+		*out = _buf;
+	else if(_buf)
+		free(_buf);
+	if(len)
+		*len = _len;
+
+	return _buf ? _status : -1;
+}
+
+/* single quote the string for the remote shell */
+int usenet_ssh_quote(const char* str, char* buf, size_t sz)
+{
+	size_t _len = 0;
+
+	if(str == NULL || buf == NULL || sz < 3)
+		return USENET_ARG_ERROR;
+
+	buf[_len++] = '\'';
+	for(; *str; str++) {
+		if(_len + 5 >= sz)
+			return USENET_ERROR;
+
+		if(*str == '\'') {
+			memcpy(buf + _len, "'\\''", 4);
+			_len += 4;
+		}
+		else
+			buf[_len++] = *str;
+	}
+	buf[_len++] = '\'';
+	buf[_len] = '\0';
+
+	return USENET_SUCCESS;
+}
+
+/* close every idle session */
+int usenet_ssh_cleanup(void)
+{
+	size_t _i = 0;
+
+	pthread_mutex_lock(&_usenet_ssh_mutex);
+	for(_i = 0; _i < USENET_SSH_MAX_SESSIONS; _i++) {
+		if(!_usenet_ssh_conns[_i]._used_flg || _usenet_ssh_conns[_i]._busy_flg)
+			continue;
+
+		_usenet_ssh_close(&_usenet_ssh_conns[_i]);
+		_usenet_ssh_conns[_i]._used_flg = 0;
+	}
+	pthread_mutex_unlock(&_usenet_ssh_mutex);
+
+	return USENET_SUCCESS;
+}
+
+/* libssh2 global state is not thread safe, initialise it once */
+static void _usenet_ssh_global_init(void)
+{
+	libssh2_init(0);
+}
+
+/* open an authenticated ssh session to the server */
+static int _usenet_ssh_connect(struct gapi_login* config, struct usenet_ssh_conn* conn)
+{
+	conn->_sock = -1;
+
+	/* iniialise the connection object */
+	USENET_LOG_MESSAGE("creating connection object");
+	thcon_init(&conn->_thcon, thcon_mode_client);
+	conn->_thcon_flg = 1;
+
+	/* set destination and port address */
+	thcon_set_server_name(&conn->_thcon, config->server_name);
+	thcon_set_port_name(&conn->_thcon, config->ssh_port);
+
+	/* create a raw socket */
+	conn->_sock = thcon_create_raw_sock(&conn->_thcon);
+	if(conn->_sock <= 0) {
+		USENET_LOG_MESSAGE("unable to create a raw socket for the scp");
+		return USENET_ERROR;
+	}
+
+	/* create a new ssh session */
+	USENET_LOG_MESSAGE("initialising ssh session");
+	conn->_session = libssh2_session_init();
+	if(!conn->_session) {
+		USENET_LOG_MESSAGE("unable to create ssh session");
+		return USENET_ERROR;
+	}
+
+	/* the blocking calls, sftp and the remote commands, fail instead of hanging on a stalled peer */
+	libssh2_session_set_timeout(conn->_session, USENET_TRANSFER_IDLE_SEC * 1000L);
+
+	/* start a handshake */
+	USENET_LOG_MESSAGE("ssh handshake");
+	if(libssh2_session_handshake(conn->_session, conn->_sock)) {
+		USENET_LOG_MESSAGE("ssh handshake failed");
+		return USENET_ERROR;
+	}
+
+	/* authenticate using public key */
+	USENET_LOG_MESSAGE("authenticating using public/private");
+	if(libssh2_userauth_publickey_fromfile(conn->_session,
+										   config->ssh_user,
+										   config->rsa_public_key,
+										   config->rsa_private_key,
+										   NULL)) {
+		USENET_LOG_MESSAGE("unable to authenticate connection");
+		return USENET_ERROR;
+	}
+
+	/* the server answers the keepalives, sent by usenet_ssh_maintain */
+	libssh2_keepalive_config(conn->_session,
+							 1,
+							 (unsigned) (config->ssh_keepalive > 0 ? config->ssh_keepalive : USENET_SSH_DEF_KEEPALIVE));
+
+	USENET_LOG_MESSAGE("ssh connection authenticated successfully");
+	return USENET_SUCCESS;
+}
+
+/* close the session and the socket */
+static void _usenet_ssh_close(struct usenet_ssh_conn* conn)
+{
+	if(conn->_session) {
+		libssh2_session_set_blocking(conn->_session, 1);
+		libssh2_session_disconnect(conn->_session, "ssh session shutdown");
+		libssh2_session_free(conn->_session);
+	}
+	conn->_session = NULL;
+
+	/* close descriptor if was open */
+	if(conn->_sock > 0)
+		close(conn->_sock);
+	conn->_sock = -1;
+
+	/* delete connection object */
+	if(conn->_thcon_flg)
+		thcon_delete(&conn->_thcon);
+	conn->_thcon_flg = 0;
+}
@@ -0,0 +1,298 @@
+/*
+ * Synchronisation with copies already on the server. A transfer is
+ * skipped when the remote copy matches the source, and an existing copy
+ * that can't be resumed is patched by sending only the blocks whose
+ * checksums differ from the checksums computed on the server.
+ */
+
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <openssl/evp.h>
+
+#include <libssh2.h>
+#include <libssh2_sftp.h>
+#include "usenet.h"
+
+#define USENET_SYNC_MD5_HEX_SZ 33
+
+static int _usenet_sync_hash_local(struct gapi_login* config, const char* source, const struct stat* fstat, char* hex);
+static int _usenet_sync_block_sums(struct usenet_ssh_conn* conn,
+								   const char* target,
+								   size_t block,
+								   long long num_blocks,
+								   char (**sums)[USENET_SYNC_MD5_HEX_SZ]);
+static void _usenet_sync_md5(const char* data, size_t len, char* hex);
+
+/*
+ * Check the copy on the server. Returns USENET_SUCCESS if it has the size
+ * of the source and is not older, and with transfer_verify set if its
+ * hash matches as well.
+ */
+int usenet_sync_unchanged(struct gapi_login* config, const char* source, const char* target)
+{
+	int _ret = USENET_ERROR, _status = 0;
+	long long _size = 0, _mtime = 0;
+	char* _out = NULL;
+	char _path[USENET_TRANSFER_PATH_SZ * 4] = {0};
+	char _cmd[USENET_TRANSFER_PATH_SZ * 4 + 64] = {0};
+	char _local[USENET_HASH_HEX_SZ] = {0}, _remote[USENET_HASH_HEX_SZ] = {0};
+	struct stat _fstat;
+	struct usenet_ssh_conn* _conn = NULL;
+
+	if(config == NULL || source == NULL || target == NULL)
+		return USENET_ARG_ERROR;
+
+	if(stat(source, &_fstat) != 0 || usenet_ssh_quote(target, _path, sizeof(_path)) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	_conn = usenet_ssh_acquire(config, 0);
+	if(_conn == NULL)
+		return USENET_ERROR;
+
+	/* a missing file fails the stat */
+	snprintf(_cmd, sizeof(_cmd), "stat -c '%%s %%Y' -- %s", _path);
+	_status = usenet_ssh_exec(_conn, _cmd, &_out, NULL);
+	if(_status != 0 || sscanf(_out, "%lld %lld", &_size, &_mtime) != 2)
+		goto clean_up;
+
+	if(_size != (long long) _fstat.st_size || _mtime < (long long) _fstat.st_mtime)
+		goto clean_up;
+
+	if(USENET_TRANSFER_VERIFY_FLG(config)) {
+		if(_usenet_sync_hash_local(config, source, &_fstat, _local) != USENET_SUCCESS ||
+		   usenet_hash_remote(_conn, target, 0, 0, _remote, USENET_HASH_HEX_SZ) != USENET_SUCCESS ||
+		   strcmp(_local, _remote) != 0)
+			goto clean_up;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("%s is already on the server, skipping", target);
+	_ret = USENET_SUCCESS;
+
+clean_up:
+	if(_out)
+		free(_out);
+
+	/* the session is only broken if the command could not run */
+	usenet_ssh_release(_conn, _status < 0);
+	return _ret;
+}
+
+/*
+ * Patch the remote copy block by block. The server sends the md5 of each
+ * block of its copy, the local blocks which differ are written at their
+ * offsets and the copy is cut to the size of the source. The blocks read
+ * are added to the hash if given. Returns USENET_ERROR if there is no
+ * remote copy to patch.
+ */
+int usenet_sync_delta(struct gapi_login* config,
+					  struct usenet_ssh_conn* conn,
+					  struct _LIBSSH2_SFTP* sftp,
+					  int fd,
+					  const struct stat* fstat,
+					  const char* target,
+					  struct usenet_hash* hash,
+					  size_t* sent)
+{
+	int _ret = USENET_ERROR;
+	ssize_t _nread = 0, _rc = 0;
+	size_t _block = 0, _off = 0, _patched = 0;
+	long long _i = 0, _num_remote = 0, _pos = 0;
+	char* _buf = NULL;
+	char _sum[USENET_SYNC_MD5_HEX_SZ] = {0};
+	char (*_sums)[USENET_SYNC_MD5_HEX_SZ] = NULL;
+	LIBSSH2_SFTP_ATTRIBUTES _attrs = {0};
+	LIBSSH2_SFTP_HANDLE* _handle = NULL;
+
+	if(config == NULL || conn == NULL || sftp == NULL || fstat == NULL || target == NULL || sent == NULL)
+		return USENET_ARG_ERROR;
+
+	if(libssh2_sftp_stat(sftp, target, &_attrs) != 0 ||
+	   !(_attrs.flags & LIBSSH2_SFTP_ATTR_SIZE) ||
+	   _attrs.filesize == 0)
+		return USENET_ERROR;
+
+	_block = (size_t) (config->delta_block_kb > 0 ? config->delta_block_kb : USENET_SYNC_DEF_BLOCK_KB) * 1024;
+	_num_remote = ((long long) _attrs.filesize + (long long) _block - 1) / (long long) _block;
+
+	if(_usenet_sync_block_sums(conn, target, _block, _num_remote, &_sums) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	if(posix_memalign((void**) &_buf, USENET_TRANSFER_ALIGN, _block) != 0) {
+		_buf = NULL;
+		goto clean_up;
+	}
+
+	_handle = libssh2_sftp_open(sftp, target, LIBSSH2_FXF_WRITE, 0);
+	if(_handle == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to open the remote file %s, sftp error %lu", target, libssh2_sftp_last_error(sftp));
+		goto clean_up;
+	}
+
+	for(_i = 0, _pos = 0; _pos < (long long) fstat->st_size; _i++, _pos += _nread) {
+		_nread = usenet_transfer_read(fd, _buf, _block, (off_t) _pos);
+		if(_nread <= 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to read the source at %lli", _pos);
+			goto clean_up;
+		}
+
+		if(hash)
+			usenet_hash_update(hash, _buf, (size_t) _nread);
+
+		/* a short remote block differs in its sum as well */
+		_usenet_sync_md5(_buf, (size_t) _nread, _sum);
+		if(_i < _num_remote && strcmp(_sum, _sums[_i]) == 0) {
+			usenet_transfer_release_pages(fd, (off_t) _pos, (size_t) _nread);
+			continue;
+		}
+
+		libssh2_sftp_seek64(_handle, (libssh2_uint64_t) _pos);
+		for(_off = 0; _off < (size_t) _nread; _off += (size_t) _rc) {
+			_rc = libssh2_sftp_write(_handle, _buf + _off, (size_t) _nread - _off);
+			if(_rc < 0) {
+				USENET_LOG_MESSAGE_ARGS("errors occured writing to %s at %lli", target, _pos + (long long) _off);
+				goto clean_up;
+			}
+		}
+
+		usenet_transfer_release_pages(fd, (off_t) _pos, (size_t) _nread);
+		*sent += (size_t) _nread;
+		_patched++;
+	}
+
+	/* drop what the remote copy has beyond the source */
+	if(_attrs.filesize > (libssh2_uint64_t) fstat->st_size) {
+		memset(&_attrs, 0, sizeof(LIBSSH2_SFTP_ATTRIBUTES));
+		_attrs.flags = LIBSSH2_SFTP_ATTR_SIZE;
+		_attrs.filesize = (libssh2_uint64_t) fstat->st_size;
+		if(libssh2_sftp_fsetstat(_handle, &_attrs) != 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to truncate %s", target);
+			goto clean_up;
+		}
+	}
+
+	_rc = libssh2_sftp_close(_handle);
+	_handle = NULL;
+	if(_rc != 0)
+		goto clean_up;
+
+	USENET_LOG_MESSAGE_ARGS("patched %lu of %lli blocks of %s", _patched, _i, target);
+	_ret = USENET_SUCCESS;
+
+clean_up:
+	if(_handle)
+		libssh2_sftp_close(_handle);
+	if(_buf)
+		free(_buf);
+	if(_sums)
+		free(_sums);
+
+	return _ret;
+}
+
+/* sha-256 of the source, read without a transfer */
+static int _usenet_sync_hash_local(struct gapi_login* config, const char* source, const struct stat* fstat, char* hex)
+{
+	int _fd = -1, _ret = USENET_ERROR;
+	ssize_t _nread = 0;
+	size_t _sz = 0;
+	long long _pos = 0;
+	char* _buf = NULL;
+	struct stat _fstat;
+	struct usenet_hash _hash = {0};
+
+	_fd = usenet_transfer_open_source(config, source, &_fstat);
+	if(_fd < 0)
+		return USENET_ERROR;
+
+	_sz = USENET_TRANSFER_BUFFER_SIZE(config);
+	if(posix_memalign((void**) &_buf, USENET_TRANSFER_ALIGN, _sz) != 0) {
+		_buf = NULL;
+		goto clean_up;
+	}
+
+	if(usenet_hash_init(&_hash) != USENET_SUCCESS)
+		goto clean_up;
+
+	while(_pos < (long long) fstat->st_size) {
+		_nread = usenet_transfer_read(_fd, _buf, _sz, (off_t) _pos);
+		if(_nread <= 0)
+			goto clean_up;
+
+		usenet_hash_update(&_hash, _buf, (size_t) _nread);
+		usenet_transfer_release_pages(_fd, (off_t) _pos, (size_t) _nread);
+		_pos += _nread;
+	}
+
+	_ret = usenet_hash_final(&_hash, hex, USENET_HASH_HEX_SZ);
+
+clean_up:
+	usenet_hash_free(&_hash);
+	if(_buf)
+		free(_buf);
+	close(_fd);
+
+	return _ret;
+}
+
+/* md5 of each block of the remote copy, one dd per block in a single command */
+static int _usenet_sync_block_sums(struct usenet_ssh_conn* conn,
+								   const char* target,
+								   size_t block,
+								   long long num_blocks,
+								   char (**sums)[USENET_SYNC_MD5_HEX_SZ])
+{
+	int _j = 0;
+	long long _i = 0;
+	char* _out = NULL, *_line = NULL, *_save = NULL;
+	char _path[USENET_TRANSFER_PATH_SZ * 4] = {0};
+	char _cmd[USENET_TRANSFER_PATH_SZ * 4 + 256] = {0};
+
+	if(usenet_ssh_quote(target, _path, sizeof(_path)) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	snprintf(_cmd,
+			 sizeof(_cmd),
+			 "f=%s; i=0; while [ $i -lt %lld ]; do dd if=\"$f\" bs=%lu skip=$i count=1 2>/dev/null | md5sum; i=$((i+1)); done",
+			 _path,
+			 num_blocks,
+			 block);
+
+	if(usenet_ssh_exec(conn, _cmd, &_out, NULL) != 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to get the block sums of %s", target);
+		if(_out)
+			free(_out);
+		return USENET_ERROR;
+	}
+
+	*sums = calloc((size_t) num_blocks, USENET_SYNC_MD5_HEX_SZ);
+	if(*sums == NULL) {
+		free(_out);
+		return USENET_ERROR;
+	}
+
+	/* a line per block, the sum is the first word */
+	for(_line = strtok_r(_out, "\n", &_save); _line && _i < num_blocks; _line = strtok_r(NULL, "\n", &_save), _i++) {
+		for(_j = 0; _j < USENET_SYNC_MD5_HEX_SZ - 1 && isxdigit((unsigned char) _line[_j]); _j++)
+			(*sums)[_i][_j] = (char) tolower((unsigned char) _line[_j]);
+	}
+
+	free(_out);
+	return USENET_SUCCESS;
+}
+
+static void _usenet_sync_md5(const char* data, size_t len, char* hex)
+{
+	unsigned int _i = 0, _len = 0;
+	unsigned char _md[EVP_MAX_MD_SIZE];
+
+	EVP_Digest(data, len, _md, &_len, EVP_md5(), NULL);
+	for(_i = 0; _i < _len; _i++)
+		sprintf(hex + _i * 2, "%02x", _md[_i]);
+	hex[_len * 2] = '\0';
+}
@@ -0,0 +1,83 @@
+/*
+ * Benchmark of the copy pipeline without a server. The source is copied
+ * through the local or null sink for each buffer size and pipeline depth,
+ * and the throughput, cpu time per gigabyte and io calls per megabyte are
+ * printed for each run. The depth sets how far the kernel reads ahead of
+ * the copy, it only shows on a source which is not in the page cache.
+ *
+ * transfer_bench <source> [target]
+ * The data is dropped if no target is given.
+ */
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "usenet.h"
+
+#define TRANSFER_BENCH_NUM_SIZES 4
+#define TRANSFER_BENCH_NUM_DEPTHS 3
+
+static double _cpu_time(void);
+
+int main(int argc, char** argv)
+{
+	int _i = 0, _j = 0;
+	int _sizes[TRANSFER_BENCH_NUM_SIZES] = {64, 256, 1024, 4096};
+	int _depths[TRANSFER_BENCH_NUM_DEPTHS] = {2, 4, 8};
+	double _cpu = 0.0, _mb = 0.0;
+	struct gapi_login _config;
+	struct usenet_transfer_stat _stat;
+
+	if(argc < 2) {
+		fprintf(stderr, "usage: %s <source> [target]\n", argv[0]);
+		return -1;
+	}
+
+	memset(&_config, 0, sizeof(struct gapi_login));
+	_config.transfer_mode = (argc > 2 ? USENET_TRANSFER_MODE_LOCAL : USENET_TRANSFER_MODE_NULL);
+
+	printf("%-10s %-6s %-10s %-12s %-10s %-10s\n", "buffer_kb", "depth", "mb_s", "cpu_s_gb", "reads_mb", "writes_mb");
+
+	for(_i = 0; _i < TRANSFER_BENCH_NUM_SIZES; _i++) {
+		for(_j = 0; _j < TRANSFER_BENCH_NUM_DEPTHS; _j++) {
+			_config.scp_buffer_size = _sizes[_i];
+			_config.scp_pipeline_depth = _depths[_j];
+			memset(&_stat, 0, sizeof(struct usenet_transfer_stat));
+
+			/* the cpu time of the whole process, the engine runs on this thread */
+			_cpu = _cpu_time();
+			if(usenet_transfer_file(&_config, argv[1], (argc > 2 ? argv[2] : "/dev/null"), NULL, NULL, &_stat) != USENET_SUCCESS) {
+				fprintf(stderr, "transfer failed with a %i KB buffer and depth %i\n", _sizes[_i], _depths[_j]);
+				return -1;
+			}
+			_cpu = _cpu_time() - _cpu;
+
+			_mb = (double) _stat._bytes / (1024.0 * 1024.0);
+			if(_mb <= 0.0) {
+				fprintf(stderr, "the source is empty\n");
+				return -1;
+			}
+
+			printf("%-10i %-6i %-10.1f %-12.3f %-10.2f %-10.2f\n",
+				   _sizes[_i],
+				   _depths[_j],
+				   _stat._mbps,
+				   _cpu / (_mb / 1024.0),
+				   (double) _stat._reads / _mb,
+				   (double) _stat._writes / _mb);
+		}
+	}
+
+	return 0;
+}
+
+/* user and system time of the process in seconds */
+static double _cpu_time(void)
+{
+	struct rusage _usage;
+
+	getrusage(RUSAGE_SELF, &_usage);
+	return (double) (_usage.ru_utime.tv_sec + _usage.ru_stime.tv_sec) +
+		(double) (_usage.ru_utime.tv_usec + _usage.ru_stime.tv_usec) / 1000000.0;
+}
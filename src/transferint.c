@@ -0,0 +1,648 @@
+/*
+ * Transfer engine for copying the completed downloads to the remote
+ * server. The file is read into a ring of aligned buffers while the
+ * sink, a non-blocking scp channel by default, drains the buffer at the
+ * head of the ring, so disk reads overlap with the channel writes.
+ * Sources are read with sequential access hints and their pages are
+ * dropped once sent, so a large copy does not evict the working set of
+ * nzbget. A pool of worker threads runs several transfers at once, each
+ * over its own session.
+ */
+
+#define _GNU_SOURCE
+#include <stdlib.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <fcntl.h>
+#include <pthread.h>
+
+#include "usenet.h"
+
+/* a buffer of the ring */
+struct _usenet_transfer_buf
+{
+	char* _data;
+	off_t _pos;														/* offset of the buffer in the file */
+	size_t _len;													/* bytes read into the buffer */
+	size_t _off;													/* bytes written to the channel */
+};
+
+/*
+ * Read ahead ring, buffers between head and head + count are filled. The
+ * depth of the ring past the next read is handed to the kernel, so the
+ * reads of a sink which never blocks find the data in the page cache.
+ */
+struct _usenet_transfer_ring
+{
+	size_t _depth;
+	size_t _sz;														/* size of each buffer */
+	size_t _head;
+	size_t _count;
+	off_t _pos;														/* offset of the next read */
+	off_t _advised;													/* end of the range read ahead by the kernel */
+	size_t _reads;													/* read calls made */
+	int _eof;
+	struct _usenet_transfer_buf _bufs[USENET_TRANSFER_MAX_DEPTH];
+};
+
+static inline __attribute__ ((always_inline)) size_t _usenet_transfer_depth(struct gapi_login* config);
+static int _usenet_transfer_ring_init(struct _usenet_transfer_ring* ring, size_t sz, size_t depth);
+static int _usenet_transfer_ring_fill(struct _usenet_transfer_ring* ring, int fd);
+static void _usenet_transfer_ring_free(struct _usenet_transfer_ring* ring);
+static void* _usenet_transfer_worker(void* obj);
+static int _usenet_transfer_job_progress(void* obj, float progress);
+static void _usenet_transfer_free_list(struct usenet_transfer_job* job);
+static int _usenet_transfer_priority(struct gapi_login* config, int nzb_id, const char* source);
+
+/* copy the source file to the target path through the sink of the transfer mode */
+int usenet_transfer_file(struct gapi_login* config,
+						 const char* source,
+						 const char* target,
+						 int (*prog)(void*, float),
+						 void* ext_obj,
+						 struct usenet_transfer_stat* stat)
+{
+	int _fd = -1, _ret = USENET_ERROR, _verify_flg = 0;
+	ssize_t _rc = 0;
+	size_t _sent = 0, _writes = 0;
+	double _secs = 0.0, _mbps = 0.0;
+	char _local[USENET_HASH_HEX_SZ] = {0}, _remote[USENET_HASH_HEX_SZ] = {0};
+	struct stat _fstat = {0};
+	struct usenet_hash _hash = {0};
+	struct usenet_shape_bucket _bucket;
+	struct usenet_transfer_sink _sink;
+	struct timespec _start;
+	struct _usenet_transfer_buf* _buf = NULL;
+	struct _usenet_transfer_ring _ring;
+
+	memset(&_ring, 0, sizeof(struct _usenet_transfer_ring));
+
+	if(config == NULL || source == NULL || target == NULL)
+		return USENET_ARG_ERROR;
+
+	usenet_transfer_sink_init(&_sink, config);
+
+	/* an identical copy costs a stat on the server instead of the upload */
+	if(_sink._remote_flg && USENET_TRANSFER_SKIP_FLG(config) && usenet_sync_unchanged(config, source, target) == USENET_SUCCESS) {
+		if(stat)
+			memset(stat, 0, sizeof(struct usenet_transfer_stat));
+		return USENET_SUCCESS;
+	}
+
+	/* sftp transfers can be resumed */
+	if(config->transfer_mode && strcmp(config->transfer_mode, USENET_TRANSFER_MODE_SFTP) == 0)
+		return usenet_sftp_transfer_file(config, source, target, prog, ext_obj, stat);
+
+	/* open file and get stats */
+	_fd = usenet_transfer_open_source(config, source, &_fstat);
+	if(_fd < 0)
+		return USENET_ERROR;
+
+	if(_usenet_transfer_ring_init(&_ring,
+								  USENET_TRANSFER_BUFFER_SIZE(config),
+								  _usenet_transfer_depth(config)) != USENET_SUCCESS)
+		goto cleanup;
+
+	clock_gettime(CLOCK_MONOTONIC, &_start);
+	usenet_shape_init(&_bucket, config, 1);
+
+	/* only a copy on the server can be hashed there */
+	_verify_flg = _sink._remote_flg && USENET_TRANSFER_VERIFY_FLG(config);
+	if(_verify_flg && usenet_hash_init(&_hash) != USENET_SUCCESS)
+		goto cleanup;
+
+	if(_sink._open(&_sink, config, target, &_fstat) != USENET_SUCCESS)
+		goto cleanup;
+
+	while(1) {
+		/* nothing is buffered, block on the disk */
+		if(_ring._count == 0) {
+			if(_usenet_transfer_ring_fill(&_ring, _fd) != USENET_SUCCESS)
+				goto cleanup;
+			if(_ring._count == 0)
+				break;
+		}
+
+		_buf = &_ring._bufs[_ring._head];
+		_rc = _sink._write(&_sink, _buf->_data + _buf->_off, _buf->_len - _buf->_off);
+
+		if(_rc == USENET_TRANSFER_AGAIN) {
+			/* the sink is busy, read ahead if there is room else wait */
+			if(!_ring._eof && _ring._count < _ring._depth) {
+				if(_usenet_transfer_ring_fill(&_ring, _fd) != USENET_SUCCESS)
+					goto cleanup;
+			}
+			else if(_sink._wait(&_sink) != USENET_SUCCESS)
+				goto cleanup;
+
+			continue;
+		}
+
+		if(_rc < 0)
+			goto cleanup;
+
+		/* a busy sink is not a write */
+		_writes++;
+		_buf->_off += (size_t) _rc;
+		_sent += (size_t) _rc;
+		usenet_shape_take(&_bucket, config, (size_t) _rc);
+
+		if(_buf->_off < _buf->_len)
+			continue;
+
+		/* the buffer is drained, hash it while it is in cache and move the head */
+		if(_verify_flg)
+			usenet_hash_update(&_hash, _buf->_data, _buf->_len);
+		usenet_transfer_release_pages(_fd, _buf->_pos, _buf->_len);
+		_ring._head = (_ring._head + 1) % _ring._depth;
+		_ring._count--;
+
+		/* if the callback function is supplied with this we call to indicate progress, an error cancels */
+		if(prog != NULL && _fstat.st_size > 0 &&
+		   prog(ext_obj, (float) _sent / (float) _fstat.st_size) != USENET_SUCCESS) {
+			USENET_LOG_MESSAGE_ARGS("transfer of %s cancelled", source);
+			goto cleanup;
+		}
+	}
+
+	if(_sink._finish(&_sink) != USENET_SUCCESS)
+		goto cleanup;
+
+	/* compare with the hash of the copy on the server */
+	if(_verify_flg) {
+		usenet_hash_final(&_hash, _local, USENET_HASH_HEX_SZ);
+		if(usenet_hash_remote(_sink._conn, target, 0, 0, _remote, USENET_HASH_HEX_SZ) != USENET_SUCCESS ||
+		   strcmp(_local, _remote) != 0) {
+			USENET_LOG_MESSAGE_ARGS("remote copy of %s failed verification, sent %s, remote %s", source, _local, _remote);
+			goto cleanup;
+		}
+		USENET_LOG_MESSAGE_ARGS("verified %s, sha256 %s", target, _local);
+	}
+
+	/* report the achieved rate */
+	_secs = usenet_utils_elapsed(&_start);
+	_mbps = (_secs > 0.0 ? (double) _sent / (1000.0 * 1000.0) / _secs : 0.0);
+	USENET_LOG_MESSAGE_ARGS("transferred %lu bytes of %s to %s in %.2fs, %.2f MB/s", _sent, source, _sink._name, _secs, _mbps);
+
+	if(stat) {
+		stat->_bytes = _sent;
+		stat->_seconds = _secs;
+		stat->_mbps = _mbps;
+		stat->_reads = _ring._reads;
+		stat->_writes = _writes;
+	}
+
+	_ret = USENET_SUCCESS;
+
+cleanup:
+	_sink._close(&_sink, _ret != USENET_SUCCESS);
+	_usenet_transfer_ring_free(&_ring);
+	usenet_hash_free(&_hash);
+
+	/* close the open file descriptor */
+	if(_fd >= 0)
+		close(_fd);
+
+	return _ret;
+}
+
+/*
+ * Open the source for a sequential read. Files above transfer_direct_mb
+ * bypass the page cache, otherwise the start of the file is read ahead.
+ */
+int usenet_transfer_open_source(struct gapi_login* config, const char* source, struct stat* stat_buf)
+{
+	int _fd = -1;
+
+	_fd = open(source, O_RDONLY);
+	if(_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to open the file %s", source);
+		return -1;
+	}
+
+	if(fstat(_fd, stat_buf) != 0) {
+		close(_fd);
+		return -1;
+	}
+
+	/* not every file system takes O_DIRECT, the cached path is used then */
+	if(config->transfer_direct_mb > 0 &&
+	   (long long) stat_buf->st_size >= (long long) config->transfer_direct_mb * 1024 * 1024 &&
+	   fcntl(_fd, F_SETFL, fcntl(_fd, F_GETFL) | O_DIRECT) == 0) {
+		USENET_LOG_MESSAGE_ARGS("reading %s with direct io", source);
+		return _fd;
+	}
+
+	posix_fadvise(_fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+	readahead(_fd, 0, USENET_TRANSFER_READAHEAD_SZ);
+
+	return _fd;
+}
+
+/*
+ * Read at the offset. Direct io needs aligned offsets and lengths, if a
+ * read is refused the descriptor falls back to cached reads.
+ */
+ssize_t usenet_transfer_read(int fd, void* buf, size_t len, off_t offset)
+{
+	int _flags = 0;
+	ssize_t _nread = 0;
+
+	while(1) {
+		_nread = pread(fd, buf, len, offset);
+		if(_nread >= 0)
+			return _nread;
+
+		if(errno == EINTR)
+			continue;
+
+		_flags = fcntl(fd, F_GETFL);
+		if(errno == EINVAL && _flags >= 0 && (_flags & O_DIRECT)) {
+			USENET_LOG_MESSAGE("unaligned direct read, falling back to cached reads");
+			fcntl(fd, F_SETFL, _flags & ~O_DIRECT);
+			posix_fadvise(fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+			continue;
+		}
+
+		return _nread;
+	}
+}
+
+/* drop the sent range from the page cache */
+void usenet_transfer_release_pages(int fd, off_t offset, size_t len)
+{
+	posix_fadvise(fd, offset, (off_t) len, POSIX_FADV_DONTNEED);
+}
+
+/* start the workers, the number of workers is taken from the config */
+int usenet_transfer_pool_init(struct usenet_transfer_pool* pool, struct gapi_login* config)
+{
+	size_t _i = 0;
+
+	if(pool == NULL || config == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(pool, 0, sizeof(struct usenet_transfer_pool));
+	pool->_config = config;
+
+	pool->_num_workers = (config->transfer_workers > 0 ? (size_t) config->transfer_workers : USENET_TRANSFER_DEF_WORKERS);
+	if(pool->_num_workers > USENET_TRANSFER_MAX_WORKERS)
+		pool->_num_workers = USENET_TRANSFER_MAX_WORKERS;
+
+	pool->_event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if(pool->_event_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to create the transfer event descriptor, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+
+	pthread_mutex_init(&pool->_mutex, NULL);
+	pthread_cond_init(&pool->_cond, NULL);
+
+	/* the workers look up their slot once all of them are created */
+	pthread_mutex_lock(&pool->_mutex);
+	for(_i = 0; _i < pool->_num_workers; _i++) {
+		if(pthread_create(&pool->_workers[_i], NULL, _usenet_transfer_worker, pool) != 0) {
+			USENET_LOG_MESSAGE("unable to start a transfer worker");
+			pool->_num_workers = _i;
+			break;
+		}
+	}
+	pthread_mutex_unlock(&pool->_mutex);
+
+	USENET_LOG_MESSAGE_ARGS("started %lu transfer workers", pool->_num_workers);
+	return pool->_num_workers > 0 ? USENET_SUCCESS : USENET_ERROR;
+}
+
+/* queue the file for copying, the paths are copied */
+int usenet_transfer_pool_submit(struct usenet_transfer_pool* pool, int nzb_id, const char* source, const char* target)
+{
+	struct usenet_transfer_job* _job = NULL;
+	struct usenet_transfer_job** _pos = NULL;
+
+	if(pool == NULL || source == NULL || target == NULL)
+		return USENET_ARG_ERROR;
+
+	_job = (struct usenet_transfer_job*) calloc(1, sizeof(struct usenet_transfer_job));
+	if(_job == NULL)
+		return USENET_ERROR;
+
+	_job->_nzb_id = nzb_id;
+	_job->_priority = _usenet_transfer_priority(pool->_config, nzb_id, source);
+	_job->_source = strdup(source);
+	_job->_target = strdup(target);
+	_job->_result = USENET_ERROR;
+
+	if(_job->_source == NULL || _job->_target == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to queue nzb %i, out of memory", nzb_id);
+		usenet_transfer_job_free(_job);
+		return USENET_ERROR;
+	}
+
+	/* queued after the jobs of the same or higher priority */
+	pthread_mutex_lock(&pool->_mutex);
+	for(_pos = &pool->_queue; *_pos && (*_pos)->_priority >= _job->_priority; _pos = &(*_pos)->_next)
+		;
+
+	_job->_next = *_pos;
+	*_pos = _job;
+	if(_job->_next == NULL)
+		pool->_queue_tail = _job;
+
+	pthread_cond_signal(&pool->_cond);
+	pthread_mutex_unlock(&pool->_mutex);
+
+	USENET_LOG_MESSAGE_ARGS("queued nzb %i for transfer to %s", nzb_id, target);
+	return USENET_SUCCESS;
+}
+
+/* check if the nzb is queued, being copied or waiting to be collected */
+int usenet_transfer_pool_find(struct usenet_transfer_pool* pool, int nzb_id)
+{
+	size_t _i = 0;
+	int _found = 0;
+	struct usenet_transfer_job* _job = NULL;
+
+	pthread_mutex_lock(&pool->_mutex);
+	for(_job = pool->_queue; _job && !_found; _job = _job->_next)
+		_found = (_job->_nzb_id == nzb_id);
+
+	for(_job = pool->_done; _job && !_found; _job = _job->_next)
+		_found = (_job->_nzb_id == nzb_id);
+
+	for(_i = 0; _i < pool->_num_workers && !_found; _i++)
+		_found = (pool->_active[_i] && pool->_active[_i]->_nzb_id == nzb_id);
+	pthread_mutex_unlock(&pool->_mutex);
+
+	return _found;
+}
+
+/* take the finished jobs, the caller frees them with usenet_transfer_job_free */
+struct usenet_transfer_job* usenet_transfer_pool_collect(struct usenet_transfer_pool* pool)
+{
+	uint64_t _cnt = 0;
+	struct usenet_transfer_job* _done = NULL;
+
+	/* reset the event counter before taking the list */
+	if(read(pool->_event_fd, &_cnt, sizeof(uint64_t)) < 0 && errno != EAGAIN)
+		USENET_LOG_MESSAGE_ARGS("unable to read the transfer event, %s", strerror(errno));
+
+	pthread_mutex_lock(&pool->_mutex);
+	_done = pool->_done;
+	pool->_done = NULL;
+	pthread_mutex_unlock(&pool->_mutex);
+
+	return _done;
+}
+
+/* call the function with the progress of every running transfer */
+int usenet_transfer_pool_progress(struct usenet_transfer_pool* pool, usenet_transfer_progress_fn fn, void* ext_obj)
+{
+	size_t _i = 0, _num = 0;
+	int _ids[USENET_TRANSFER_MAX_WORKERS];
+	float _prog[USENET_TRANSFER_MAX_WORKERS];
+
+	/* copy under the lock and report outside it */
+	pthread_mutex_lock(&pool->_mutex);
+	for(_i = 0; _i < pool->_num_workers; _i++) {
+		if(pool->_active[_i] == NULL)
+			continue;
+
+		_ids[_num] = pool->_active[_i]->_nzb_id;
+		_prog[_num++] = pool->_active[_i]->_progress;
+	}
+	pthread_mutex_unlock(&pool->_mutex);
+
+	for(_i = 0; _i < _num; _i++)
+		fn(ext_obj, _ids[_i], _prog[_i]);
+
+	return USENET_SUCCESS;
+}
+
+/* cancel the running transfers and stop the workers */
+int usenet_transfer_pool_destroy(struct usenet_transfer_pool* pool)
+{
+	size_t _i = 0;
+
+	pthread_mutex_lock(&pool->_mutex);
+	pool->_stop_flg = 1;
+	pthread_cond_broadcast(&pool->_cond);
+	pthread_mutex_unlock(&pool->_mutex);
+
+	for(_i = 0; _i < pool->_num_workers; _i++)
+		pthread_join(pool->_workers[_i], NULL);
+
+	_usenet_transfer_free_list(pool->_queue);
+	_usenet_transfer_free_list(pool->_done);
+	pool->_queue = pool->_queue_tail = pool->_done = NULL;
+	pool->_num_workers = 0;
+
+	if(pool->_event_fd >= 0)
+		close(pool->_event_fd);
+	pool->_event_fd = -1;
+
+	pthread_cond_destroy(&pool->_cond);
+	pthread_mutex_destroy(&pool->_mutex);
+	return USENET_SUCCESS;
+}
+
+void usenet_transfer_job_free(struct usenet_transfer_job* job)
+{
+	if(job == NULL)
+		return;
+
+	if(job->_source)
+		free(job->_source);
+	if(job->_target)
+		free(job->_target);
+	free(job);
+}
+
+/* take jobs off the queue until the pool is stopped */
+static void* _usenet_transfer_worker(void* obj)
+{
+	size_t _slot = 0;
+	uint64_t _one = 1;
+	struct usenet_transfer_pool* _pool = (struct usenet_transfer_pool*) obj;
+	struct usenet_transfer_job* _job = NULL;
+
+	pthread_mutex_lock(&_pool->_mutex);
+
+	/* find the slot of this worker */
+	for(_slot = 0; _slot < _pool->_num_workers; _slot++) {
+		if(pthread_equal(_pool->_workers[_slot], pthread_self()))
+			break;
+	}
+
+	while(!_pool->_stop_flg) {
+		if(_pool->_queue == NULL) {
+			pthread_cond_wait(&_pool->_cond, &_pool->_mutex);
+			continue;
+		}
+
+		_job = _pool->_queue;
+		_pool->_queue = _job->_next;
+		if(_pool->_queue == NULL)
+			_pool->_queue_tail = NULL;
+		_job->_next = NULL;
+		_job->_pool = _pool;
+		_pool->_active[_slot] = _job;
+		pthread_mutex_unlock(&_pool->_mutex);
+
+		_job->_result = usenet_transfer_file(_pool->_config,
+											 _job->_source,
+											 _job->_target,
+											 _usenet_transfer_job_progress,
+											 _job,
+											 &_job->_stat);
+
+		/* hand the job back to the owner */
+		pthread_mutex_lock(&_pool->_mutex);
+		_pool->_active[_slot] = NULL;
+		_job->_next = _pool->_done;
+		_pool->_done = _job;
+
+		if(write(_pool->_event_fd, &_one, sizeof(uint64_t)) < 0)
+			USENET_LOG_MESSAGE_ARGS("unable to signal the transfer event, %s", strerror(errno));
+	}
+
+	pthread_mutex_unlock(&_pool->_mutex);
+	return NULL;
+}
+
+/* record the progress of the job, cancels the transfer when the pool stops */
+static int _usenet_transfer_job_progress(void* obj, float progress)
+{
+	int _stop = 0;
+	struct usenet_transfer_job* _job = (struct usenet_transfer_job*) obj;
+
+	/* the progress is read by usenet_transfer_pool_progress under the same lock */
+	pthread_mutex_lock(&_job->_pool->_mutex);
+	_job->_progress = progress;
+	_stop = _job->_pool->_stop_flg;
+	pthread_mutex_unlock(&_job->_pool->_mutex);
+
+	return _stop ? USENET_ERROR : USENET_SUCCESS;
+}
+
+/* priority class of the job from the configured order */
+static int _usenet_transfer_priority(struct gapi_login* config, int nzb_id, const char* source)
+{
+	struct stat _fstat;
+
+	if(config->transfer_priority == NULL)
+		return 0;
+
+	if(strcmp(config->transfer_priority, USENET_TRANSFER_PRIORITY_NEWEST) == 0)
+		return nzb_id;
+
+	if(strcmp(config->transfer_priority, USENET_TRANSFER_PRIORITY_SMALLEST) == 0 && stat(source, &_fstat) == 0)
+		return -(int) (_fstat.st_size / (1024 * 1024));
+
+	return 0;
+}
+
+static void _usenet_transfer_free_list(struct usenet_transfer_job* job)
+{
+	struct usenet_transfer_job* _next = NULL;
+
+	while(job) {
+		_next = job->_next;
+		usenet_transfer_job_free(job);
+		job = _next;
+	}
+}
+
+/* number of buffers, at least two so reads can overlap the writes */
+static inline __attribute__ ((always_inline)) size_t _usenet_transfer_depth(struct gapi_login* config)
+{
+	if(config->scp_pipeline_depth <= 0)
+		return USENET_TRANSFER_DEF_DEPTH;
+	if(config->scp_pipeline_depth < 2)
+		return 2;
+	if(config->scp_pipeline_depth > USENET_TRANSFER_MAX_DEPTH)
+		return USENET_TRANSFER_MAX_DEPTH;
+
+	return (size_t) config->scp_pipeline_depth;
+}
+
+/* allocate the page aligned buffers of the ring */
+static int _usenet_transfer_ring_init(struct _usenet_transfer_ring* ring, size_t sz, size_t depth)
+{
+	size_t _i = 0;
+
+	ring->_sz = sz;
+	ring->_depth = depth;
+
+	for(_i = 0; _i < depth; _i++) {
+		if(posix_memalign((void**) &ring->_bufs[_i]._data, USENET_TRANSFER_ALIGN, sz) != 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to allocate %lu byte transfer buffers", sz);
+			return USENET_ERROR;
+		}
+	}
+
+	USENET_LOG_MESSAGE_ARGS("transfer ring of %lu buffers, %lu bytes each", depth, sz);
+	return USENET_SUCCESS;
+}
+
+/* read the next buffer from the file into the tail of the ring */
+static int _usenet_transfer_ring_fill(struct _usenet_transfer_ring* ring, int fd)
+{
+	ssize_t _nread = 0;
+	struct _usenet_transfer_buf* _buf = NULL;
+
+	if(ring->_eof || ring->_count >= ring->_depth)
+		return USENET_SUCCESS;
+
+	_buf = &ring->_bufs[(ring->_head + ring->_count) % ring->_depth];
+	_buf->_pos = ring->_pos;
+	_buf->_len = 0;
+	_buf->_off = 0;
+
+	/* fill the whole buffer unless the end of the file is reached */
+	while(_buf->_len < ring->_sz) {
+		_nread = usenet_transfer_read(fd, _buf->_data + _buf->_len, ring->_sz - _buf->_len, _buf->_pos + (off_t) _buf->_len);
+		ring->_reads++;
+		if(_nread < 0) {
+			USENET_LOG_MESSAGE_ARGS("unable to read the source file, %s", strerror(errno));
+			return USENET_ERROR;
+		}
+
+		if(_nread == 0) {
+			ring->_eof = 1;
+			break;
+		}
+
+		_buf->_len += (size_t) _nread;
+	}
+
+	ring->_pos += (off_t) _buf->_len;
+	if(_buf->_len > 0)
+		ring->_count++;
+
+	/* start reading the next depth buffers while this one is written */
+	if(!ring->_eof && ring->_advised < ring->_pos + (off_t) (ring->_depth * ring->_sz)) {
+		if(ring->_advised < ring->_pos)
+			ring->_advised = ring->_pos;
+		posix_fadvise(fd, ring->_advised, ring->_pos + (off_t) (ring->_depth * ring->_sz) - ring->_advised, POSIX_FADV_WILLNEED);
+		ring->_advised = ring->_pos + (off_t) (ring->_depth * ring->_sz);
+	}
+
+	return USENET_SUCCESS;
+}
+
+static void _usenet_transfer_ring_free(struct _usenet_transfer_ring* ring)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < ring->_depth; _i++) {
+		if(ring->_bufs[_i]._data)
+			free(ring->_bufs[_i]._data);
+		ring->_bufs[_i]._data = NULL;
+	}
+}
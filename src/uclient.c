@@ -8,6 +8,12 @@
 #include <pthread.h>
 #include <signal.h>
 #include <time.h>
+#include <errno.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/timerfd.h>
+#include <sys/signalfd.h>
+#include <sys/wait.h>
 #include <gqueue.h>
 #include "usenet.h"
 #include "thcon.h"
@@ -15,14 +21,40 @@
 
 #define USENET_CLIENT_MSG_SZ 256
 #define USENET_CLIENT_MSG_PULSE_GAP 5
+#define USENET_CLIENT_HISTORY_GAP_MS 1000
+#define USENET_CLIENT_MAX_EVENTS 8
+#define USENET_CLIENT_RETRY_BASE_SEC 5							/* wait before the first retry of a failed copy */
+#define USENET_CLIENT_RETRY_MAX_SEC 600							/* longest wait between retries */
+#define USENET_CLIENT_RETRY_GROW 16								/* retry entries added at a time */
+
+/* progress broadcast interval, once a second if not configured */
+#define USENET_CLIENT_PROGRESS_GAP_MS(cli)								\
+	((cli)->_login.progress_update_interval > 0 ? (cli)->_login.progress_update_interval * 1000L : 1000L)
 #define USENET_CLIENT_NZBGET_CLIENT "nzbget"
 
 #define USENET_CLIENT_PROGRESS_MAX 40
 
+/* arguments to start nzbget as a daemon */
+static char* const _nzbget_argv[] = {USENET_CLIENT_NZBGET_CLIENT, "-D", NULL};
+
+/* socket of the connection to the server */
+#define USENET_CLIENT_SOCK(cli)					\
+	THCON_GET_ACTIVE_SOCK(&(cli)->_connection)
+
+/* a copy waiting to be retried, the wait doubles with each failure */
+struct uclient_retry
+{
+	int _nzb_id;
+	int _attempts;
+	int _pending_flg;											/* still in the history cache, not yet released */
+	time_t _next;												/* time the item is released to the next poll */
+};
+
 /* struct to encapsulate server component */
 struct uclient
 {
 	int _progress_flg;											/* scp copy progress flag */
+	int _bin_flg;												/* send broadcasts in the binary payload */
 	int _log_fd;												/* log file descriptor */
 	volatile sig_atomic_t _init_flg;							/* flag to indicate initialised struct */
 
@@ -32,49 +64,89 @@ struct uclient
 	 * the client shall quit.
 	 */
 	volatile sig_atomic_t _pulse_sent;
-	volatile sig_atomic_t _ini_wait_flg;						/* flag for the initial wait */
 	volatile unsigned int _act_ix;								/* index for the action to be taken */
 	volatile unsigned int _probe_nzb_flg;						/* flag to indicate probe nzbget */
-	volatile int _act_nzb_id;									/* store the NZB ID here to prevent rename interupted */
-
-	time_t _cp_prog_time;										/* last recorded progress time */
 
-	pid_t _child_pid;											/* child process ID */
 	pid_t _nzbget_pid;											/* nzbget process ID */
 
-	int _pulse_counter;											/* pulse counter */
+	int _epoll_fd;												/* event loop descriptor */
+	int _pulse_fd;												/* timer for the server pulse */
+	int _hist_fd;												/* timer for polling the nzbget history */
+	int _sig_fd;												/* signals handled by the event loop */
+	int _prog_fd;												/* timer for broadcasting the copy progress */
 	const char* _server_name;									/* server name */
 	const char* _server_port;									/* port name */
 
 	struct gapi_login _login;									/* struct containing login settings */
 	pthread_t _thread;											/* thread */
 	pthread_mutex_t _mutex;										/* queue mutex */
+	struct usenet_nzb_batch _nzb_batch;							/* nzbget calls sent with the next history poll */
+	struct usenet_nzb_history _history;							/* nzbget history seen by the last poll */
+	int _hist_done_flg;											/* the empty history was reported */
+	struct uclient_retry* _retries;								/* failed copies, by the event loop only */
+	size_t _num_retries;
+	size_t _retries_sz;
 	thcon _connection;											/* connection object */
+	struct usenet_msg_decoder _decoder;							/* frame decoder for received bytes */
+	struct usenet_rpc_table _rpc_table;							/* handlers of the broadcast rpcs */
+	struct usenet_proc_supervisor _supervisor;					/* child processes of the client */
+	struct usenet_transfer_pool _transfers;						/* workers copying the files to the server */
+};
+
+/* state of one history poll, handed to the history callback */
+struct uclient_history_pass
+{
+	struct uclient* _cli;
+	struct usenet_nzb_batch* _batch;							/* deletes sent at the end of the poll */
 };
 
 static int _data_receive_callback(void* self, void* data, size_t sz);
-static void _signal_hanlder(int signal);
-static int _progress_callback(void* self, float progress);
+static int _frame_callback(void* self, struct usenet_message* msg);
+static int _block_signals(sigset_t* mask);
+static int _add_timer(struct uclient* cli, long first_ms, long interval_ms);
+static int _init_event_loop(struct uclient* cli, const sigset_t* mask);
+static int _run_event_loop(struct uclient* cli);
+static int _handle_signal(struct uclient* cli);
+static int _nzbget_exited(void* self, const struct usenet_proc_stat* stat);
+static int _collect_transfers(struct uclient* cli);
+static int _poll_history(struct uclient* cli);
+static int _send_progress(void* self, int nzb_id, float progress);
 
 static inline __attribute__ ((always_inline)) int _default_response(struct uclient* client, struct usenet_message* msg);
 static inline __attribute__ ((always_inline)) int _send_pulse(struct uclient* client);
 
 static int _msg_handler(struct uclient* cli, struct usenet_message* msg);
 static int _action_json(struct uclient* cli, const char* json_msg);
-static int _echo_daemon_check_to_parent(struct uclient* cli);
 static int _echo_update_list(struct uclient* cli);
-static int _echo_scp_complete(struct uclient* cli);
 static int _echo_scp_done(struct uclient* cli);
+static int _send_bin_broadcast(struct uclient* cli, unsigned char opcode, int nzb_id, float progress);
 
 static int _handle_unknown_message(struct uclient* cli, struct usenet_message* msg);
+static int _handle_bin_message(struct uclient* cli, struct usenet_message* msg);
+static int _register_rpc_handlers(struct uclient* cli);
+
+/* rpc handlers */
+static int _rpc_complete(void* self, struct usenet_rpc_call* call);
+static int _rpc_update_list(void* self, struct usenet_rpc_call* call);
+static int _rpc_scp_complete(void* self, struct usenet_rpc_call* call);
+static int _rpc_progress(void* self, struct usenet_rpc_call* call);
+static int _rpc_done(void* self, struct usenet_rpc_call* call);
 static int _terminate_helper(struct uclient* cli, const char* msg, jsmntok_t* tok);
 static int _terminate_client(struct uclient* cli, pid_t child);
 static int _check_nzb_list(struct uclient* cli);
-static int _copy_file(struct uclient* cli, struct usenet_nzb_filellist* list);
-
-static int _progress_handler(struct uclient* cli, struct usenet_message* msg, jsmntok_t* tok);
+static int _history_changed(void* self, int change, struct usenet_nzb_filellist* entry);
+static void _requeue_deletes(struct uclient* cli, struct usenet_nzb_batch* batch);
+static void _retry_later(struct uclient* cli, int nzb_id);
+static void _retry_release(struct uclient* cli);
+static void _retry_drop(struct uclient* cli, int nzb_id);
+static void _retry_prune(struct uclient* cli);
+static int _queue_copy(struct uclient* cli, struct usenet_nzb_filellist* list);
+
+static int _progress_handler(struct uclient* cli, const char* msg, jsmntok_t* tok);
+static void _log_progress(float progress);
 static int _create_log_file(struct uclient* cli);
 static int _set_scp_progress_flg(struct uclient* cli);
+static int _set_bin_broadcast_flg(struct uclient* cli);
 
 /* static void* _thread_handler(void* obj); */
 
@@ -90,22 +162,24 @@ volatile sig_atomic_t term_sig = 1;
 
 int main(int argc, char** argv)
 {
-	int _cnt = 0;
+	sigset_t _mask;
+
+	/*
+	 * Block the signals before the connection thread starts
+	 * so they are only delivered through the signal descriptor.
+	 */
+	_block_signals(&_mask);
+
 	if(init_client(&client) == USENET_ERROR)
 		return USENET_ERROR;
 
-	signal(SIGINT, _signal_hanlder);
-	while(term_sig) {
-		if(client._init_flg ^ client._ini_wait_flg)
-			pulse_client(&client);
-
-		sleep(1);
-		if(!(++_cnt > client._login.svr_wait_time) && _cnt != 1) {
-			client._ini_wait_flg ^= 1;
-			_cnt = 0;
-		}
+	if(_init_event_loop(&client, &_mask) != USENET_SUCCESS) {
+		stop_client(&client);
+		return USENET_ERROR;
 	}
 
+	_run_event_loop(&client);
+
 	/* stop the server */
 	stop_client(&client);
 	USENET_LOG_MESSAGE("client stopped");
@@ -120,9 +194,17 @@ int init_client(struct uclient* cli)
 	int status = 0;
 	cli->_server_name = NULL;
 	cli->_server_port = NULL;
-	cli->_log_fd = -1;
 
 	memset(cli, 0, sizeof(struct uclient));
+	cli->_log_fd = -1;
+	cli->_epoll_fd = -1;
+	cli->_pulse_fd = -1;
+	cli->_hist_fd = -1;
+	cli->_sig_fd = -1;
+	cli->_prog_fd = -1;
+	pthread_mutex_init(&cli->_mutex, NULL);
+	usenet_nzb_batch_init(&cli->_nzb_batch);
+	usenet_nzb_history_init(&cli->_history);
 
 	/* initialise config object */
 	if(usenet_utils_load_config(&cli->_login) != USENET_SUCCESS) {
@@ -138,6 +220,17 @@ int init_client(struct uclient* cli)
 	cli->_server_name = cli->_login.server_name;
 	cli->_server_port = cli->_login.server_port;
 
+	/*
+	 * The event loop descriptor and the supervisor are ready before the
+	 * connection thread starts, a received message may spawn nzbget.
+	 */
+	cli->_epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if(cli->_epoll_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to create the event loop, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+	usenet_proc_init(&cli->_supervisor, cli->_epoll_fd);
+
 	/* launch connection object as a server */
 	USENET_LOG_MESSAGE("initiating connection object..");
 	status = thcon_init(&cli->_connection, thcon_mode_client);
@@ -151,6 +244,13 @@ int init_client(struct uclient* cli)
 	thcon_set_server_name(&cli->_connection, cli->_server_name);
 	thcon_set_port_name(&cli->_connection, cli->_server_port);
 
+	/* initialise the decoder and rpc table before any data can arrive */
+	if(usenet_decoder_init(&cli->_decoder, _frame_callback, cli) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to initialise the frame decoder");
+		return USENET_ERROR;
+	}
+	_register_rpc_handlers(cli);
+
 	/* assign callbacks */
 	USENET_LOG_MESSAGE("setting callbacks to the connection object");
 	thcon_set_recv_callback(&cli->_connection, _data_receive_callback);
@@ -168,23 +268,29 @@ int init_client(struct uclient* cli)
 
 	cli->_pulse_sent = 0;
 	cli->_init_flg = 0;
-	cli->_pulse_counter = 0;
 	cli->_act_ix = 0;
 	cli->_probe_nzb_flg = 0;
-	cli->_child_pid = -1;
 	cli->_nzbget_pid = -1;
-	cli->_act_nzb_id = 0;
 	cli->_progress_flg = 0;
+	cli->_bin_flg = 0;
 
 	/* set the scp progress flag accordingly */
 	_set_scp_progress_flg(cli);
 
-	/*
-	 * Initialise the progress clock to now.
-	 * this shall be checked every time the callback handler is called.
-	 * only after a diff will the progress update sent to the server.
-	 */
-	time(&cli->_cp_prog_time);
+	/* select the broadcast encoding for this connection */
+	_set_bin_broadcast_flg(cli);
+
+	/* the rpc connections to nzbget are kept for the life of the client */
+	if(usenet_nzb_init(&cli->_login) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to initialise the nzbget rpc client");
+		return USENET_ERROR;
+	}
+
+	/* start the workers copying the completed downloads */
+	if(usenet_transfer_pool_init(&cli->_transfers, &cli->_login) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to start the transfer workers");
+		return USENET_ERROR;
+	}
 
 	return USENET_SUCCESS;
 }
@@ -193,6 +299,271 @@ int init_client(struct uclient* cli)
 int stop_client(struct uclient* svr)
 {
 	thcon_stop(&svr->_connection);
+	usenet_decoder_destroy(&svr->_decoder);
+	usenet_transfer_pool_destroy(&svr->_transfers);
+	usenet_ssh_cleanup();
+	usenet_nzb_cleanup();
+	usenet_nzb_batch_free(&svr->_nzb_batch);
+	usenet_nzb_history_free(&svr->_history);
+	if(svr->_retries)
+		free(svr->_retries);
+	svr->_retries = NULL;
+	svr->_num_retries = 0;
+	pthread_mutex_destroy(&svr->_mutex);
+	usenet_proc_destroy(&svr->_supervisor);
+
+	/* close the event loop descriptors */
+	if(svr->_pulse_fd >= 0)
+		close(svr->_pulse_fd);
+	if(svr->_hist_fd >= 0)
+		close(svr->_hist_fd);
+	if(svr->_sig_fd >= 0)
+		close(svr->_sig_fd);
+	if(svr->_prog_fd >= 0)
+		close(svr->_prog_fd);
+	if(svr->_epoll_fd >= 0)
+		close(svr->_epoll_fd);
+
+	svr->_pulse_fd = -1;
+	svr->_hist_fd = -1;
+	svr->_sig_fd = -1;
+	svr->_prog_fd = -1;
+	svr->_epoll_fd = -1;
+	return USENET_SUCCESS;
+}
+
+/* block the signals handled by the event loop */
+static int _block_signals(sigset_t* mask)
+{
+	sigemptyset(mask);
+	sigaddset(mask, SIGINT);
+	sigaddset(mask, SIGTERM);
+	sigaddset(mask, SIGCHLD);
+
+	if(pthread_sigmask(SIG_BLOCK, mask, NULL) != 0) {
+		USENET_LOG_MESSAGE("unable to block the client signals");
+		return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* create a monotonic timer and register it with the event loop */
+static int _add_timer(struct uclient* cli, long first_ms, long interval_ms)
+{
+	int _fd = -1;
+	struct itimerspec _spec = {{0}};
+	struct epoll_event _ev = {0};
+
+	_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+	if(_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to create timer, %s", strerror(errno));
+		return -1;
+	}
+
+	/* a zero value disarms the timer, fire the first one straight away */
+	if(first_ms <= 0)
+		first_ms = 1;
+
+	_spec.it_value.tv_sec = first_ms / 1000;
+	_spec.it_value.tv_nsec = (first_ms % 1000) * 1000000;
+	_spec.it_interval.tv_sec = interval_ms / 1000;
+	_spec.it_interval.tv_nsec = (interval_ms % 1000) * 1000000;
+
+	_ev.events = EPOLLIN;
+	_ev.data.fd = _fd;
+	if(timerfd_settime(_fd, 0, &_spec, NULL) || epoll_ctl(cli->_epoll_fd, EPOLL_CTL_ADD, _fd, &_ev)) {
+		USENET_LOG_MESSAGE_ARGS("unable to arm timer, %s", strerror(errno));
+		close(_fd);
+		return -1;
+	}
+
+	return _fd;
+}
+
+/*
+ * Add the pulse and history timers and the signal descriptor to the
+ * epoll descriptor. The server wait time delays the first pulse.
+ */
+static int _init_event_loop(struct uclient* cli, const sigset_t* mask)
+{
+	struct epoll_event _ev = {0};
+
+	cli->_sig_fd = signalfd(-1, mask, SFD_NONBLOCK | SFD_CLOEXEC);
+	_ev.events = EPOLLIN;
+	_ev.data.fd = cli->_sig_fd;
+	if(cli->_sig_fd < 0 || epoll_ctl(cli->_epoll_fd, EPOLL_CTL_ADD, cli->_sig_fd, &_ev)) {
+		USENET_LOG_MESSAGE_ARGS("unable to create the signal descriptor, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+
+	cli->_pulse_fd = _add_timer(cli, cli->_login.svr_wait_time * 1000L, USENET_CLIENT_MSG_PULSE_GAP * 1000L);
+	cli->_hist_fd = _add_timer(cli, USENET_CLIENT_HISTORY_GAP_MS, USENET_CLIENT_HISTORY_GAP_MS);
+	if(cli->_pulse_fd < 0 || cli->_hist_fd < 0)
+		return USENET_ERROR;
+
+	/* the progress of the running copies is broadcast on its own timer */
+	if(cli->_progress_flg) {
+		cli->_prog_fd = _add_timer(cli, USENET_CLIENT_PROGRESS_GAP_MS(cli), USENET_CLIENT_PROGRESS_GAP_MS(cli));
+		if(cli->_prog_fd < 0)
+			return USENET_ERROR;
+	}
+
+	/* finished copies are signalled by the transfer workers */
+	_ev.events = EPOLLIN;
+	_ev.data.fd = cli->_transfers._event_fd;
+	if(epoll_ctl(cli->_epoll_fd, EPOLL_CTL_ADD, cli->_transfers._event_fd, &_ev)) {
+		USENET_LOG_MESSAGE_ARGS("unable to watch the transfer workers, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* wait for timers and signals until the client is asked to stop */
+static int _run_event_loop(struct uclient* cli)
+{
+	int _i = 0, _num = 0;
+	uint64_t _exp = 0;
+	struct epoll_event _evs[USENET_CLIENT_MAX_EVENTS];
+
+	while(term_sig) {
+		_num = epoll_wait(cli->_epoll_fd, _evs, USENET_CLIENT_MAX_EVENTS, -1);
+		if(_num < 0) {
+			if(errno == EINTR)
+				continue;
+
+			USENET_LOG_MESSAGE_ARGS("errors occured while waiting for events, %s", strerror(errno));
+			return USENET_ERROR;
+		}
+
+		for(_i = 0; _i < _num; _i++) {
+			if(_evs[_i].data.fd == cli->_sig_fd) {
+				_handle_signal(cli);
+				continue;
+			}
+
+			/* a child process has exited */
+			if(usenet_proc_handle_event(&cli->_supervisor, _evs[_i].data.fd) == USENET_SUCCESS)
+				continue;
+
+			if(_evs[_i].data.fd == cli->_transfers._event_fd) {
+				_collect_transfers(cli);
+				continue;
+			}
+
+			/* drain the expiry count of the timer */
+			if(read(_evs[_i].data.fd, &_exp, sizeof(uint64_t)) != sizeof(uint64_t))
+				continue;
+
+			if(_evs[_i].data.fd == cli->_pulse_fd) {
+				/* keep the cached ssh sessions alive between transfers */
+				usenet_ssh_maintain(&cli->_login);
+				if(cli->_init_flg)
+					pulse_client(cli);
+			}
+			else if(_evs[_i].data.fd == cli->_hist_fd)
+				_poll_history(cli);
+			else if(_evs[_i].data.fd == cli->_prog_fd)
+				usenet_transfer_pool_progress(&cli->_transfers, _send_progress, cli);
+		}
+	}
+
+	return USENET_SUCCESS;
+}
+
+/* read the pending signals */
+static int _handle_signal(struct uclient* cli)
+{
+	struct signalfd_siginfo _info;
+
+	while(read(cli->_sig_fd, &_info, sizeof(struct signalfd_siginfo)) == sizeof(struct signalfd_siginfo)) {
+		switch(_info.ssi_signo) {
+		case SIGCHLD:
+			usenet_proc_reap(&cli->_supervisor);
+			break;
+		case SIGINT:
+		case SIGTERM:
+			USENET_LOG_MESSAGE("stopping client");
+			term_sig = 0;
+			break;
+		}
+	}
+
+	return USENET_SUCCESS;
+}
+
+/*
+ * The spawned nzbget has daemonised. This replaces the round trip
+ * of the launch message through the server.
+ */
+static int _nzbget_exited(void* self, const struct usenet_proc_stat* stat)
+{
+	struct uclient* _cli = (struct uclient*) self;
+
+	if(!WIFEXITED(stat->_status) || WEXITSTATUS(stat->_status) != 0) {
+		USENET_LOG_MESSAGE("nzbget failed to start");
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE("nzbget is launched successfully");
+	_cli->_probe_nzb_flg = 1;
+
+	/* get the pid of newly spawned nzbget instance */
+	_cli->_nzbget_pid = usenet_find_process(USENET_CLIENT_NZBGET_CLIENT);
+	return USENET_SUCCESS;
+}
+
+/* the copied files are removed from the history by the next poll */
+static int _collect_transfers(struct uclient* cli)
+{
+	struct usenet_shape_stat _shape;
+	struct usenet_transfer_job* _job = NULL, *_next = NULL;
+
+	pthread_mutex_lock(&cli->_mutex);
+	for(_job = usenet_transfer_pool_collect(&cli->_transfers); _job; _job = _next) {
+		_next = _job->_next;
+
+		/* a failed copy is released to the history poll once its wait is over */
+		if(_job->_result == USENET_SUCCESS) {
+			usenet_nzb_batch_delete(&cli->_nzb_batch, _job->_nzb_id);
+			_retry_drop(cli, _job->_nzb_id);
+		}
+		else
+			_retry_later(cli, _job->_nzb_id);
+
+		/* the last progress of the file */
+		if(cli->_progress_flg && _job->_result == USENET_SUCCESS)
+			_send_progress(cli, _job->_nzb_id, 1.0);
+
+		usenet_transfer_job_free(_job);
+	}
+	pthread_mutex_unlock(&cli->_mutex);
+
+	/* the shaping counters for tuning the rates */
+	usenet_shape_get_stat(&_shape);
+	if(_shape._bytes > 0)
+		USENET_LOG_MESSAGE_ARGS("shaping, %llu bytes, %llu delays of which %llu global, %.2fs waited, global cap %.0f KB/s",
+								_shape._bytes,
+								_shape._throttled,
+								_shape._global_waits,
+								_shape._wait_seconds,
+								_shape._global_rate / 1024.0);
+
+	return USENET_SUCCESS;
+}
+
+/* check the nzbget history, independent of the pulse */
+static int _poll_history(struct uclient* cli)
+{
+	/* if probe flag was set, update server to broadcast */
+	if(cli->_probe_nzb_flg)
+		_echo_update_list(cli);
+
+	/* if nzbget child process exists */
+	if(cli->_nzbget_pid > 0)
+		_check_nzb_list(cli);
+
 	return USENET_SUCCESS;
 }
 
@@ -201,7 +572,6 @@ int stop_client(struct uclient* svr)
 static int _data_receive_callback(void* self, void* data, size_t sz)
 {
 	struct uclient* _client = NULL;
-	struct usenet_message _msg;
 
 	/*
 	 * If the size is less than 0 or the size is greater
@@ -210,52 +580,58 @@ static int _data_receive_callback(void* self, void* data, size_t sz)
 	if(sz <= 0)
 		return USENET_SUCCESS;
 
-	USENET_LOG_MESSAGE("message received from server");
-
 	_client = (struct uclient*) self;
-	usenet_message_init(&_msg);
-	usenet_unserialise_message(data, sz, &_msg);
 
+	/*
+	 * The received bytes may carry part of a message or several
+	 * messages, the decoder calls the frame callback for each one.
+	 */
+	if(usenet_decoder_feed(&_client->_decoder, data, sz) != USENET_SUCCESS) {
+
+		/*
+		 * The frame boundary is lost, start over on an empty buffer
+		 * and shut the connection down so both sides reconnect and
+		 * exchange a new handshake.
+		 */
+		USENET_LOG_MESSAGE("errors occured while decoding received data, resetting the connection");
+		usenet_decoder_reset(&_client->_decoder);
+		shutdown(USENET_CLIENT_SOCK(_client), SHUT_RDWR);
+	}
+
+	return 0;
+}
+
+/* called by the decoder for every complete message */
+static int _frame_callback(void* self, struct usenet_message* msg)
+{
+	struct uclient* _client = (struct uclient*) self;
+
+	USENET_LOG_MESSAGE("message received from server");
 
 	/* we receive some thing therefore pulse flag is reset */
 	_client->_pulse_sent = USENET_PULSE_RESET;
 
-
 	/*
 	 * if a request instruction was sent, acknowledge
 	 * to the server.
 	 */
-	_msg_handler(_client, &_msg);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
-
-	return 0;
+	return _msg_handler(_client, msg);
 }
 
 int pulse_client(struct uclient* cli)
 {
-	/*
-	 * We only send a pulse every USENET_CLIENT_MSG_PULSE_GAP
-	 */
-	if(++cli->_pulse_counter < USENET_CLIENT_MSG_PULSE_GAP)
-		return 0;
-
-	/* terminate the child process if running */
-	_terminate_client(cli, -1);
-
-	/* if probe flag was set, update server to broadcast */
-	if(cli->_probe_nzb_flg)
-		_echo_update_list(cli);
-
-	/* if nzbget child process exists */
-	if(cli->_nzbget_pid > 0)
-		_check_nzb_list(cli);
-
-	/* reset counter back to 0 to start timer again */
-	cli->_pulse_counter = 0;
+	struct usenet_pool_stats _pool_stats = {0};
 
 	/* send pulse to server */
 	_send_pulse(cli);
 
+	/* report the message pool counters */
+	usenet_pool_get_stats(&_pool_stats);
+	USENET_LOG_MESSAGE_ARGS("message pool hits: %lu, misses: %lu, in use: %lu",
+							_pool_stats._hits,
+							_pool_stats._misses,
+							_pool_stats._in_use);
+
 	/*
 	 * Check if the server has responded to the previous.
 	 * If haven't raise signal to terminate.
@@ -265,35 +641,23 @@ int pulse_client(struct uclient* cli)
 		/* raise(SIGINT); */
 	}
 
-	cli->_ini_wait_flg = 0;
 	cli->_pulse_sent = USENET_PULSE_SENT;
 	return 0;
 }
 
-static void _signal_hanlder(int signal)
-{
-	USENET_LOG_MESSAGE("stopping client");
-	term_sig = 0;
-}
-
 /* Default reponse */
 static int _default_response(struct uclient* client, struct usenet_message* msg)
 {
-	void* _data = NULL;
-	size_t _size = 0;
-
 	msg->ins = USENET_REQUEST_RESPONSE;
-	usenet_serialise_message(msg, &_data, &_size);
 
 	USENET_LOG_MESSAGE("sending default response");
-	thcon_send_info(&client->_connection, _data, _size);
+	usenet_send_message(USENET_CLIENT_SOCK(client), msg);
 
 	/*
 	 * after successfully initialised, set the init flg
 	 * to send a pulse to the server.
 	 */
 	client->_init_flg = 1;
-	free(_data);
 	return 0;
 }
 
@@ -333,6 +697,12 @@ static int _msg_handler(struct uclient* cli, struct usenet_message* msg)
 		}
 		break;
 	default:
+		/* binary broadcasts don't need the json parser */
+		if(msg->ins == USENET_REQUEST_BROADCAST_BIN) {
+			_handle_bin_message(cli, msg);
+			break;
+		}
+
 		USENET_LOG_MESSAGE("unkown request received, handling message..");
 		_handle_unknown_message(cli, msg);
 	}
@@ -402,23 +772,10 @@ static int _action_json(struct uclient* cli, const char* json_msg)
 	if(cli->_nzbget_pid < 0) {
 		USENET_LOG_MESSAGE("process not initialised, spawning nzbget");
 
-		/* fork the process here, call system to spawn nzbget */
-		cli->_child_pid = fork();
-		if(cli->_child_pid == 0) {
-
-			/* this is the child process therefore spawn nzbget */
-			USENET_LOG_MESSAGE("starting nzbget as a deamon");
-			system("nzbget -D");
-
-			_echo_daemon_check_to_parent(cli);
-			_echo_update_list(cli);
-
-			/* raise signal to terminate self */
-			USENET_LOG_MESSAGE("stopping client");
-			stop_client(&client);
-			raise(SIGINT);
-			exit(0);
-		}
+		/* nzbget forks the daemon and exits, the exit is handled in the event loop */
+		USENET_LOG_MESSAGE("starting nzbget as a deamon");
+		if(usenet_proc_spawn(&cli->_supervisor, _nzbget_argv, _nzbget_exited, cli, NULL) != USENET_SUCCESS)
+			_ret = USENET_ERROR;
 	}
 	else {
 		USENET_LOG_MESSAGE_ARGS("process found with pid %i", cli->_nzbget_pid);
@@ -428,140 +785,124 @@ static int _action_json(struct uclient* cli, const char* json_msg)
 	return _ret;
 }
 
-static int _echo_daemon_check_to_parent(struct uclient* cli)
+
+/* dispatch the json broadcast through the rpc table */
+static int _handle_unknown_message(struct uclient* cli, struct usenet_message* msg)
 {
-	struct usenet_message _msg;
-	void* _data = NULL;
-	size_t _size = 0;
+	USENET_LOG_MESSAGE("parsing unknown message");
+	return usenet_rpc_dispatch_json(&cli->_rpc_table, msg->msg_body);
+}
 
-	usenet_message_init(&_msg);
-	_msg.ins = USENET_REQUEST_BROADCAST;
-	_msg.msg_body = (char*) malloc(sizeof(char)*USENET_JSON_BUFF_SZ);
-	_msg.size += USENET_JSON_BUFF_SZ;
-	memset(_msg.msg_body, 0, sizeof(char)*USENET_JSON_BUFF_SZ);
+/* dispatch the binary broadcast through the rpc table */
+static int _handle_bin_message(struct uclient* cli, struct usenet_message* msg)
+{
+	if(msg->msg_body == NULL)
+		return USENET_ERROR;
 
-	snprintf(_msg.msg_body,
-			 USENET_JSON_BUFF_SZ,
-			 "{\"%s\": \"%s\", \"%s\": []}",
-			 USENET_JSON_FN_HEADER, USENET_JSON_FN_1, USENET_JSON_ARG_HEADER);
+	return usenet_rpc_dispatch_bin(&cli->_rpc_table,
+								   msg->msg_body,
+								   USENET_GET_MSG_SIZE(msg) - USENET_MSG_HEADER_SZ);
+}
 
-	USENET_LOG_MESSAGE("serialise message");
-	usenet_serialise_message(&_msg, &_data, &_size);
+/* bind the broadcast rpcs to their handlers */
+static int _register_rpc_handlers(struct uclient* cli)
+{
+	usenet_rpc_init(&cli->_rpc_table, cli);
 
-	USENET_LOG_MESSAGE("broadcasting message to parent to indicate it I am complete");
-	thcon_send_info(&cli->_connection, _data, _size);
+	usenet_rpc_register(&cli->_rpc_table, USENET_JSON_FN_1, USENET_RPC_OP_COMPLETE, _rpc_complete);
+	usenet_rpc_register(&cli->_rpc_table, USENET_JSON_FN_2, USENET_RPC_OP_UPDATE_LIST, _rpc_update_list);
+	usenet_rpc_register(&cli->_rpc_table, USENET_JSON_FN_3, USENET_RPC_OP_SCP_COMPLETE, _rpc_scp_complete);
+	usenet_rpc_register(&cli->_rpc_table, USENET_JSON_FN_4, USENET_RPC_OP_PROGRESS, _rpc_progress);
+	usenet_rpc_register(&cli->_rpc_table, USENET_JSON_FN_5, USENET_RPC_OP_DONE, _rpc_done);
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
 	return USENET_SUCCESS;
 }
 
-
-static int _handle_unknown_message(struct uclient* cli, struct usenet_message* msg)
+/* nzbget was launched by the child process */
+static int _rpc_complete(void* self, struct usenet_rpc_call* call)
 {
-	int _num = 0;
-	jsmntok_t* _tok = NULL, *_rpc_tok = NULL, *_arg_tok = NULL;
-	char* _rpc_val = NULL, *_arg_val = NULL;
-
+	struct uclient* _cli = (struct uclient*) self;
 
-	int _ret = USENET_SUCCESS;
+	USENET_LOG_MESSAGE("echo message received from child process, nzbget is launched successfully");
+	_cli->_probe_nzb_flg = 1;
 
-	/* parse the message */
-	USENET_LOG_MESSAGE("parsing unknown message");
+	/* get the pid of newly spawned nzbget instance */
+	_cli->_nzbget_pid = usenet_find_process(USENET_CLIENT_NZBGET_CLIENT);
+	return USENET_SUCCESS;
+}
 
-	if(usjson_parse_message(msg->msg_body, &_tok, &_num) != USENET_SUCCESS)
-		return USENET_ERROR;
+static int _rpc_update_list(void* self, struct usenet_rpc_call* call)
+{
+	struct uclient* _cli = (struct uclient*) self;
 
-	/* get token */
-	USENET_LOG_MESSAGE("inspecting remote procedure call");
-	if(usjson_get_token(msg->msg_body, _tok, _num, USENET_JSON_FN_HEADER, &_rpc_val, &_rpc_tok) != USENET_SUCCESS) {
-		_ret = USENET_ERROR;
-		USENET_LOG_MESSAGE("json parser error");
-		goto clean_up;
-	}
+	/* sent with the next history poll */
+	USENET_LOG_MESSAGE("echo message received to update the nzbget list");
+	pthread_mutex_lock(&_cli->_mutex);
+	usenet_nzb_batch_scan(&_cli->_nzb_batch);
+	pthread_mutex_unlock(&_cli->_mutex);
 
-	/* compare the function call */
-	if(strcmp(_rpc_val, USENET_JSON_FN_1) == 0) {
-		USENET_LOG_MESSAGE("echo message received from child process, nzbget is launched successfully");
-		cli->_probe_nzb_flg = 1;
+	return USENET_SUCCESS;
+}
 
-		/* get the pid of newly spawned nzbget instance */
-		cli->_nzbget_pid = usenet_find_process(USENET_CLIENT_NZBGET_CLIENT);
-	}
-	else if(strcmp(_rpc_val, USENET_JSON_FN_2) == 0) {
-		USENET_LOG_MESSAGE("echo message received to update the nzbget list");
-		usenet_nzb_scan();
-	}
-	else if(strcmp(_rpc_val, USENET_JSON_FN_3) == 0) {
-		/*
-		 * The child process is indicating the scp operation is complete.
-		 * Get the array value.
-		 */
-		USENET_LOG_MESSAGE("process complete message recieved");
-		if(usjson_get_token(msg->msg_body, _tok, _num, USENET_JSON_ARG_HEADER, &_arg_val, &_arg_tok) != USENET_SUCCESS) {
-			_ret = USENET_ERROR;
-			USENET_LOG_MESSAGE("unable to parse json to get the array value");
-			goto clean_up;
-		}
+/*
+ * A child process is indicating the scp operation is complete.
+ * Terminate it using the pid in the arguments, only children of
+ * this client are signalled. Copies made by this client run on the
+ * transfer workers and are collected in the event loop.
+ */
+static int _rpc_scp_complete(void* self, struct usenet_rpc_call* call)
+{
+	jsmntok_t* _arg_tok = NULL;
+	struct uclient* _cli = (struct uclient*) self;
 
-		USENET_LOG_MESSAGE("attempting to terminate the process");
-		if(_arg_val) {
-			/*
-			 * Call the helper method to parse the array and
-			 * kill the process with process id
-			 */
-			_terminate_helper(cli, msg->msg_body, _arg_tok);
-
-			/* reset the index */
-			cli->_act_nzb_id = 0;
-			free(_arg_val);
-		}
+	USENET_LOG_MESSAGE("process complete message recieved");
 
-		_arg_tok = NULL;
-		_arg_val = NULL;
+	/* binary payload carries the pid */
+	if(call->_json == NULL)
+		return _terminate_client(_cli, call->_payload._pid);
 
+	if(usjson_get_token(call->_json, call->_tok, call->_num_tok, USENET_JSON_ARG_HEADER, NULL, &_arg_tok) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to parse json to get the array value");
+		return USENET_ERROR;
 	}
-	else if(strcmp(_rpc_val, USENET_JSON_FN_4) == 0) {
 
-		if(usjson_get_token(msg->msg_body, _tok, _num, USENET_JSON_ARG_HEADER, &_arg_val, &_arg_tok) != USENET_SUCCESS) {
-			_ret = USENET_ERROR;
-			goto clean_up;
-		}
-
-		if(_arg_val) {
+	/*
+	 * Call the helper method to parse the array and
+	 * kill the process with process id
+	 */
+	USENET_LOG_MESSAGE("attempting to terminate the process");
+	return _terminate_helper(_cli, call->_json, _arg_tok);
+}
 
-			/* write the progress to the screen or log */
-			_progress_handler(cli, msg, _arg_tok);
+static int _rpc_progress(void* self, struct usenet_rpc_call* call)
+{
+	jsmntok_t* _arg_tok = NULL;
 
-			free(_arg_val);
-			_arg_val = NULL;
-		}
+	if(call->_json == NULL) {
+		_log_progress((float) call->_payload._progress / USENET_BIN_PROGRESS_SCALE);
+		return USENET_SUCCESS;
 	}
 
+	if(usjson_get_token(call->_json, call->_tok, call->_num_tok, USENET_JSON_ARG_HEADER, NULL, &_arg_tok) != USENET_SUCCESS)
+		return USENET_ERROR;
 
-clean_up:
-	USENET_LOG_MESSAGE("cleaning up the allocated memory");
-	/* free allocated resources */
-	if(_tok)
-		free(_tok);
-
-	if(_rpc_val)
-		free(_rpc_val);
+	/* write the progress to the screen or log */
+	return _progress_handler((struct uclient*) self, call->_json, _arg_tok);
+}
 
-	return _ret;
+static int _rpc_done(void* self, struct usenet_rpc_call* call)
+{
+	USENET_LOG_MESSAGE("client reported all copies are done");
+	return USENET_SUCCESS;
 }
 
 /* Kills the child process, child argument takes priority */
 static int _terminate_client(struct uclient* cli, pid_t child)
 {
+	/* only our own children are signalled, the pid is not trusted */
 	if(child > 0) {
 		USENET_LOG_MESSAGE_ARGS("terminating child process: %i", child);
-		kill(child, SIGKILL);
-	}
-	else if(cli->_child_pid > 0) {
-		USENET_LOG_MESSAGE_ARGS("terminating child process: %i", cli->_child_pid);
-		kill(cli->_child_pid, SIGKILL);
-		cli->_child_pid = -1;
+		usenet_proc_kill(&cli->_supervisor, child, SIGKILL);
 	}
 
 	return USENET_SUCCESS;
@@ -570,25 +911,23 @@ static int _terminate_client(struct uclient* cli, pid_t child)
 static int _echo_update_list(struct uclient* cli)
 {
 	struct usenet_message _msg;
-	void* _data = NULL;
-	size_t _size = 0;
+
+	if(cli->_bin_flg) {
+		cli->_probe_nzb_flg = 0;
+		return _send_bin_broadcast(cli, USENET_RPC_OP_UPDATE_LIST, 0, 0.0);
+	}
 
 	usenet_message_init(&_msg);
 	_msg.ins = USENET_REQUEST_BROADCAST;
 
-	_msg.msg_body = (char*) malloc(sizeof(char) * USENET_JSON_BUFF_SZ);
-	memset(_msg.msg_body, 0, sizeof(char) * USENET_JSON_BUFF_SZ);
+	USENET_CREATE_POOLED_MESSAGE(&_msg, USENET_JSON_BUFF_SZ);
 	snprintf(_msg.msg_body,
 			 USENET_JSON_BUFF_SZ,
 			 "{\"%s\": \"%s\", \"%s\": []}",
 			 USENET_JSON_FN_HEADER, USENET_JSON_FN_2, USENET_JSON_ARG_HEADER);
 
-	/* serialise the message */
-	USENET_LOG_MESSAGE("serialising the message");
-	usenet_serialise_message(&_msg, &_data, &_size);
-
 	USENET_LOG_MESSAGE("broadcasting message update list");
-	thcon_send_info(&cli->_connection, _data, _size);
+	usenet_send_message(USENET_CLIENT_SOCK(cli), &_msg);
 
 	/*
 	 * we turn the probe flag off as we don't want nzbget to
@@ -596,194 +935,276 @@ static int _echo_update_list(struct uclient* cli)
 	 */
 	cli->_probe_nzb_flg = 0;
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
+	USENET_DESTROY_POOLED_MESSAGE(&_msg);
 	return USENET_SUCCESS;
 }
 
 static inline __attribute__ ((always_inline)) int _send_pulse(struct uclient* client)
 {
 	struct usenet_message _msg = {0};
-	thcon* _con = NULL;
-	void* _data = NULL;
-	size_t _size = 0;
 
 	usenet_message_init(&_msg);
 	_msg.ins = USENET_REQUEST_PULSE;
-	_msg.msg_body = (char*) malloc(sizeof(char) * USENET_JSON_BUFF_SZ);
-	memset(_msg.msg_body, 0, sizeof(char) * USENET_JSON_BUFF_SZ);
+	USENET_CREATE_POOLED_MESSAGE(&_msg, USENET_JSON_BUFF_SZ);
 
 	snprintf(_msg.msg_body, sizeof(char) * USENET_JSON_BUFF_SZ, "%s", "alive");
 
-	/* serialise the buffer */
-	USENET_LOG_MESSAGE("serialising the message");
-	usenet_serialise_message(&_msg, &_data, &_size);
-
-	/* get pointer to the connection object */
-	_con = &client->_connection;
-
 	USENET_LOG_MESSAGE("sending server pulse");
-	thcon_send_info(_con, _data, _size);
+	usenet_send_message(USENET_CLIENT_SOCK(client), &_msg);
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
+	USENET_DESTROY_POOLED_MESSAGE(&_msg);
 	return USENET_SUCCESS;
 }
 
 /*
- * Queries the nzbget list and once which are finished
- * can be renamed and scp to the server.
+ * Queries the nzbget history and acts on the items which changed since
+ * the last poll, the finished ones are renamed and copied to the server.
  */
 static int _check_nzb_list(struct uclient* cli)
 {
-	int _i = 0;
-	size_t _list_sz = 0;
-	int _s_flg = 0;													/* flag to indicate success of failure */
-	struct usenet_nzb_filellist* _list = NULL;
+	int _changes = 0;
+	struct usenet_nzb_batch _batch;
+	struct uclient_history_pass _pass;
 
 	USENET_LOG_MESSAGE_ARGS("found nzbget with pid %i, getting history", cli->_nzbget_pid);
 
+	/* take the calls queued since the last poll, the deletes go before the history */
+	pthread_mutex_lock(&cli->_mutex);
+	_batch = cli->_nzb_batch;
+	usenet_nzb_batch_init(&cli->_nzb_batch);
+	pthread_mutex_unlock(&cli->_mutex);
+
 	/* call the interface method for getting a list */
 	USENET_LOG_MESSAGE("getting history list");
-	usenet_nzb_get_history(&_list, &_list_sz);
+	usenet_nzb_batch_history(&_batch);
+	if(usenet_nzb_batch_flush(&_batch) != USENET_SUCCESS || _batch._delete_result != USENET_SUCCESS)
+		_requeue_deletes(cli, &_batch);
+
+	/* a failed call is not an empty history, the cache is kept for the next poll */
+	if(_batch._history_result != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE("unable to get the nzbget history");
+		usenet_nzb_batch_free(&_batch);
+		return USENET_ERROR;
+	}
 
-	/* if list size is zero let the server we are done */
-	if(_list_sz == 0)
-		_echo_scp_done(cli);
+	/* the deletes of this pass are queued in the batch by the callback */
+	_batch._num_delete = 0;
+	_pass._cli = cli;
+	_pass._batch = &_batch;
 
-	/* iterate through the list and action */
-	for(_i = 0; _i < _list_sz; _i++) {
+	/* the failed copies due for a retry show up as inserted */
+	_retry_release(cli);
 
-		/* do stuff here */
-		if(!_list[_i]._nzb_name || !_list[_i]._status)
-			continue;
+	_changes = usenet_nzb_history_sync(&cli->_history, _batch._history, _batch._num_history, _history_changed, &_pass);
+	if(_changes > 0)
+		USENET_LOG_MESSAGE_ARGS("%i changes in the history of %lu items", _changes, cli->_history._num);
 
-		/* create standard name field and copy to it */
-		usenet_utils_append_std_fname(&_list[_i]);
+	/* a released item missing from this poll is never seen again */
+	if(_changes >= 0)
+		_retry_prune(cli);
 
-		USENET_LOG_MESSAGE_ARGS("nzb file name: %s, and status: %s", _list[_i]._u_std_fname, _list[_i]._status);
+	/* let the server know once the history is empty */
+	if(cli->_history._num == 0) {
+		if(!cli->_hist_done_flg)
+			_echo_scp_done(cli);
+		cli->_hist_done_flg = 1;
+	}
+	else
+		cli->_hist_done_flg = 0;
 
-		/*
-		 * If the download was not sucessful or the the nzb id being processed is same as
-		 * this one we continue with the next one.
-		 */
-		_s_flg = strcmp(_list[_i]._status, USENET_NZB_SUCCESS);
-		if(_s_flg || cli->_act_nzb_id != 0) {
-			if(_s_flg)
-				usenet_nzb_delete_item_from_history(&_list[_i]._nzb_id, 1);
-			continue;
-		}
+	/* remove the failed items in one call */
+	if(_batch._num_delete > 0 &&
+	   (usenet_nzb_batch_flush(&_batch) != USENET_SUCCESS || _batch._delete_result != USENET_SUCCESS))
+		_requeue_deletes(cli, &_batch);
 
-		if(cli->_act_nzb_id == 0)
-			cli->_act_nzb_id = _list[_i]._nzb_id;
+	/* the entries kept are owned by the cache, free the rest */
+	usenet_nzb_batch_free(&_batch);
 
-		/*
-		 * Rename and copy the file in a forked process.
-		 * If not delete the file in the next round
-		 */
-		if(usenet_utils_rename_file(&_list[_i], cli->_login.nzb_fsize_threshold) == USENET_SUCCESS)
-			_copy_file(cli, &_list[_i]);
-		else {
-			usenet_nzb_delete_item_from_history(&_list[_i]._nzb_id, 1);
-			cli->_act_nzb_id = 0;
-		}
+	return USENET_SUCCESS;
+}
 
+/*
+ * Called for each item inserted, updated or removed since the last poll.
+ * A failed download is removed from the history, a finished one is renamed
+ * and queued for the transfer workers.
+ */
+static int _history_changed(void* self, int change, struct usenet_nzb_filellist* entry)
+{
+	struct uclient_history_pass* _pass = (struct uclient_history_pass*) self;
+	struct uclient* _cli = _pass->_cli;
+
+	/* nothing to do for an item which left the history */
+	if(change == USENET_NZB_HISTORY_REMOVE) {
+		_retry_drop(_cli, entry->_nzb_id);
+		return USENET_SUCCESS;
 	}
 
-	/* free the list and return */
-	USENET_LOG_MESSAGE("free file list");
-	for(_i = 0; _i < _list_sz; _i++) {
-		USENET_FILELIST_FREE(&_list[_i]);
+	if(!entry->_nzb_name || !entry->_status)
+		return USENET_SUCCESS;
+
+	/* create standard name field and copy to it */
+	usenet_utils_append_std_fname(entry);
+
+	USENET_LOG_MESSAGE_ARGS("nzb file name: %s, and status: %s", entry->_u_std_fname, entry->_status);
+
+	/*
+	 * If the download was not sucessful remove it, if the nzb is
+	 * already with the transfer workers there is nothing to do.
+	 */
+	if(strcmp(entry->_status, USENET_NZB_SUCCESS))
+		return usenet_nzb_batch_delete(_pass->_batch, entry->_nzb_id);
+
+	if(usenet_transfer_pool_find(&_cli->_transfers, entry->_nzb_id))
+		return USENET_SUCCESS;
+
+	/*
+	 * Rename and queue the file for the transfer workers.
+	 * If not delete the file in the next round
+	 */
+	if(usenet_utils_rename_file(entry, _cli->_login.nzb_fsize_threshold) != USENET_SUCCESS)
+		return usenet_nzb_batch_delete(_pass->_batch, entry->_nzb_id);
+
+	/* the cache can't change during the sync, the item is released by a later poll */
+	if(_queue_copy(_cli, entry) != USENET_SUCCESS) {
+		_retry_later(_cli, entry->_nzb_id);
+		return USENET_ERROR;
 	}
-	free(_list);
 
 	return USENET_SUCCESS;
 }
 
 /*
- * Method for copying the file to the remote destination.
- * This uses a forked process and send message to the remote server on completion.
+ * Hold a failed copy back from the history poll. The item stays in the
+ * history cache, so it is not seen again, until its wait is over. The
+ * wait doubles with each failure up to USENET_CLIENT_RETRY_MAX_SEC.
  */
-static int _copy_file(struct uclient* cli, struct usenet_nzb_filellist* list)
+static void _retry_later(struct uclient* cli, int nzb_id)
 {
-	int _stat = USENET_SUCCESS;
-	char* _fname = NULL;
-	size_t _len = 0;
+	size_t _i = 0;
+	long _wait = USENET_CLIENT_RETRY_BASE_SEC;
+	struct uclient_retry* _retry = NULL, *_tmp = NULL;
+
+	for(_i = 0; _i < cli->_num_retries && _retry == NULL; _i++) {
+		if(cli->_retries[_i]._nzb_id == nzb_id)
+			_retry = &cli->_retries[_i];
+	}
 
-	/* fork the process */
-	pid_t _pid = 0;
+	if(_retry == NULL) {
+		if(cli->_num_retries == cli->_retries_sz) {
+			_tmp = (struct uclient_retry*) realloc(cli->_retries, (cli->_retries_sz + USENET_CLIENT_RETRY_GROW) * sizeof(struct uclient_retry));
+			if(_tmp == NULL) {
+				/* without an entry the item is retried on the next poll */
+				usenet_nzb_history_forget(&cli->_history, nzb_id);
+				return;
+			}
+
+			cli->_retries = _tmp;
+			cli->_retries_sz += USENET_CLIENT_RETRY_GROW;
+		}
 
-	/* fork the process */
-	USENET_LOG_MESSAGE("forking the process to copy the file to the remote server");
-	_pid = fork();
+		_retry = &cli->_retries[cli->_num_retries++];
+		memset(_retry, 0, sizeof(struct uclient_retry));
+		_retry->_nzb_id = nzb_id;
+	}
 
-	/* if this is the parent process exit here */
-	if(_pid != 0)
-		return USENET_SUCCESS;
+	for(_i = 0; _i < (size_t) _retry->_attempts && _wait < USENET_CLIENT_RETRY_MAX_SEC; _i++)
+		_wait *= 2;
+	if(_wait > USENET_CLIENT_RETRY_MAX_SEC)
+		_wait = USENET_CLIENT_RETRY_MAX_SEC;
 
-	/* construct the destination path */
-	_stat = usenet_utils_create_destinatin_path(&cli->_login, list, &_fname, &_len);
-	if(_stat == USENET_ERROR) {
-		USENET_LOG_MESSAGE("errors occured while creating destination path");
-		goto cleanup;
+	_retry->_attempts++;
+	_retry->_pending_flg = 1;
+	_retry->_next = time(NULL) + _wait;
+
+	USENET_LOG_MESSAGE_ARGS("copy of nzb %i failed %i times, retrying in %lis", nzb_id, _retry->_attempts, _wait);
+}
+
+/* drop the items due for a retry from the history cache, the next sync inserts them */
+static void _retry_release(struct uclient* cli)
+{
+	size_t _i = 0;
+	time_t _now = time(NULL);
+
+	for(_i = 0; _i < cli->_num_retries; _i++) {
+		if(!cli->_retries[_i]._pending_flg || cli->_retries[_i]._next > _now)
+			continue;
+
+		cli->_retries[_i]._pending_flg = 0;
+		usenet_nzb_history_forget(&cli->_history, cli->_retries[_i]._nzb_id);
 	}
+}
 
-	/*
-	 * SCP the file if it was successful, remove from list.
-	 */
-	if(usenet_utils_scp_file(&cli->_login,
-							 list->_u_r_fpath,
-							 _fname,
-							 (cli->_progress_flg? _progress_callback : NULL),
-							 (void*) cli) == USENET_SUCCESS)
-		usenet_nzb_delete_item_from_history(&list->_nzb_id, 1);
-
-	/* echo the message to the server to indicate complete */
-	_echo_scp_complete(cli);
-
-cleanup:
-	/* exit(0); */
-	return USENET_SUCCESS;
+/* forget the failures of an item which was copied or left the history */
+static void _retry_drop(struct uclient* cli, int nzb_id)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < cli->_num_retries; _i++) {
+		if(cli->_retries[_i]._nzb_id == nzb_id) {
+			cli->_retries[_i] = cli->_retries[--cli->_num_retries];
+			return;
+		}
+	}
 }
 
 /*
- * Indicate to the server that the scp operation is complete.
- * this is relayed back to the client.
+ * Drop the released items which the sync did not insert again. Such an
+ * item left the history while it was out of the cache, so no remove is
+ * reported for it.
  */
-static int _echo_scp_complete(struct uclient* cli)
+static void _retry_prune(struct uclient* cli)
 {
-	pid_t _pid;
-	struct usenet_message _msg;
-	void* _data = NULL;
-	size_t _size = 0;
+	size_t _i = 0;
 
-	/* get the pid */
-	_pid = getpid();
+	while(_i < cli->_num_retries) {
+		if(!cli->_retries[_i]._pending_flg &&
+		   usenet_nzb_history_find(&cli->_history, cli->_retries[_i]._nzb_id) == NULL) {
+			USENET_LOG_MESSAGE_ARGS("nzb %i left the history before its retry", cli->_retries[_i]._nzb_id);
+			cli->_retries[_i] = cli->_retries[--cli->_num_retries];
+			continue;
+		}
 
-	/* format the message */
-	usenet_message_init(&_msg);
-	_msg.ins = USENET_REQUEST_BROADCAST;
-	_msg.msg_body = (char*) malloc(sizeof(char)*USENET_JSON_BUFF_SZ);
-	memset(_msg.msg_body, 0, sizeof(char)*USENET_JSON_BUFF_SZ);
+		_i++;
+	}
+}
 
-	snprintf(_msg.msg_body,
-			 USENET_JSON_BUFF_SZ,
-			 "{\"%s\": \"%s\", \"%s\": [\"%i\"]}",
-			USENET_JSON_FN_HEADER,
-			USENET_JSON_FN_3,
-			USENET_JSON_ARG_HEADER,
-			_pid);
+/* put the ids of a failed delete back for the next poll */
+static void _requeue_deletes(struct uclient* cli, struct usenet_nzb_batch* batch)
+{
+	size_t _i = 0;
 
-	/* serialise the message */
-	USENET_LOG_MESSAGE("serialising the message");
-	usenet_serialise_message(&_msg, &_data, &_size);
+	if(batch->_num_delete == 0)
+		return;
 
-	USENET_LOG_MESSAGE_ARGS("broadcasting message, %s, scp complete", _msg.msg_body);
-	thcon_send_info(&cli->_connection, _data, _size);
+	USENET_LOG_MESSAGE("unable to remove the items from the history, retrying on the next poll");
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
-	return USENET_SUCCESS;
+	pthread_mutex_lock(&cli->_mutex);
+	for(_i = 0; _i < batch->_num_delete; _i++)
+		usenet_nzb_batch_delete(&cli->_nzb_batch, batch->_delete_ids[_i]);
+	pthread_mutex_unlock(&cli->_mutex);
+}
+
+/*
+ * Queue the file for copying to the remote destination.
+ * The workers signal the event loop once it is done.
+ */
+static int _queue_copy(struct uclient* cli, struct usenet_nzb_filellist* list)
+{
+	int _stat = USENET_SUCCESS;
+	char* _fname = NULL;
+	size_t _len = 0;
+
+	/* construct the destination path */
+	_stat = usenet_utils_create_destinatin_path(&cli->_login, list, &_fname, &_len);
+	if(_stat == USENET_ERROR) {
+		USENET_LOG_MESSAGE("errors occured while creating destination path");
+		return USENET_ERROR;
+	}
+
+	_stat = usenet_transfer_pool_submit(&cli->_transfers, list->_nzb_id, list->_u_r_fpath, _fname);
+
+	free(_fname);
+	return _stat;
 }
 
 /*
@@ -817,9 +1238,7 @@ static int _terminate_helper(struct uclient* cli, const char* msg, jsmntok_t* to
 		_str_arr._arr[_i] = NULL;
 	}
 
-	/* reset the active NZB ID */
-	cli->_act_nzb_id = 0;
-
+	/* the active NZB ID is reset when the copy process is reaped */
 	if(_str_arr._arr != NULL)
 		free(_str_arr._arr);
 	_str_arr._arr = NULL;
@@ -828,15 +1247,12 @@ static int _terminate_helper(struct uclient* cli, const char* msg, jsmntok_t* to
 }
 
 /*
- * indicate progress to the server.
+ * indicate progress of a copy to the server, called on the progress timer.
  */
-static int _progress_callback(void* self, float progress)
+static int _send_progress(void* self, int nzb_id, float progress)
 {
 	struct usenet_message _msg;
 	struct uclient* _self = NULL;
-	void* _data = NULL;
-	size_t _size = 0;
-	time_t _now;
 
 	if(self == NULL)
 		return USENET_ERROR;
@@ -844,19 +1260,13 @@ static int _progress_callback(void* self, float progress)
 	/* cast the object to uclient */
 	_self = (struct uclient*) self;
 
-	/* compare the times */
-	time(&_now);
-	if(difftime(_now, _self->_cp_prog_time) < _self->_login.progress_update_interval)
-		return USENET_SUCCESS;
-
-	/* set the current time */
-	time(&_self->_cp_prog_time);
+	if(_self->_bin_flg)
+		return _send_bin_broadcast(_self, USENET_RPC_OP_PROGRESS, nzb_id, progress);
 
 	/* format the message */
 	usenet_message_init(&_msg);
 	_msg.ins = USENET_REQUEST_BROADCAST;
-	_msg.msg_body = (char*) malloc(sizeof(char) * USENET_JSON_BUFF_SZ);
-	memset(_msg.msg_body, 0, sizeof(char) * USENET_JSON_BUFF_SZ);
+	USENET_CREATE_POOLED_MESSAGE(&_msg, USENET_JSON_BUFF_SZ);
 
 	snprintf(_msg.msg_body,
 			 USENET_JSON_BUFF_SZ,
@@ -866,26 +1276,21 @@ static int _progress_callback(void* self, float progress)
 			USENET_JSON_ARG_HEADER,
 			progress);
 
-	/* serialise the buffer */
-	usenet_serialise_message(&_msg, &_data, &_size);
-
 	/* no logging is done here to minimise stdout */
-	thcon_send_info(&_self->_connection, _data, _size);
+	usenet_send_message(USENET_CLIENT_SOCK(_self), &_msg);
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
+	USENET_DESTROY_POOLED_MESSAGE(&_msg);
 	return USENET_SUCCESS;
 }
 
 /* log progress to the screen */
-static int _progress_handler(struct uclient* cli, struct usenet_message* msg, jsmntok_t* tok)
+static int _progress_handler(struct uclient* cli, const char* msg, jsmntok_t* tok)
 {
-	int _i = 0, _prog = 0;
+	int _i = 0;
 	struct usenet_str_arr _str_arr = {0};
-	char* _prog_disp = NULL;
 
 	/* get the array into struct */
-	if(usjson_get_token_arr_as_str(msg->msg_body, tok, &_str_arr) == USENET_ERROR) {
+	if(usjson_get_token_arr_as_str(msg, tok, &_str_arr) == USENET_ERROR) {
 		return USENET_ERROR;
 	}
 
@@ -894,35 +1299,53 @@ static int _progress_handler(struct uclient* cli, struct usenet_message* msg, js
 			continue;
 
 		/* write the progress */
-		_prog = USENET_CLIENT_PROGRESS_MAX * atof(_str_arr._arr[_i]);
-
-		/* allocate memory */
-		_prog_disp = (char*) malloc(sizeof(char) * (USENET_CLIENT_PROGRESS_MAX + 2));
-		memset(_prog_disp, USENET_ASSIGN_CHAR, _prog);
-		sprintf(_prog_disp+_prog, ">");
-		USENET_LOG_MESSAGE(_prog_disp);
+		_log_progress(atof(_str_arr._arr[_i]));
 
-		free(_prog_disp);
 		free(_str_arr._arr[_i]);
 		_str_arr._arr[_i] = NULL;
 	}
 
+	if(_str_arr._arr != NULL)
+		free(_str_arr._arr);
+	_str_arr._arr = NULL;
+
 	return USENET_SUCCESS;
 }
 
+/* write the progress bar to the log */
+static void _log_progress(float progress)
+{
+	int _prog = 0;
+	char _prog_disp[USENET_CLIENT_PROGRESS_MAX + 2] = {0};
+
+	_prog = USENET_CLIENT_PROGRESS_MAX * progress;
+
+	/* clamp to the display width */
+	if(_prog > USENET_CLIENT_PROGRESS_MAX)
+		_prog = USENET_CLIENT_PROGRESS_MAX;
+	if(_prog < 0)
+		_prog = 0;
+
+	memset(_prog_disp, USENET_ASSIGN_CHAR, _prog);
+	sprintf(_prog_disp+_prog, ">");
+	USENET_LOG_MESSAGE(_prog_disp);
+
+	return;
+}
+
 static int _echo_scp_done(struct uclient* cli)
 {
 	struct usenet_message _msg;
-	void* _data = NULL;
-	size_t _size = 0;
 
 	/* format the message */
 	USENET_LOG_MESSAGE("copy complete to the remote server");
+	if(cli->_bin_flg)
+		return _send_bin_broadcast(cli, USENET_RPC_OP_DONE, 0, 0.0);
+
 	usenet_message_init(&_msg);
 	_msg.ins = USENET_REQUEST_BROADCAST;
 
-	_msg.msg_body = (char*) malloc(sizeof(char) * USENET_JSON_BUFF_SZ);
-	memset(_msg.msg_body, 0, sizeof(char) * USENET_JSON_BUFF_SZ);
+	USENET_CREATE_POOLED_MESSAGE(&_msg, USENET_JSON_BUFF_SZ);
 
 	sprintf(_msg.msg_body,
 			"{\"%s\": \"%s\", \"%s\": []}",
@@ -930,15 +1353,36 @@ static int _echo_scp_done(struct uclient* cli)
 			USENET_JSON_FN_5,
 			USENET_JSON_ARG_HEADER);
 
-	/* serialise the message */
-	usenet_serialise_message(&_msg, &_data, &_size);
-	thcon_send_info(&cli->_connection, _data, _size);
+	usenet_send_message(USENET_CLIENT_SOCK(cli), &_msg);
 
-	free(_data);
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
+	USENET_DESTROY_POOLED_MESSAGE(&_msg);
 	return USENET_SUCCESS;
 }
 
+/*
+ * Send a broadcast in the binary payload. The body lives on the
+ * stack, nothing is allocated.
+ */
+static int _send_bin_broadcast(struct uclient* cli, unsigned char opcode, int nzb_id, float progress)
+{
+	struct usenet_message _msg;
+	struct usenet_bin_payload _payload = {0};
+	char _body[USENET_BIN_PAYLOAD_SZ] = {0};
+
+	_payload._opcode = opcode;
+	_payload._nzb_id = nzb_id;
+	_payload._pid = getpid();
+	_payload._progress = (unsigned int) (progress * USENET_BIN_PROGRESS_SCALE);
+	usenet_bin_encode(&_payload, _body, USENET_BIN_PAYLOAD_SZ);
+
+	usenet_message_init(&_msg);
+	_msg.ins = USENET_REQUEST_BROADCAST_BIN;
+	_msg.msg_body = _body;
+	_msg.size = USENET_MSG_HEADER_SZ + USENET_BIN_PAYLOAD_SZ;
+
+	return usenet_send_message(USENET_CLIENT_SOCK(cli), &_msg);
+}
+
 static int _create_log_file(struct uclient* cli)
 {
 	int _ret = USENET_ERROR;
@@ -997,3 +1441,18 @@ static int _set_scp_progress_flg(struct uclient* cli)
 
 	return USENET_SUCCESS;
 }
+
+/*
+ * Select the binary payload for broadcasts if enabled in the config.
+ * Function requests from the server remain json.
+ */
+static int _set_bin_broadcast_flg(struct uclient* cli)
+{
+	if(cli->_login.binary_broadcast &&
+	   strcmp(cli->_login.binary_broadcast, USENET_CONFIG_YES) == 0)
+		cli->_bin_flg = 1;
+	else
+		cli->_bin_flg = 0;
+
+	return USENET_SUCCESS;
+}
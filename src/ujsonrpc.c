@@ -0,0 +1,388 @@
+/*
+ * JSON-RPC transport for nzbget. The response is tokenised in place with
+ * jsmn and the lists are read from the tokens, the strings are copied
+ * once into the file list without building a tree of the response.
+ * Like the xmlrpc calls a single curl handle is kept for the process.
+ */
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <curl/curl.h>
+#include <pthread.h>
+
+#include "usenet.h"
+#include "jsmn.h"
+
+#define USENET_JSONRPC_SERVER_URL "http://127.0.0.1:6789/jsonrpc"
+#define USENET_JSONRPC_USERNAME_PASS "nzbget:tegbzn6789"
+#define USENET_JSONRPC_USERAGENT "libcurl-agent/1.0"
+#define USENET_JSONRPC_HEADER "Content-Type: application/json"
+#define USENET_JSONRPC_CURL_TIMEOUT 5L
+#define USENET_JSONRPC_REQUEST_FMT "{\"method\":\"%s\",\"params\":%s,\"id\":1}"
+
+/* buffer to hold the data returned from the server */
+struct ujsonrpc_buffer
+{
+	char* _buffer;
+	size_t _size;
+};
+
+static pthread_once_t _ujsonrpc_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _ujsonrpc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CURL* _ujsonrpc_curl = NULL;									/* kept open between calls */
+
+static void _ujsonrpc_global_init(void);
+static int _ujsonrpc_open(void);
+static size_t _ujsonrpc_write_callback(void* contents, size_t size, size_t nmemb, void* userp);
+
+/* number of tokens of the value starting at tok, itself included */
+static int _ujsonrpc_skip(const jsmntok_t* tok);
+static int _ujsonrpc_key(const char* js, const jsmntok_t* tok, const char* key);
+static char* _ujsonrpc_copy(const char* js, const jsmntok_t* tok);
+static int _ujsonrpc_set_field(const char* js, const jsmntok_t* key, const jsmntok_t* value, struct usenet_nzb_filellist* f_list);
+
+/*
+ * Post the method with the json array of parameters and tokenise the
+ * response. The result member is set in the response, a call returning
+ * an error fails.
+ */
+int usenet_ujsonrpc_call(const char* method, const char* params, struct usenet_jsonrpc_res* res)
+{
+	int _i = 0, _count = 0, _ret = USENET_ERROR;
+	CURLcode _stat = CURLE_OK;
+	char* _req = NULL;
+	size_t _req_sz = 0;
+	jsmn_parser _parser;
+	struct curl_slist* _hlist = NULL;
+	struct ujsonrpc_buffer _cbuf = {NULL, 0};
+	const jsmntok_t* _tok = NULL;
+
+	if(method == NULL || res == NULL)
+		return USENET_ARG_ERROR;
+
+	memset(res, 0, sizeof(struct usenet_jsonrpc_res));
+	if(params == NULL)
+		params = "[]";
+
+	_req_sz = strlen(USENET_JSONRPC_REQUEST_FMT) + strlen(method) + strlen(params) + 1;
+	_req = (char*) malloc(_req_sz);
+	if(_req == NULL)
+		return USENET_ERROR;
+	snprintf(_req, _req_sz, USENET_JSONRPC_REQUEST_FMT, method, params);
+
+	_hlist = curl_slist_append(_hlist, USENET_JSONRPC_HEADER);
+
+	/* the handle is shared by the threads calling nzbget */
+	pthread_mutex_lock(&_ujsonrpc_mutex);
+	if(_ujsonrpc_open() != USENET_SUCCESS) {
+		pthread_mutex_unlock(&_ujsonrpc_mutex);
+		goto clean_up;
+	}
+
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_HTTPHEADER, _hlist);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_POSTFIELDS, _req);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_WRITEDATA, &_cbuf);
+
+	USENET_LOG_MESSAGE_ARGS("performing json rpc call on method: %s", method);
+	_stat = curl_easy_perform(_ujsonrpc_curl);
+
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_HTTPHEADER, NULL);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_POSTFIELDS, NULL);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_WRITEDATA, NULL);
+	pthread_mutex_unlock(&_ujsonrpc_mutex);
+
+	if(_stat != CURLE_OK || _cbuf._buffer == NULL) {
+		USENET_LOG_MESSAGE_ARGS("json rpc call was not successful, %s", curl_easy_strerror(_stat));
+		goto clean_up;
+	}
+
+	/* count the tokens first, the response is then tokenised in one go */
+	jsmn_init(&_parser);
+	_count = jsmn_parse(&_parser, _cbuf._buffer, _cbuf._size, NULL, 0);
+	if(_count <= 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to parse the response of %s", method);
+		goto clean_up;
+	}
+
+	res->_tok = (jsmntok_t*) calloc((size_t) _count, sizeof(jsmntok_t));
+	if(res->_tok == NULL)
+		goto clean_up;
+
+	jsmn_init(&_parser);
+	res->_num = jsmn_parse(&_parser, _cbuf._buffer, _cbuf._size, res->_tok, (unsigned int) _count);
+	if(res->_num <= 0 || res->_tok[0].type != JSMN_OBJECT) {
+		USENET_LOG_MESSAGE_ARGS("unable to parse the response of %s", method);
+		goto clean_up;
+	}
+
+	res->_buffer = _cbuf._buffer;
+	res->_size = _cbuf._size;
+	_cbuf._buffer = NULL;
+
+	/* find the result, a failed call has an error object instead */
+	for(_i = 0, _tok = &res->_tok[1]; _i < res->_tok[0].size; _i++) {
+		if(_ujsonrpc_key(res->_buffer, _tok, "error") && _tok[1].type == JSMN_OBJECT) {
+			USENET_LOG_MESSAGE_ARGS("json rpc call %s returned an error", method);
+			goto clean_up;
+		}
+		if(_ujsonrpc_key(res->_buffer, _tok, "result"))
+			res->_result = (jsmntok_t*) &_tok[1];
+
+		_tok += _ujsonrpc_skip(_tok);
+	}
+
+	if(res->_result == NULL) {
+		USENET_LOG_MESSAGE_ARGS("json rpc call %s has no result", method);
+		goto clean_up;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("json rpc call %s, was successful", method);
+	_ret = USENET_SUCCESS;
+
+clean_up:
+	if(_ret != USENET_SUCCESS)
+		usenet_ujsonrpc_free(res);
+	if(_cbuf._buffer)
+		free(_cbuf._buffer);
+	if(_hlist)
+		curl_slist_free_all(_hlist);
+	free(_req);
+
+	return _ret;
+}
+
+/* load the list from the array of objects in the result */
+int usenet_ujsonrpc_get_list(struct usenet_jsonrpc_res* res, struct usenet_nzb_filellist** f_list, size_t* num)
+{
+	int _i = 0, _j = 0;
+	const jsmntok_t* _obj = NULL, *_tok = NULL;
+
+	if(res == NULL || res->_result == NULL || f_list == NULL || num == NULL)
+		return USENET_ARG_ERROR;
+
+	*num = 0;
+	if(res->_result->type != JSMN_ARRAY) {
+		USENET_LOG_MESSAGE("json rpc result is not an array");
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("rpc response array returned %i", res->_result->size);
+	if(res->_result->size <= 0)
+		return USENET_SUCCESS;
+
+	*f_list = (struct usenet_nzb_filellist*) calloc(sizeof(struct usenet_nzb_filellist), (size_t) res->_result->size);
+	if(*f_list == NULL)
+		return USENET_ERROR;
+
+	for(_i = 0, _obj = res->_result + 1; _i < res->_result->size; _i++, _obj += _ujsonrpc_skip(_obj)) {
+		USENET_NZBGET_INIT_LIST(&(*f_list)[_i]);
+		if(_obj->type != JSMN_OBJECT)
+			continue;
+
+		/* keys are followed by their values */
+		for(_j = 0, _tok = _obj + 1; _j < _obj->size; _j++, _tok += _ujsonrpc_skip(_tok))
+			_ujsonrpc_set_field(res->_buffer, _tok, _tok + 1, &(*f_list)[_i]);
+	}
+
+	*num = (size_t) res->_result->size;
+	return USENET_SUCCESS;
+}
+
+/* boolean result of the call */
+int usenet_ujsonrpc_result_true(struct usenet_jsonrpc_res* res)
+{
+	if(res == NULL || res->_result == NULL)
+		return USENET_ARG_ERROR;
+
+	return (res->_result->type == JSMN_PRIMITIVE && res->_buffer[res->_result->start] == 't') ? USENET_SUCCESS : USENET_ERROR;
+}
+
+void usenet_ujsonrpc_free(struct usenet_jsonrpc_res* res)
+{
+	if(res == NULL)
+		return;
+
+	if(res->_buffer)
+		free(res->_buffer);
+	if(res->_tok)
+		free(res->_tok);
+
+	memset(res, 0, sizeof(struct usenet_jsonrpc_res));
+}
+
+/* Open the connection handle up front, safe to call more than once */
+int usenet_ujsonrpc_init(void)
+{
+	int _ret = USENET_SUCCESS;
+
+	pthread_mutex_lock(&_ujsonrpc_mutex);
+	_ret = _ujsonrpc_open();
+	pthread_mutex_unlock(&_ujsonrpc_mutex);
+
+	return _ret;
+}
+
+/* close the connection and release the handle */
+int usenet_ujsonrpc_cleanup(void)
+{
+	pthread_mutex_lock(&_ujsonrpc_mutex);
+	if(_ujsonrpc_curl) {
+		USENET_LOG_MESSAGE("cleaning up json rpc curl");
+		curl_easy_cleanup(_ujsonrpc_curl);
+	}
+	_ujsonrpc_curl = NULL;
+	pthread_mutex_unlock(&_ujsonrpc_mutex);
+
+	return USENET_SUCCESS;
+}
+
+static void _ujsonrpc_global_init(void)
+{
+	curl_global_init(CURL_GLOBAL_ALL);
+}
+
+/* create the shared handle if it's not open, called with the mutex held */
+static int _ujsonrpc_open(void)
+{
+	pthread_once(&_ujsonrpc_once, _ujsonrpc_global_init);
+
+	if(_ujsonrpc_curl)
+		return USENET_SUCCESS;
+
+	USENET_LOG_MESSAGE("initialising curl for the json rpc calls");
+	_ujsonrpc_curl = curl_easy_init();
+	if(_ujsonrpc_curl == NULL) {
+		USENET_LOG_MESSAGE("failed to initialise curl for json rpc call");
+		return USENET_ERROR;
+	}
+
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_USERPWD, USENET_JSONRPC_USERNAME_PASS);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_POST, 1L);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_URL, USENET_JSONRPC_SERVER_URL);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_USERAGENT, USENET_JSONRPC_USERAGENT);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_WRITEFUNCTION, _ujsonrpc_write_callback);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_TIMEOUT, USENET_JSONRPC_CURL_TIMEOUT);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_NOSIGNAL, 1L);
+	curl_easy_setopt(_ujsonrpc_curl, CURLOPT_TCP_KEEPALIVE, 1L);
+
+	return USENET_SUCCESS;
+}
+
+static size_t _ujsonrpc_write_callback(void* contents, size_t size, size_t nmemb, void* userp)
+{
+	size_t _act_size = size * nmemb;
+	char* _buffer = NULL;
+	struct ujsonrpc_buffer* _content = (struct ujsonrpc_buffer*) userp;
+
+	_buffer = (char*) realloc(_content->_buffer, _content->_size + _act_size + 1);
+	if(_buffer == NULL) {
+		USENET_LOG_MESSAGE("Unable to allocate content memory..");
+		return 0;
+	}
+
+	_content->_buffer = _buffer;
+	memcpy(&_content->_buffer[_content->_size], contents, _act_size);
+	_content->_size += _act_size;
+	_content->_buffer[_content->_size] = '\0';
+
+	return _act_size;
+}
+
+static int _ujsonrpc_skip(const jsmntok_t* tok)
+{
+	int _i = 0, _n = 1;
+
+	for(_i = 0; _i < tok->size; _i++)
+		_n += _ujsonrpc_skip(tok + _n);
+
+	return _n;
+}
+
+static int _ujsonrpc_key(const char* js, const jsmntok_t* tok, const char* key)
+{
+	return tok->type == JSMN_STRING &&
+		(size_t) (tok->end - tok->start) == strlen(key) &&
+		strncmp(js + tok->start, key, (size_t) (tok->end - tok->start)) == 0;
+}
+
+/* copy of the string value with the json escapes resolved */
+static char* _ujsonrpc_copy(const char* js, const jsmntok_t* tok)
+{
+	int _i = 0;
+	unsigned int _cp = 0;
+	char* _str = NULL, *_ptr = NULL;
+
+	_str = (char*) malloc((size_t) (tok->end - tok->start) + 1);
+	if(_str == NULL)
+		return NULL;
+
+	for(_i = tok->start, _ptr = _str; _i < tok->end; _i++) {
+		if(js[_i] != '\\' || _i + 1 >= tok->end) {
+			*_ptr++ = js[_i];
+			continue;
+		}
+
+		switch(js[++_i]) {
+		case 'n': *_ptr++ = '\n'; break;
+		case 't': *_ptr++ = '\t'; break;
+		case 'r': *_ptr++ = '\r'; break;
+		case 'b': *_ptr++ = '\b'; break;
+		case 'f': *_ptr++ = '\f'; break;
+		case 'u':
+			/* code points of the basic plane as utf-8, never longer than the escape */
+			if(_i + 4 >= tok->end || sscanf(js + _i + 1, "%4x", &_cp) != 1) {
+				*_ptr++ = '?';
+				break;
+			}
+			_i += 4;
+			if(_cp < 0x80)
+				*_ptr++ = (char) _cp;
+			else if(_cp < 0x800) {
+				*_ptr++ = (char) (0xc0 | (_cp >> 6));
+				*_ptr++ = (char) (0x80 | (_cp & 0x3f));
+			}
+			else {
+				*_ptr++ = (char) (0xe0 | (_cp >> 12));
+				*_ptr++ = (char) (0x80 | ((_cp >> 6) & 0x3f));
+				*_ptr++ = (char) (0x80 | (_cp & 0x3f));
+			}
+			break;
+		default:
+			*_ptr++ = js[_i];
+			break;
+		}
+	}
+	*_ptr = '\0';
+
+	return _str;
+}
+
+/* the fields read from the history and group entries */
+static int _ujsonrpc_set_field(const char* js, const jsmntok_t* key, const jsmntok_t* value, struct usenet_nzb_filellist* f_list)
+{
+	if(key->type != JSMN_STRING)
+		return USENET_ERROR;
+
+	if(_ujsonrpc_key(js, key, "NZBID"))
+		f_list->_nzb_id = atoi(js + value->start);
+	else if(_ujsonrpc_key(js, key, "NZBFilename"))
+		f_list->_nzb_file_name = _ujsonrpc_copy(js, value);
+	else if(_ujsonrpc_key(js, key, "NZBName"))
+		f_list->_nzb_name = _ujsonrpc_copy(js, value);
+	else if(_ujsonrpc_key(js, key, "DestDir"))
+		f_list->_dest_dir = _ujsonrpc_copy(js, value);
+	else if(_ujsonrpc_key(js, key, "FinalDir"))
+		f_list->_final_dir = _ujsonrpc_copy(js, value);
+	else if(_ujsonrpc_key(js, key, "FileSizeMB"))
+		f_list->_file_size = atoi(js + value->start);
+	else if(_ujsonrpc_key(js, key, "RemainingSizeMB"))
+		f_list->_remaining_size = atoi(js + value->start);
+	else if(_ujsonrpc_key(js, key, "ActiveDownloads"))
+		f_list->_active_downloads = atoi(js + value->start);
+	else if(_ujsonrpc_key(js, key, "Status"))
+		f_list->_status = _ujsonrpc_copy(js, value);
+
+	return USENET_SUCCESS;
+}
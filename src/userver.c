@@ -2,53 +2,155 @@
  * Server for controlling the other machine for downloading nzbs.
  * This sends magic packet to wake the machine with mac address
  * and waits for the client to send the confirmation signal.
- * Subsequently,
+ * Subsequently, every connected client is driven through its own
+ * handshake and the requests are distributed across all of them.
  */
 
 #include <stdlib.h>
 #include <unistd.h>
 #include <signal.h>
 #include <time.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/socket.h>
+#include <dirent.h>
+#include <sys/stat.h>
 #include "usenet.h"
 #include "thcon.h"
 
 #define USENET_SERVER_MSG_SZ 256
 #define USENET_SERVER_JSON_SZ 151
+#define USENET_SERVER_MAX_SESSIONS 16
+#define USENET_SERVER_MAX_PENDING 64
+#define USENET_SERVER_PULSE_TIMEOUT 30
+#define USENET_SERVER_TICK_MS 1000
+#define USENET_SERVER_EVENT_BUFF_SZ 4096
 
 #define USENET_SERVER_JSON_FN_HEADER USENET_JSON_FN_HEADER
 #define USENET_SERVER_JSON_ARG_HEADER USENET_JSON_ARG_HEADER
 #define USENET_SERVER_JSON_FN_NAME "usenet_nzb_search_and_get"
-#define USENET_SERVER_JSON_PATH "../resource/req.json"
+#define USENET_SERVER_JSON_DIR "../resource"
+#define USENET_SERVER_JSON_FILE "req.json"
+#define USENET_SERVER_JSON_PATH USENET_SERVER_JSON_DIR "/" USENET_SERVER_JSON_FILE
+#define USENET_SERVER_SPOOL_EXT ".json"
+#define USENET_SERVER_SPOOL_DONE "done"
+#define USENET_SERVER_PATH_SZ 512
+
+struct userver;
+struct userver_session;
+
+/*
+ * External object of a connection. The listening connection carries the
+ * server alone, a connection of a client carries its session as well so
+ * the received bytes go to the decoder of that session.
+ */
+struct userver_conn
+{
+	struct userver* _svr;
+	struct userver_session* _ses;
+};
+
+/* a single title to be searched and downloaded */
+struct userver_request
+{
+	char* _title;											/* search title */
+	char* _file;											/* spool file of the request, NULL for the request json */
+	int _sock;												/* client the request was sent to, 0 if not sent */
+	int _acked;												/* flag to indicate the client accepted the request */
+};
+
+/* a message queued under the mutex, sent once it is released */
+struct userver_out
+{
+	int _ix;												/* slot of the session */
+	int _sock;												/* socket of the session when queued */
+	struct usenet_message _msg;								/* the body is a copy owned by the queue */
+};
+
+/* messages waiting to be sent */
+struct userver_outbox
+{
+	size_t _num;
+	size_t _sz;
+	struct userver_out* _msgs;
+};
+
+/* state of a single client connection */
+struct userver_session
+{
+	int _sock;												/* connection socket, 0 if the slot is free */
+	unsigned int _act_ix;									/* index for action */
+	int _accept_flg;										/* flag to indicate handshake is required */
+	time_t _last_pulse;										/* time of the last pulse received */
+
+	size_t _num_pending;									/* number of requests waiting for acknowledgement */
+	struct userver_request* _pending[USENET_SERVER_MAX_PENDING];	/* requests assigned to this client */
+
+	struct userver* _svr;									/* server owning the session */
+	struct userver_conn _conn;								/* external object of the client connection */
+	struct usenet_msg_decoder _decoder;						/* frame decoder for the connection */
+	struct userver_outbox* _out;							/* replies of the decoded messages, set while feeding */
+};
 
 /* struct to encapsulate server component */
 struct userver
 {
-	int active_sock;										/* active socket */
 	const char* _server_name;
 	const char* _server_port;
 
 	struct gapi_login _login;
 	thcon _connection;
-
-	int _active_sock;										/* active connection socket */
-	unsigned int _act_ix;									/* index for action */
-	volatile sig_atomic_t _conn_flg;						/* flag to indicate connection was made */
-	volatile sig_atomic_t _accept_flg;						/* flag to indicate handshake was made */
+	struct userver_conn _conn;								/* external object of the listening connection */
+
+	int _watch_fd;											/* inotify descriptor watching the requests */
+	size_t _num_requests;									/* number of outstanding requests */
+	struct userver_request** _requests;						/* requests not yet acknowledged */
+	struct userver_session _sessions[USENET_SERVER_MAX_SESSIONS];
+	pthread_mutex_t _mutex;									/* guards the session table */
+	pthread_mutex_t _send_locks[USENET_SERVER_MAX_SESSIONS];	/* serialise the writes to the socket of a slot */
 };
 
 static int _data_receive_callback(void* self, void* data, size_t sz);
+static int _frame_callback(void* self, struct usenet_message* msg);
 static int _conn_made(void* self, void* conn);
 static int _conn_closed(void* self, void* conn, int socket);
 static int _initialise_contact(struct userver* svr);
+static int _check_pulses(struct userver* svr);
 static void _signal_hanlder(int signal);							/* signal handler */
-static int _msg_handler(struct userver* svr, struct usenet_message* msg);
-
-static inline __attribute__ ((always_inline)) int _send_function_req(struct userver* svr, struct usenet_message* msg);
-static inline __attribute__ ((always_inline)) int _send_reset_req(struct userver* svr, struct usenet_message* msg);
-static inline __attribute__ ((always_inline)) int _reset_ix_conn_flg(struct userver* svr);
+static int _watch_requests(struct userver* svr);
+static int _read_watch_events(struct userver* svr);
+static int _requests_changed(struct userver* svr);
+static int _msg_handler(struct userver_session* ses, struct usenet_message* msg);
+
+static inline __attribute__ ((always_inline)) int _send_function_req(struct userver_session* ses, struct usenet_message* msg, struct userver_outbox* out);
+static inline __attribute__ ((always_inline)) int _send_reset_req(struct userver_session* ses, struct usenet_message* msg, struct userver_outbox* out);
+static inline __attribute__ ((always_inline)) int _reset_ix_conn_flg(struct userver_session* ses);
+
+/* session table helpers */
+static struct userver_session* _find_session(struct userver* svr, int sock);
+static void _drop_session(struct userver_session* ses, const char* reason);
+static int _reset_all_sessions(struct userver* svr);
+
+/* sends are queued under the mutex and written once it is released */
+static int _queue_message(struct userver_outbox* out, struct userver_session* ses, const struct usenet_message* msg);
+static int _flush_outbox(struct userver* svr, struct userver_outbox* out);
+
+/* Methods for loading and distributing requests */
+static int _make_done_dir(struct userver* svr);
+static int _load_requests(struct userver* svr);
+static int _parse_request_file(struct userver* svr, const char* path, const char* file);
+static int _add_request(struct userver* svr, char* title, const char* file);
+static int _scan_spool(struct userver* svr);
+static int _spool_file_loaded(struct userver* svr, const char* file);
+static int _spool_file_pending(struct userver* svr, const char* file);
+static int _spool_file_done(struct userver* svr, const char* file);
+static int _ack_requests(struct userver_session* ses);
+static int _free_requests(struct userver* svr);
+static int _assign_requests(struct userver_session* ses);
 
 /* Methods for constructing jsons */
-static int _msg_get_nzb(const char* nzb, struct usenet_message* msg);
+static int _msg_get_nzb(struct userver_session* ses, struct usenet_message* msg);
 
 /* starts  the server */
 int init_server(struct userver* svr);
@@ -60,30 +162,43 @@ struct userver server;												/* server */
 volatile sig_atomic_t term_sig = 1;									/* signal */
 int main(int argc, char** argv)
 {
-	int sec_cnt = 0;												/* second counter */
-	struct usenet_message _msg = {0};
+	int _rc = 0;
+	struct pollfd _pfd = {0};
 
 	if(init_server(&server) == USENET_ERROR)
 		return USENET_ERROR;
 
 	signal(SIGINT, _signal_hanlder);
+
+	_pfd.fd = server._watch_fd;
+	_pfd.events = POLLIN;
+
 	while(term_sig) {
 
-		if(sec_cnt++ % server._login.scan_freq) {
-			_initialise_contact(&server);
+		/*
+		 * Sleep until the request file changes or the tick elapses,
+		 * the tick drives handshakes and pulse checks.
+		 */
+		_rc = poll(&_pfd, (server._watch_fd >= 0 ? 1 : 0), USENET_SERVER_TICK_MS);
+		if(_rc < 0 && errno != EINTR) {
+			USENET_LOG_MESSAGE_ARGS("errors occured while polling, %s", strerror(errno));
+			break;
 		}
 
-		/* send client a new function request if the file was updated */
-		if(usenet_utils_time_diff(USENET_SERVER_JSON_PATH) == server._login.scan_freq) {
+		/* send clients a new function request if the file was updated */
+		if(_requests_changed(&server)) {
 			thcon_wol_device(&server._connection, server._login.mac_addr);
-			USENET_LOG_MESSAGE("request json changed, sending request to client to reset index");
+			USENET_LOG_MESSAGE("requests changed, sending request to clients to reset index");
 
-			/* reset the index and action flg*/
-			usenet_message_init(&_msg);
-			_send_reset_req(&server, &_msg);
+			/* reload the requests and reset every session */
+			_load_requests(&server);
+			_reset_all_sessions(&server);
 		}
 
-		sleep(1);
+		if(_rc == 0) {
+			_initialise_contact(&server);
+			_check_pulses(&server);
+		}
 	}
 
 	/* stop the server */
@@ -99,7 +214,7 @@ int main(int argc, char** argv)
 /* initialise method */
 int init_server(struct userver* svr)
 {
-	int status = 0;
+	int status = 0, _i = 0;
 	svr->_server_name = NULL;
 	svr->_server_port = NULL;
 
@@ -115,8 +230,18 @@ int init_server(struct userver* svr)
 	USENET_LOG_MESSAGE("setting server port and name to local from config file");
 	svr->_server_name = svr->_login.server_name;
 	svr->_server_port = svr->_login.server_port;
-	svr->_active_sock = 0;
 
+	pthread_mutex_init(&svr->_mutex, NULL);
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++)
+		pthread_mutex_init(&svr->_send_locks[_i], NULL);
+
+	/* processed spool files are moved to the done directory */
+	if(svr->_login.spool_dir && _make_done_dir(svr) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	/* load the requests to be distributed and watch for changes */
+	_load_requests(svr);
+	_watch_requests(svr);
 
 	/* launch connection object as a server */
 	USENET_LOG_MESSAGE("initiating connection object..");
@@ -148,18 +273,14 @@ int init_server(struct userver* svr)
 	thcon_set_closed_callback(&svr->_connection, _conn_closed);
 	thcon_set_recv_callback(&svr->_connection, _data_receive_callback);
 
-	thcon_set_ext_obj(&svr->_connection, svr);
+	svr->_conn._svr = svr;
+	svr->_conn._ses = NULL;
+	thcon_set_ext_obj(&svr->_connection, &svr->_conn);
 
 	/* start the server */
 	USENET_LOG_MESSAGE("connection initialised, starting service");
 	status = thcon_start(&svr->_connection);
 
-	/* initialise the connection atomic variable */
-	svr->_conn_flg = 0;
-	svr->_active_sock = 0;
-	svr->_accept_flg = 0;
-	svr->_act_ix = 0;
-
 	if(status != 0) {
 		USENET_LOG_MESSAGE("server not started successfully");
 		return USENET_ERROR;
@@ -170,7 +291,25 @@ int init_server(struct userver* svr)
 
 int stop_server(struct userver* svr)
 {
+	int _i = 0;
+
 	thcon_stop(&svr->_connection);
+
+	/* release the sessions still open */
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(svr->_sessions[_i]._sock > 0)
+			usenet_decoder_destroy(&svr->_sessions[_i]._decoder);
+		svr->_sessions[_i]._sock = 0;
+	}
+
+	if(svr->_watch_fd >= 0)
+		close(svr->_watch_fd);
+	svr->_watch_fd = -1;
+
+	_free_requests(svr);
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++)
+		pthread_mutex_destroy(&svr->_send_locks[_i]);
+	pthread_mutex_destroy(&svr->_mutex);
 	return USENET_SUCCESS;
 }
 
@@ -178,9 +317,11 @@ int stop_server(struct userver* svr)
 /* main method for handling received data */
 static int _data_receive_callback(void* self, void* data, size_t sz)
 {
+	int _sock = 0, _rc = USENET_SUCCESS;
+	struct userver_conn* _conn = NULL;
 	struct userver* _server = NULL;
-	struct usenet_message _msg;
-
+	struct userver_session* _ses = NULL;
+	struct userver_outbox _out = {0};
 
 	if(sz <= 0)
 		return USENET_ERROR;
@@ -188,34 +329,88 @@ static int _data_receive_callback(void* self, void* data, size_t sz)
 	if(self == NULL)
 		return USENET_ERROR;
 
-	_server = (struct userver*) self;
-	usenet_message_init(&_msg);
-	usenet_unserialise_message(data, sz, &_msg);
+	_conn = (struct userver_conn*) self;
+	_server = _conn->_svr;
+	if(_server == NULL)
+		return USENET_ERROR;
+
+	/*
+	 * The connection of a client carries its session, the active socket
+	 * of the shared connection object is only used if thcon reports the
+	 * data on the listening connection.
+	 */
+	pthread_mutex_lock(&_server->_mutex);
+	if(_conn->_ses != NULL)
+		_ses = _conn->_ses->_sock > 0 ? _conn->_ses : NULL;
+	else
+		_ses = _find_session(_server, THCON_GET_ACTIVE_SOCK(&_server->_connection));
 
-	USENET_LOG_MESSAGE_ARGS("message received from client, action ix: %i", _server->_act_ix);
-	_msg_handler(_server, &_msg);
+	/*
+	 * Decoder calls the frame callback for each complete message,
+	 * the replies are queued and sent once the mutex is released.
+	 */
+	if(_ses == NULL)
+		USENET_LOG_MESSAGE("data received on an unknown connection, ignoring");
+	else {
+		_ses->_out = &_out;
+		_rc = usenet_decoder_feed(&_ses->_decoder, data, sz);
+		_ses->_out = NULL;
+	}
 
-	/* destroy the message object */
-	USENET_DESTROY_MESSAGE_BUFFER(&_msg);
+	if(_ses != NULL && _rc != USENET_SUCCESS) {
 
+		/*
+		 * The frame boundary is lost, the session is dropped and the
+		 * connection shut down so the client reconnects and starts
+		 * with a new handshake.
+		 */
+		_sock = _ses->_sock;
+		_drop_session(_ses, "undecodable data");
+		shutdown(_sock, SHUT_RDWR);
+	}
+
+	pthread_mutex_unlock(&_server->_mutex);
+
+	_flush_outbox(_server, &_out);
 	return USENET_SUCCESS;
 }
 
+/* called by the decoder for every complete message */
+static int _frame_callback(void* self, struct usenet_message* msg)
+{
+	struct userver_session* _ses = (struct userver_session*) self;
+
+	USENET_LOG_MESSAGE_ARGS("message received from client %i, action ix: %i", _ses->_sock, _ses->_act_ix);
+	return _msg_handler(_ses, msg);
+}
+
 static int _conn_closed(void* self, void* conn, int socket)
 {
+	int _ix = -1;
 	struct userver* _server = NULL;
+	struct userver_session* _ses = NULL;
 
 	USENET_LOG_MESSAGE("connection closed");
 
 	if(self == NULL)
 		return USENET_ERROR;
 
-	_server = (struct userver*) self;
-	if(socket == _server->_active_sock) {
-		_server->_conn_flg = 0;
-		_server->_active_sock = 0;
-		_server->_accept_flg = 0;
-		_server->_act_ix = 0;
+	_server = ((struct userver_conn*) self)->_svr;
+	if(_server == NULL)
+		return USENET_ERROR;
+
+	pthread_mutex_lock(&_server->_mutex);
+	_ses = _find_session(_server, socket);
+	if(_ses != NULL) {
+		_ix = (int) (_ses - _server->_sessions);
+		_drop_session(_ses, "closed");
+	}
+	pthread_mutex_unlock(&_server->_mutex);
+
+	/* wait out a send in flight, the socket is closed once this returns */
+	if(_ix >= 0) {
+		pthread_mutex_lock(&_server->_send_locks[_ix]);
+		pthread_mutex_unlock(&_server->_send_locks[_ix]);
 	}
 
 	return USENET_SUCCESS;
@@ -223,60 +418,109 @@ static int _conn_closed(void* self, void* conn, int socket)
 
 static int _conn_made(void* self, void* conn)
 {
+	int _i = 0;
 	thcon* _conn = (thcon*) conn;
-	struct userver* _svr = (struct userver*) self;
-	USENET_LOG_MESSAGE("connection made, checking for existing connections");
+	struct userver* _svr = ((struct userver_conn*) self)->_svr;
+	struct userver_session* _ses = NULL;
 
-	/*
-	 * Check if a connection is made and the active socket was set.
-	 * If these were set we don't want to handle any other connections
-	 * therefore we exit method.
-	 */
-	if(_svr->_conn_flg > 0 && _svr->active_sock > 0)
+	USENET_LOG_MESSAGE("connection made, allocating session");
+
+	pthread_mutex_lock(&_svr->_mutex);
+
+	/* find a free slot in the session table */
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(_svr->_sessions[_i]._sock <= 0) {
+			_ses = &_svr->_sessions[_i];
+			break;
+		}
+	}
+
+	if(_ses == NULL) {
+		pthread_mutex_unlock(&_svr->_mutex);
+		USENET_LOG_MESSAGE("session table is full, refusing connection");
 		return USENET_ERROR;
+	}
+
+	memset(_ses, 0, sizeof(struct userver_session));
+	if(usenet_decoder_init(&_ses->_decoder, _frame_callback, _ses) != USENET_SUCCESS) {
+		pthread_mutex_unlock(&_svr->_mutex);
+		USENET_LOG_MESSAGE("unable to allocate the session decoder, refusing connection");
+		return USENET_ERROR;
+	}
 
-	USENET_LOG_MESSAGE("no other connections are made, therefore proceeding with instructions");
-	/* set the active socket to this connection */
-	_svr->_active_sock = THCON_GET_ACTIVE_SOCK(_conn);
+	_ses->_sock = THCON_GET_ACTIVE_SOCK(_conn);
+	_ses->_svr = _svr;
+	_ses->_conn._svr = _svr;
+	_ses->_conn._ses = _ses;
+
+	/* receives on a connection object of its own go straight to the session */
+	if(_conn != &_svr->_connection)
+		thcon_set_ext_obj(_conn, &_ses->_conn);
+	_ses->_act_ix = 0;
+	time(&_ses->_last_pulse);
 
 	/*
-	 * On first connection we set the flag to true. If this method is called
-	 * again it will not handle any processing on this connection.
+	 * Set the accept flag so the main loop sends the
+	 * handshake to this client.
 	 */
-	_svr->_conn_flg = 1;
-	_svr->_accept_flg = 1;
+	_ses->_accept_flg = 1;
+
+	USENET_LOG_MESSAGE_ARGS("session %i created for client %i", _i, _ses->_sock);
+	pthread_mutex_unlock(&_svr->_mutex);
 
 	return 0;
 }
 
-/* Send message to the client */
+/* Send handshake to every client waiting for one */
 static int _initialise_contact(struct userver* svr)
 {
-	void* _data = NULL;
-	size_t _size = 0;
+	int _i = 0;
 	struct usenet_message _msg;
+	struct userver_outbox _out = {0};
 
-	if(svr->_conn_flg == 0)
-		return USENET_SUCCESS;
-
-	if(svr->_active_sock <= 0)
-		return USENET_SUCCESS;
-
-	if(svr->_accept_flg <= 0)
-		return USENET_SUCCESS;
+	pthread_mutex_lock(&svr->_mutex);
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(svr->_sessions[_i]._sock <= 0 || svr->_sessions[_i]._accept_flg <= 0)
+			continue;
 
-	/* send message to client */
-	usenet_message_init(&_msg);
-	usenet_message_request_instruct(&_msg);
+		/* send message to client */
+		usenet_message_init(&_msg);
+		usenet_message_request_instruct(&_msg);
 
-	/* serialise the message */
-	USENET_LOG_MESSAGE("serialising message");
-	usenet_serialise_message(&_msg, &_data, &_size);
+		USENET_LOG_MESSAGE_ARGS("sending handshake to client %i waiting for response", svr->_sessions[_i]._sock);
+		_queue_message(&_out, &svr->_sessions[_i], &_msg);
+	}
+	pthread_mutex_unlock(&svr->_mutex);
 
-	USENET_LOG_MESSAGE("sending handshake to client waiting for response");
-	thcon_send_info(&svr->_connection, _data, _size);
+	return _flush_outbox(svr, &_out);
+}
 
-	free(_data);
+/*
+ * Drop the clients which stopped sending pulses. Their requests go back
+ * to the queue and the connection is shut down, the closed callback
+ * finds no session left.
+ */
+static int _check_pulses(struct userver* svr)
+{
+	int _i = 0, _sock = 0;
+	time_t _now;
+
+	time(&_now);
+	pthread_mutex_lock(&svr->_mutex);
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(svr->_sessions[_i]._sock <= 0)
+			continue;
+
+		if(difftime(_now, svr->_sessions[_i]._last_pulse) > USENET_SERVER_PULSE_TIMEOUT) {
+			USENET_LOG_MESSAGE_ARGS("no pulse from client %i for %i seconds, dropping the session",
+									svr->_sessions[_i]._sock,
+									USENET_SERVER_PULSE_TIMEOUT);
+			_sock = svr->_sessions[_i]._sock;
+			_drop_session(&svr->_sessions[_i], "stopped sending pulses");
+			shutdown(_sock, SHUT_RDWR);
+		}
+	}
+	pthread_mutex_unlock(&svr->_mutex);
 
 	return USENET_SUCCESS;
 }
@@ -287,30 +531,104 @@ static void _signal_hanlder(int signal)
 	term_sig = 0;
 }
 
-static int _msg_handler(struct userver* svr, struct usenet_message* msg)
+/*
+ * Watch the directory of the request file. Editors and copy tools
+ * replace the file, therefore the directory is watched for writes
+ * and renames rather than the file itself.
+ */
+static int _watch_requests(struct userver* svr)
+{
+	const char* _dir = (svr->_login.spool_dir ? svr->_login.spool_dir : USENET_SERVER_JSON_DIR);
+
+	svr->_watch_fd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(svr->_watch_fd < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to initialise inotify, %s", strerror(errno));
+		return USENET_ERROR;
+	}
+
+	if(inotify_add_watch(svr->_watch_fd, _dir, IN_CLOSE_WRITE | IN_MOVED_TO) < 0) {
+		USENET_LOG_MESSAGE_ARGS("unable to watch %s, %s", _dir, strerror(errno));
+		close(svr->_watch_fd);
+		svr->_watch_fd = -1;
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("watching %s for request changes", _dir);
+	return USENET_SUCCESS;
+}
+
+/*
+ * Drain the pending events, returns 1 if the request file was written
+ * or a request file was added to the spool directory.
+ */
+static int _read_watch_events(struct userver* svr)
 {
-	void* _data;
-	size_t _size;
+	int _changed = 0;
+	size_t _nlen = 0;
+	ssize_t _len = 0;
+	char* _ptr = NULL;
+	const struct inotify_event* _event = NULL;
+	char _buf[USENET_SERVER_EVENT_BUFF_SZ] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+
+	while((_len = read(svr->_watch_fd, _buf, sizeof(_buf))) > 0) {
+		for(_ptr = _buf; _ptr < _buf + _len; _ptr += sizeof(struct inotify_event) + _event->len) {
+			_event = (const struct inotify_event*) _ptr;
+			if(_event->len == 0)
+				continue;
+
+			/* any json file in the spool directory is a new request */
+			_nlen = strlen(_event->name);
+			if(svr->_login.spool_dir)
+				_changed |= (_nlen > strlen(USENET_SERVER_SPOOL_EXT) &&
+							 strcmp(_event->name + _nlen - strlen(USENET_SERVER_SPOOL_EXT), USENET_SERVER_SPOOL_EXT) == 0);
+			else if(strcmp(_event->name, USENET_SERVER_JSON_FILE) == 0)
+				_changed = 1;
+		}
+	}
 
+	return _changed;
+}
+
+/*
+ * Check if the requests changed. Falls back to the modification
+ * time if inotify is not available.
+ */
+static int _requests_changed(struct userver* svr)
+{
+	if(svr->_watch_fd >= 0)
+		return _read_watch_events(svr);
+
+	/* without inotify the spool directory is scanned every tick */
+	if(svr->_login.spool_dir)
+		return _scan_spool(svr) > 0;
+
+	return usenet_utils_time_diff(USENET_SERVER_JSON_PATH) == svr->_login.scan_freq;
+}
+
+static int _msg_handler(struct userver_session* ses, struct usenet_message* msg)
+{
 	/* check if handshake is required */
-	switch(svr->_act_ix) {
+	switch(ses->_act_ix) {
 	case 0:
-		if(svr->_accept_flg <= 0 || msg->ins != USENET_REQUEST_RESPONSE)
+		if(ses->_accept_flg <= 0 || msg->ins != USENET_REQUEST_RESPONSE)
 			break;
-		USENET_LOG_MESSAGE_ARGS("response accepted from client with ins: %x", msg->ins);
-		svr->_accept_flg = 0;
+		USENET_LOG_MESSAGE_ARGS("response accepted from client %i with ins: %x", ses->_sock, msg->ins);
+		ses->_accept_flg = 0;
 
 		/* send a json request */
-		_send_function_req(svr, msg);
+		_send_function_req(ses, msg, ses->_out);
 
 		/* increment action index to the next message */
-		svr->_act_ix++;
+		ses->_act_ix++;
 		break;
 	case 1:
 		if(msg->ins != USENET_REQUEST_RESPONSE)
 			break;
-		USENET_LOG_MESSAGE_ARGS("response accepted from client with ins: %x", msg->ins);
-		svr->_act_ix++;
+		USENET_LOG_MESSAGE_ARGS("client %i acknowledged %lu requests", ses->_sock, ses->_num_pending);
+
+		/* the client has taken the requests */
+		_ack_requests(ses);
+		ses->_act_ix++;
 		break;
 	case 2:
 		if(msg->ins != USENET_REQUEST_RESPONSE)
@@ -326,112 +644,543 @@ static int _msg_handler(struct userver* svr, struct usenet_message* msg)
 		 * the message handler then go through another iteration
 		 * of the action list.
 		 */
-		_reset_ix_conn_flg(svr);
+		_reset_ix_conn_flg(ses);
 
 	default:
 		break;
 	}
 
-	if(msg->ins == USENET_REQUEST_PULSE)
+	if(msg->ins == USENET_REQUEST_PULSE) {
 		USENET_LOG_MESSAGE("responding to client's pulse");
+		time(&ses->_last_pulse);
+	}
 
 	if(msg->ins == USENET_REQUEST_BROADCAST)
 		USENET_LOG_MESSAGE("responding to client's broadcast request");
 
 	/* echo back the message if its pulse or broadcast */
-	if(msg->ins == USENET_REQUEST_PULSE || msg->ins == USENET_REQUEST_BROADCAST) {
-		usenet_serialise_message(msg, &_data, &_size);
-		thcon_send_info(&svr->_connection, _data, _size);
-		USENET_LOG_MESSAGE("sent client response");
-
-		if(_data != NULL && _size > 0)
-			free(_data);
+	if(msg->ins == USENET_REQUEST_PULSE ||
+	   msg->ins == USENET_REQUEST_BROADCAST ||
+	   msg->ins == USENET_REQUEST_BROADCAST_BIN) {
+		_queue_message(ses->_out, ses, msg);
+		USENET_LOG_MESSAGE("queued client response");
 	}
 
 	return 0;
 }
 
-/* construct message */
-static int _msg_get_nzb(const char* nzb, struct usenet_message* msg)
+/* find the session of the socket, caller holds the mutex */
+static struct userver_session* _find_session(struct userver* svr, int sock)
 {
-	char* _buff = NULL;
-	size_t _sz = 0;
+	int _i = 0;
 
-	USENET_LOG_MESSAGE("constructing json rpc message");
+	if(sock <= 0)
+		return NULL;
 
-	/* if nzb is not NULL */
-	if(nzb != NULL) {
-		msg->msg_body = (char*) malloc(sizeof(char) * USENET_JSON_BUFF_SZ);
-		memset(msg->msg_body, 0, sizeof(char)*USENET_JSON_BUFF_SZ);
-		msg->size += USENET_JSON_BUFF_SZ;
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(svr->_sessions[_i]._sock == sock)
+			return &svr->_sessions[_i];
+	}
 
-		return snprintf(msg->msg_body, USENET_JSON_BUFF_SZ,
-						"{%s:%s,%s:[%s]}",
-						USENET_SERVER_JSON_FN_HEADER,
-						USENET_SERVER_JSON_FN_NAME,
-						USENET_SERVER_JSON_ARG_HEADER,
-						nzb);
+	return NULL;
+}
+
+/* free the slot of a session, caller holds the mutex */
+static void _drop_session(struct userver_session* ses, const char* reason)
+{
+	if(ses->_num_pending > 0)
+		USENET_LOG_MESSAGE_ARGS("client %i %s with %lu unacknowledged requests, "
+								"they will be redistributed on the next reset",
+								ses->_sock, reason, ses->_num_pending);
+
+	/* return the unacknowledged requests to the queue */
+	while(ses->_num_pending > 0)
+		ses->_pending[--ses->_num_pending]->_sock = 0;
+
+	usenet_decoder_destroy(&ses->_decoder);
+	memset(ses, 0, sizeof(struct userver_session));
+}
+
+/* queue a copy of the message for the session, caller holds the mutex */
+static int _queue_message(struct userver_outbox* out, struct userver_session* ses, const struct usenet_message* msg)
+{
+	size_t _body_sz = 0;
+	struct userver_out* _tmp = NULL;
+	struct userver_out* _item = NULL;
+
+	if(out == NULL || ses->_sock <= 0)
+		return USENET_ARG_ERROR;
+
+	if(out->_num == out->_sz) {
+		_tmp = (struct userver_out*) realloc(out->_msgs, (out->_sz > 0 ? out->_sz * 2 : USENET_SERVER_MAX_SESSIONS) * sizeof(struct userver_out));
+		if(_tmp == NULL) {
+			USENET_LOG_MESSAGE_ARGS("unable to queue a message for client %i", ses->_sock);
+			return USENET_ERROR;
+		}
+
+		out->_msgs = _tmp;
+		out->_sz = (out->_sz > 0 ? out->_sz * 2 : USENET_SERVER_MAX_SESSIONS);
 	}
 
+	_item = &out->_msgs[out->_num];
+	_item->_ix = (int) (ses - ses->_svr->_sessions);
+	_item->_sock = ses->_sock;
+	_item->_msg = *msg;
+	_item->_msg.msg_body = NULL;
+
+	/* the body of a decoded message is released once the handler returns */
+	if(msg->msg_body != NULL && USENET_GET_MSG_SIZE(msg) > USENET_MSG_HEADER_SZ) {
+		_body_sz = USENET_GET_MSG_SIZE(msg) - USENET_MSG_HEADER_SZ;
+		_item->_msg.msg_body = (char*) malloc(_body_sz);
+		if(_item->_msg.msg_body == NULL) {
+			USENET_LOG_MESSAGE_ARGS("unable to queue a message for client %i", ses->_sock);
+			return USENET_ERROR;
+		}
+		memcpy(_item->_msg.msg_body, msg->msg_body, _body_sz);
+	}
+
+	out->_num++;
+	return USENET_SUCCESS;
+}
+
+/*
+ * Send the queued messages, the mutex must not be held. A message is
+ * dropped if its session was closed meanwhile, the closed callback
+ * waits for the send lock so the socket stays open during a send.
+ */
+static int _flush_outbox(struct userver* svr, struct userver_outbox* out)
+{
+	size_t _i = 0;
+	int _valid = 0;
+	struct userver_out* _item = NULL;
+
+	for(_i = 0; _i < out->_num; _i++) {
+		_item = &out->_msgs[_i];
+
+		pthread_mutex_lock(&svr->_send_locks[_item->_ix]);
+
+		pthread_mutex_lock(&svr->_mutex);
+		_valid = (svr->_sessions[_item->_ix]._sock == _item->_sock);
+		pthread_mutex_unlock(&svr->_mutex);
+
+		if(_valid)
+			usenet_send_message(_item->_sock, &_item->_msg);
+		else
+			USENET_LOG_MESSAGE_ARGS("client %i closed before the message was sent", _item->_sock);
+
+		pthread_mutex_unlock(&svr->_send_locks[_item->_ix]);
+
+		if(_item->_msg.msg_body)
+			free(_item->_msg.msg_body);
+	}
+
+	if(out->_msgs)
+		free(out->_msgs);
+	memset(out, 0, sizeof(struct userver_outbox));
+
+	return USENET_SUCCESS;
+}
+
+/* send a reset request to every client past the handshake */
+static int _reset_all_sessions(struct userver* svr)
+{
+	int _i = 0;
+	struct usenet_message _msg;
+	struct userver_outbox _out = {0};
+
+	pthread_mutex_lock(&svr->_mutex);
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(svr->_sessions[_i]._sock <= 0)
+			continue;
+
+		/* reset the index and action flg*/
+		usenet_message_init(&_msg);
+		_send_reset_req(&svr->_sessions[_i], &_msg, &_out);
+	}
+	pthread_mutex_unlock(&svr->_mutex);
+
+	return _flush_outbox(svr, &_out);
+}
+
+/* create the done directory of the spool */
+static int _make_done_dir(struct userver* svr)
+{
+	char _path[USENET_SERVER_PATH_SZ] = {0};
+
+	snprintf(_path, USENET_SERVER_PATH_SZ, "%s/%s", svr->_login.spool_dir, USENET_SERVER_SPOOL_DONE);
+	if(mkdir(_path, 0755) && errno != EEXIST) {
+		USENET_LOG_MESSAGE_ARGS("unable to create %s, %s", _path, strerror(errno));
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("spooling requests from %s", svr->_login.spool_dir);
+	return USENET_SUCCESS;
+}
+
+/*
+ * Load the requests. In spool mode only the new files of the spool
+ * directory are added, otherwise the request json replaces all
+ * outstanding requests.
+ */
+static int _load_requests(struct userver* svr)
+{
+	int _ret = USENET_SUCCESS;
+
+	if(svr->_login.spool_dir)
+		return _scan_spool(svr) < 0 ? USENET_ERROR : USENET_SUCCESS;
+
+	pthread_mutex_lock(&svr->_mutex);
+	_free_requests(svr);
+	_ret = _parse_request_file(svr, USENET_SERVER_JSON_PATH, NULL);
+	pthread_mutex_unlock(&svr->_mutex);
+
+	USENET_LOG_MESSAGE_ARGS("loaded %lu requests", svr->_num_requests);
+	return _ret;
+}
+
+/* parse the titles of the request file, caller holds the mutex */
+static int _parse_request_file(struct userver* svr, const char* path, const char* file)
+{
+	int _i = 0, _ret = USENET_SUCCESS, _num_tok = 0;
+	size_t _sz = 0;
+	char* _buff = NULL;
+	jsmntok_t* _tok = NULL, *_args = NULL;
+	struct usenet_str_arr _titles = {0};
+
 	/* read json from file */
-	usenet_read_file(USENET_SERVER_JSON_PATH, &_buff, &_sz);
+	if(usenet_read_file(path, &_buff, &_sz) != USENET_SUCCESS || _buff == NULL) {
+		_ret = USENET_ERROR;
+		goto clean_up;
+	}
+
+	if(usjson_parse_message(_buff, &_tok, &_num_tok) != USENET_SUCCESS ||
+	   usjson_get_token(_buff, _tok, _num_tok, USENET_SERVER_JSON_ARG_HEADER, NULL, &_args) != USENET_SUCCESS ||
+	   usjson_get_token_arr_as_str(_buff, _args, &_titles) != USENET_SUCCESS) {
+		USENET_LOG_MESSAGE_ARGS("unable to parse the request json %s", path);
+		_ret = USENET_ERROR;
+		goto clean_up;
+	}
 
-	if(_buff != NULL && _sz > 0) {
-		USENET_LOG_MESSAGE("copying request json to message body");
-		msg->msg_body = (char*) malloc(_sz+1);
-		strncpy((char*) msg->msg_body, _buff, _sz);
-		msg->msg_body[_sz] = '\0';
-		msg->size += _sz;
+	/* the requests take ownership of the titles */
+	for(_i = 0; _i < _titles._sz; _i++) {
+		if(_titles._arr[_i])
+			_add_request(svr, _titles._arr[_i], file);
 	}
-	if(_buff != NULL)
+
+clean_up:
+	if(_titles._arr)
+		free(_titles._arr);
+	if(_tok)
+		free(_tok);
+	if(_buff)
 		free(_buff);
 
+	return _ret;
+}
+
+/* append the request, caller holds the mutex */
+static int _add_request(struct userver* svr, char* title, const char* file)
+{
+	struct userver_request* _req = NULL;
+
+	_req = (struct userver_request*) calloc(1, sizeof(struct userver_request));
+	_req->_title = title;
+	_req->_file = (file ? strdup(file) : NULL);
+
+	svr->_requests = (struct userver_request**) realloc(svr->_requests,
+														sizeof(struct userver_request*) * (svr->_num_requests + 1));
+	svr->_requests[svr->_num_requests++] = _req;
+
 	return USENET_SUCCESS;
 }
 
-static inline __attribute__ ((always_inline)) int _send_function_req(struct userver* svr, struct usenet_message* msg)
+/*
+ * Add the request files of the spool directory which are not loaded yet.
+ * Returns the number of new files found or USENET_ERROR.
+ */
+static int _scan_spool(struct userver* svr)
 {
-	void* _data = NULL;
-	size_t _size = 0;
+	int _cnt = 0;
+	size_t _nlen = 0, _num = 0, _elen = strlen(USENET_SERVER_SPOOL_EXT);
+	DIR* _dir = NULL;
+	struct dirent* _ent = NULL;
+	struct stat _st;
+	char _path[USENET_SERVER_PATH_SZ] = {0};
+
+	_dir = opendir(svr->_login.spool_dir);
+	if(_dir == NULL) {
+		USENET_LOG_MESSAGE_ARGS("unable to open spool directory %s", svr->_login.spool_dir);
+		return USENET_ERROR;
+	}
 
-	msg->ins = USENET_REQUEST_FUNCTION;
-	_msg_get_nzb(NULL, msg);
+	pthread_mutex_lock(&svr->_mutex);
+	while((_ent = readdir(_dir))) {
+		if(_ent->d_type != DT_REG && _ent->d_type != DT_UNKNOWN)
+			continue;
+
+		_nlen = strlen(_ent->d_name);
+		if(_nlen <= _elen || strcmp(_ent->d_name + _nlen - _elen, USENET_SERVER_SPOOL_EXT) != 0)
+			continue;
+
+		/* skip the files already queued */
+		if(_spool_file_loaded(svr, _ent->d_name))
+			continue;
+
+		/* some file systems don't report the type in the entry */
+		snprintf(_path, USENET_SERVER_PATH_SZ, "%s/%s", svr->_login.spool_dir, _ent->d_name);
+		if(_ent->d_type == DT_UNKNOWN && (stat(_path, &_st) != 0 || !S_ISREG(_st.st_mode)))
+			continue;
+
+		_num = svr->_num_requests;
+		if(_parse_request_file(svr, _path, _ent->d_name) != USENET_SUCCESS)
+			continue;
+
+		/* a file without titles is never loaded, move it aside so it is not counted again */
+		if(svr->_num_requests == _num) {
+			USENET_LOG_MESSAGE_ARGS("spool file %s has no requests", _ent->d_name);
+			_spool_file_done(svr, _ent->d_name);
+			continue;
+		}
 
-	USENET_LOG_MESSAGE("serialising the buffer");
-	usenet_serialise_message(msg, &_data, &_size);
+		_cnt++;
+	}
+	pthread_mutex_unlock(&svr->_mutex);
 
-	USENET_LOG_MESSAGE("sending message to client");
-	thcon_send_info(&svr->_connection, _data, _size);
+	closedir(_dir);
 
-	/* once sent destroy the buffer */
-	free(_data);
-	return USENET_SUCCESS;
+	if(_cnt > 0)
+		USENET_LOG_MESSAGE_ARGS("queued %i new spool files, %lu requests outstanding", _cnt, svr->_num_requests);
+
+	return _cnt;
 }
 
-static inline __attribute__ ((always_inline)) int _send_reset_req(struct userver* svr, struct usenet_message* msg)
+/* check if the spool file has outstanding requests, caller holds the mutex */
+static int _spool_file_loaded(struct userver* svr, const char* file)
 {
-	void* _data = NULL;
-	size_t _size = 0;
+	size_t _i = 0;
+
+	for(_i = 0; _i < svr->_num_requests; _i++) {
+		if(svr->_requests[_i]->_file && strcmp(svr->_requests[_i]->_file, file) == 0)
+			return 1;
+	}
 
-	if(svr->_conn_flg == 0)
+	return 0;
+}
+
+/* check if a request of the spool file is still unacknowledged, caller holds the mutex */
+static int _spool_file_pending(struct userver* svr, const char* file)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < svr->_num_requests; _i++) {
+		if(!svr->_requests[_i]->_acked && svr->_requests[_i]->_file &&
+		   strcmp(svr->_requests[_i]->_file, file) == 0)
+			return 1;
+	}
+
+	return 0;
+}
+
+/* move a spool file to the done directory */
+static int _spool_file_done(struct userver* svr, const char* file)
+{
+	char _src[USENET_SERVER_PATH_SZ] = {0};
+	char _dst[USENET_SERVER_PATH_SZ] = {0};
+
+	snprintf(_src, USENET_SERVER_PATH_SZ, "%s/%s", svr->_login.spool_dir, file);
+	snprintf(_dst, USENET_SERVER_PATH_SZ, "%s/%s/%s", svr->_login.spool_dir, USENET_SERVER_SPOOL_DONE, file);
+	if(rename(_src, _dst)) {
+		USENET_LOG_MESSAGE_ARGS("unable to move %s to %s, %s", _src, _dst, strerror(errno));
+		return USENET_ERROR;
+	}
+
+	USENET_LOG_MESSAGE_ARGS("spool file %s processed", file);
+	return USENET_SUCCESS;
+}
+
+/*
+ * Mark the pending requests of the session as acknowledged and drop them.
+ * Spool files with no outstanding requests left are moved to the done
+ * directory. The titles of the request json stay loaded and are sent
+ * again with the next handshake, caller holds the mutex.
+ */
+static int _ack_requests(struct userver_session* ses)
+{
+	size_t _i = 0, _j = 0;
+	struct userver* _svr = ses->_svr;
+	struct userver_request* _req = NULL;
+
+	/* without a spool the requests are only handed back for the next cycle */
+	if(_svr->_login.spool_dir == NULL) {
+		while(ses->_num_pending > 0)
+			ses->_pending[--ses->_num_pending]->_sock = 0;
 		return USENET_SUCCESS;
+	}
+
+	for(_i = 0; _i < ses->_num_pending; _i++)
+		ses->_pending[_i]->_acked = 1;
+	ses->_num_pending = 0;
+
+	/* move the spool files whose requests are all acknowledged */
+	for(_i = 0; _i < _svr->_num_requests; _i++) {
+		_req = _svr->_requests[_i];
+		if(!_req->_acked || _req->_file == NULL || _spool_file_pending(_svr, _req->_file))
+			continue;
+
+		/* several requests share a file, move it once */
+		for(_j = 0; _j < _i; _j++) {
+			if(_svr->_requests[_j]->_file && strcmp(_svr->_requests[_j]->_file, _req->_file) == 0)
+				break;
+		}
+		if(_j < _i)
+			continue;
+
+		_spool_file_done(_svr, _req->_file);
+	}
+
+	/* compact the outstanding requests */
+	for(_i = 0, _j = 0; _i < _svr->_num_requests; _i++) {
+		_req = _svr->_requests[_i];
+		if(!_req->_acked) {
+			_svr->_requests[_j++] = _req;
+			continue;
+		}
+
+		free(_req->_title);
+		if(_req->_file)
+			free(_req->_file);
+		free(_req);
+	}
+
+	_svr->_num_requests = _j;
+	return USENET_SUCCESS;
+}
+
+/* release the requests, caller holds the mutex */
+static int _free_requests(struct userver* svr)
+{
+	size_t _i = 0;
+
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++)
+		svr->_sessions[_i]._num_pending = 0;
+
+	for(_i = 0; _i < svr->_num_requests; _i++) {
+		free(svr->_requests[_i]->_title);
+		if(svr->_requests[_i]->_file)
+			free(svr->_requests[_i]->_file);
+		free(svr->_requests[_i]);
+	}
+
+	if(svr->_requests)
+		free(svr->_requests);
+
+	svr->_requests = NULL;
+	svr->_num_requests = 0;
+	return USENET_SUCCESS;
+}
 
-	if(svr->_active_sock <= 0)
+/*
+ * Queue the share of unsent requests for the session. The unsent requests
+ * are split evenly between the sessions still waiting for their function
+ * request, caller holds the mutex.
+ */
+static int _assign_requests(struct userver_session* ses)
+{
+	int _i = 0, _num = 0;
+	size_t _j = 0, _unsent = 0, _share = 0;
+	struct userver* _svr = ses->_svr;
+
+	/* sessions yet to receive a function request, including this one */
+	for(_i = 0; _i < USENET_SERVER_MAX_SESSIONS; _i++) {
+		if(_svr->_sessions[_i]._sock > 0 && _svr->_sessions[_i]._act_ix == 0)
+			_num++;
+	}
+
+	/* give back anything this session held from a previous cycle */
+	while(ses->_num_pending > 0)
+		ses->_pending[--ses->_num_pending]->_sock = 0;
+
+	for(_j = 0; _j < _svr->_num_requests; _j++) {
+		if(_svr->_requests[_j]->_sock == 0)
+			_unsent++;
+	}
+
+	_share = (_unsent + (_num > 0 ? _num : 1) - 1) / (_num > 0 ? _num : 1);
+	for(_j = 0; _j < _svr->_num_requests && ses->_num_pending < _share && ses->_num_pending < USENET_SERVER_MAX_PENDING; _j++) {
+		if(_svr->_requests[_j]->_sock != 0)
+			continue;
+
+		_svr->_requests[_j]->_sock = ses->_sock;
+		ses->_pending[ses->_num_pending++] = _svr->_requests[_j];
+	}
+
+	USENET_LOG_MESSAGE_ARGS("assigned %lu of %lu unsent requests to client %i",
+							ses->_num_pending, _unsent, ses->_sock);
+	return USENET_SUCCESS;
+}
+
+/* construct the function request from the pending requests of the session */
+static int _msg_get_nzb(struct userver_session* ses, struct usenet_message* msg)
+{
+	int _i = 0;
+	size_t _sz = 0, _len = 0;
+
+	USENET_LOG_MESSAGE("constructing json rpc message");
+
+	/* work out the size of the body */
+	_sz = USENET_SERVER_JSON_SZ;
+	for(_i = 0; _i < ses->_num_pending; _i++)
+		_sz += strlen(ses->_pending[_i]->_title) + 4;
+
+	msg->msg_body = (char*) malloc(sizeof(char) * _sz);
+	_len = snprintf(msg->msg_body, _sz, "{\"%s\": \"%s\", \"%s\": [",
+					USENET_SERVER_JSON_FN_HEADER,
+					USENET_SERVER_JSON_FN_NAME,
+					USENET_SERVER_JSON_ARG_HEADER);
+
+	for(_i = 0; _i < ses->_num_pending; _i++) {
+		_len += snprintf(msg->msg_body + _len, _sz - _len, "%s\"%s\"",
+						 (_i > 0 ? ", " : ""),
+						 ses->_pending[_i]->_title);
+	}
+
+	_len += snprintf(msg->msg_body + _len, _sz - _len, "]}");
+	msg->size += _len + 1;
+
+	return USENET_SUCCESS;
+}
+
+static inline __attribute__ ((always_inline)) int _send_function_req(struct userver_session* ses, struct usenet_message* msg, struct userver_outbox* out)
+{
+	_assign_requests(ses);
+
+	msg->ins = USENET_REQUEST_FUNCTION;
+	_msg_get_nzb(ses, msg);
+
+	USENET_LOG_MESSAGE_ARGS("sending message to client %i", ses->_sock);
+	_queue_message(out, ses, msg);
+
+	/* the body is not owned by the decoder, the queue took a copy */
+	free(msg->msg_body);
+	msg->msg_body = NULL;
+	msg->size = USENET_MSG_HEADER_SZ;
+
+	return USENET_SUCCESS;
+}
+
+static inline __attribute__ ((always_inline)) int _send_reset_req(struct userver_session* ses, struct usenet_message* msg, struct userver_outbox* out)
+{
+	if(ses->_sock <= 0)
 		return USENET_SUCCESS;
 
-	if(svr->_accept_flg != 0)
+	if(ses->_accept_flg != 0)
 		return USENET_SUCCESS;
 
 	msg->ins = USENET_REQUEST_RESET;
 
-	USENET_LOG_MESSAGE("serialising message");
-	/* serialise the buffer */
-	usenet_serialise_message(msg, &_data, &_size);
-
-	USENET_LOG_MESSAGE("sending message to client reset request");
-	thcon_send_info(&svr->_connection, _data, _size);
+	USENET_LOG_MESSAGE_ARGS("sending message to client %i reset request", ses->_sock);
+	_queue_message(out, ses, msg);
 
-	free(_data);
 	return USENET_SUCCESS;
 }
 
@@ -439,10 +1188,10 @@ static inline __attribute__ ((always_inline)) int _send_reset_req(struct userver
  * This method resets the action index and set the connection flag
  * back in to the accepted state.
  */
-static inline __attribute__ ((always_inline)) int _reset_ix_conn_flg(struct userver* svr)
+static inline __attribute__ ((always_inline)) int _reset_ix_conn_flg(struct userver_session* ses)
 {
-	svr->_act_ix = 0;
-	svr->_accept_flg = 1;
+	ses->_act_ix = 0;
+	ses->_accept_flg = 1;
 
 	return USENET_SUCCESS;
 }
@@ -13,6 +13,10 @@
 #include <time.h>
 #include <errno.h>
 #include <sys/types.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <arpa/inet.h>
+#include <stdint.h>
 #include <dirent.h>
 
 
@@ -24,7 +28,6 @@
 #define USENET_SETTINGS_FILE "../config/usenet.cfg"
 #define USENET_PROC_PATH "/proc"
 #define USENET_DESTINATION_PATH_SZ 512
-#define USENET_SCP_BUF_SZ 1024
 
 #define USENET_GET_SETTING_STRING(name)								\
     if((_setting = config_lookup(&login->_config, #name)) != NULL)	\
@@ -36,6 +39,16 @@
 #define USENET_CHECK_FILE_EXT(fname)									\
 	(((strstr((fname), "mkv") || strstr((fname), "avi") || strstr((fname), "wmv")) && !strstr((fname), "sample"))? 1 : 0)
 
+/* per thread block pool, a set bit in the mask marks a taken block */
+struct _usenet_pool
+{
+	unsigned int _used_mask;
+	char _blocks[USENET_POOL_NUM_BLOCKS][USENET_POOL_BLOCK_SZ] __attribute__ ((aligned (16)));
+};
+
+static __thread struct _usenet_pool _pool;
+static struct usenet_pool_stats _pool_stats;
+
 static inline __attribute__ ((always_inline)) const char* _usenet_utils_get_ext(const char* fname);
 static const int _usenet_utils_rename_helper(struct  usenet_nzb_filellist* list, const char* file_path);
 
@@ -81,10 +94,31 @@ int usenet_utils_load_config(struct gapi_login* login)
 	USENET_GET_SETTING_STRING(log_to_file);
 	USENET_GET_SETTING_STRING(log_file_path);
 	USENET_GET_SETTING_STRING(scp_progress);
+	USENET_GET_SETTING_STRING(binary_broadcast);
+	USENET_GET_SETTING_STRING(spool_dir);
+	USENET_GET_SETTING_STRING(transfer_mode);
+	USENET_GET_SETTING_STRING(checkpoint_dir);
+	USENET_GET_SETTING_STRING(transfer_verify);
+	USENET_GET_SETTING_STRING(transfer_schedule);
+	USENET_GET_SETTING_STRING(transfer_priority);
+	USENET_GET_SETTING_STRING(transfer_skip_existing);
+	USENET_GET_SETTING_STRING(transfer_delta);
+	USENET_GET_SETTING_STRING(nzbget_transport);
 	USENET_GET_SETTING_INT(scan_freq);
 	USENET_GET_SETTING_INT(svr_wait_time);
 	USENET_GET_SETTING_INT(nzb_fsize_threshold);
 	USENET_GET_SETTING_INT(progress_update_interval);
+	USENET_GET_SETTING_INT(scp_buffer_size);
+	USENET_GET_SETTING_INT(scp_pipeline_depth);
+	USENET_GET_SETTING_INT(transfer_workers);
+	USENET_GET_SETTING_INT(ssh_keepalive);
+	USENET_GET_SETTING_INT(ssh_idle_timeout);
+	USENET_GET_SETTING_INT(transfer_streams);
+	USENET_GET_SETTING_INT(segment_threshold_mb);
+	USENET_GET_SETTING_INT(transfer_rate_kb);
+	USENET_GET_SETTING_INT(transfer_file_rate_kb);
+	USENET_GET_SETTING_INT(transfer_direct_mb);
+	USENET_GET_SETTING_INT(delta_block_kb);
 
     return USENET_SUCCESS;
 }
@@ -408,6 +442,18 @@ int usenet_utils_time_diff(const char* file)
 	return (int) difftime(_now, _buf.st_mtime);
 }
 
+/*
+ * Seconds elapsed since start on the monotonic clock
+ */
+double usenet_utils_elapsed(const struct timespec* start)
+{
+	struct timespec _now;
+
+	clock_gettime(CLOCK_MONOTONIC, &_now);
+	return (double) (_now.tv_sec - start->tv_sec) +
+		(double) (_now.tv_nsec - start->tv_nsec) / 1000000000.0;
+}
+
 /*
  * Replace space character with an underscore
  */
@@ -610,210 +656,395 @@ int usenet_utils_create_destinatin_path(struct gapi_login* config, struct usenet
 	return USENET_SUCCESS;
 }
 
-/* scp the file from source to the destination */
+/* scp the file from source to the destination through the transfer engine */
 int usenet_utils_scp_file(struct gapi_login* config,
 						  const char* source,
 						  const char* target,
 						  int (*prog)(void*, float),
 						  void* ext_obj)
 {
-	thcon _thcon;											/* connection object */
-	int _sock = -1, _fd = -1, _nread = 0, _rc = 0, _prog = 0;
-	int _ret = USENET_ERROR;
-	char _buf[USENET_SCP_BUF_SZ] = {0};						/* read buffer */
-	char* _w_ptr = NULL;									/* pointer to the buffer writing to channel */
+	return usenet_transfer_file(config, source, target, prog, ext_obj, NULL);
+}
 
-	struct stat _fstat = {0};
+/* Serialise the message into buffer */
+int usenet_serialise_message(struct usenet_message* msg, void** buff, size_t* sz)
+{
+	/* get the buffer size */
+	*sz = USENET_GET_MSG_SIZE(msg);
+
+	*buff = malloc(sizeof(char) * (*sz));
+
+	/* pack the buffer with message contents */
+	memcpy(*buff, &msg->ins, USENET_CMD_BUFF_SZ);
+	memcpy(*buff + USENET_CMD_BUFF_SZ, &msg->size, USENET_SIZE_BUFF_SZ);
 
-    LIBSSH2_SESSION *_session = NULL;
-    LIBSSH2_CHANNEL *_channel = NULL;
+	/*
+	 * copy to the message buffer if its not NULL and the length is greather than
+	 * standard.
+	 */
+	if(msg->msg_body != NULL &&
+	   *sz > (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)) {
+		memcpy(*buff + USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ,
+			   msg->msg_body,
+			   msg->size - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ));
+	}
+
+	/* return the total size */
+	return USENET_SUCCESS;
+}
 
-	/* iniialise the connection object */
-	USENET_LOG_MESSAGE("creating connection object");
-	thcon_init(&_thcon, thcon_mode_client);
+/*
+ * Send the message header and body with a single vectored write.
+ * The header fields and the body are written straight from the message
+ * struct, no intermediate buffer is created.
+ */
+int usenet_send_message(int sock, struct usenet_message* msg)
+{
+	int _cnt = 1;
+	ssize_t _rc = 0;
+	size_t _body_sz = 0;
+	struct iovec _iov[3];
+	struct iovec* _iov_ptr = _iov;
+	struct msghdr _mhdr = {0};
+
+	if(msg == NULL || sock <= 0)
+		return USENET_ARG_ERROR;
 
-	/* set destination and port address */
-	thcon_set_server_name(&_thcon, config->server_name);
-	thcon_set_port_name(&_thcon, config->ssh_port);
+	/* instruction and size header */
+	_iov[0].iov_base = &msg->ins;
+	_iov[0].iov_len = USENET_CMD_BUFF_SZ;
+	_iov[1].iov_base = &msg->size;
+	_iov[1].iov_len = USENET_SIZE_BUFF_SZ;
+	_cnt = 2;
 
-	/* create a raw socket */
-	_sock = thcon_create_raw_sock(&_thcon);
-	if(_sock <= 0) {
-		USENET_LOG_MESSAGE("unable to create a raw socket for the scp");
-		goto cleanup;
+	/* attach the body only if the size indicates there is one */
+	if(msg->msg_body != NULL &&
+	   USENET_GET_MSG_SIZE(msg) > (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)) {
+		_body_sz = USENET_GET_MSG_SIZE(msg) - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ);
+		_iov[2].iov_base = msg->msg_body;
+		_iov[2].iov_len = _body_sz;
+		_cnt = 3;
 	}
 
-	/* create a new ssh session */
-	USENET_LOG_MESSAGE("initialising ssh session");
-	_session = libssh2_session_init();
-	if(!_session) {
-		USENET_LOG_MESSAGE("unable to create ssh session");
-		goto cleanup;
+	/* keep writing until all vectors are drained */
+	while(_cnt > 0) {
+		_mhdr.msg_iov = _iov_ptr;
+		_mhdr.msg_iovlen = _cnt;
+
+		_rc = sendmsg(sock, &_mhdr, MSG_NOSIGNAL);
+		if(_rc < 0) {
+			if(errno == EINTR)
+				continue;
+
+			USENET_LOG_MESSAGE_ARGS("errors occured while sending message, %s", strerror(errno));
+			return USENET_ERROR;
+		}
+
+		/* advance past the fully written vectors */
+		while(_cnt > 0 && (size_t) _rc >= _iov_ptr->iov_len) {
+			_rc -= _iov_ptr->iov_len;
+			_iov_ptr++;
+			_cnt--;
+		}
+
+		/* partially written vector, move its base forward */
+		if(_cnt > 0) {
+			_iov_ptr->iov_base = (char*) _iov_ptr->iov_base + _rc;
+			_iov_ptr->iov_len -= _rc;
+		}
 	}
 
-	/* start a handshake */
-	USENET_LOG_MESSAGE("ssh handshake");
-	if(libssh2_session_handshake(_session, _sock)) {
-		USENET_LOG_MESSAGE("ssh handshake failed");
-		goto cleanup;
+	return USENET_SUCCESS;
+}
+
+/* allocate a zeroed block from the calling thread's pool */
+void* usenet_pool_alloc(size_t sz)
+{
+	int _ix = 0;
+	unsigned int _free = 0;
+
+	_free = ~_pool._used_mask & ((1u << USENET_POOL_NUM_BLOCKS) - 1);
+	if(sz > USENET_POOL_BLOCK_SZ || _free == 0) {
+		__sync_fetch_and_add(&_pool_stats._misses, 1);
+		return calloc(sz, sizeof(char));
 	}
 
-	/* authenticate using public key */
-	USENET_LOG_MESSAGE("authenticating using public/private");
-	if(libssh2_userauth_publickey_fromfile(_session,
-										   config->ssh_user,
-										   config->rsa_public_key,
-										   config->rsa_private_key,
-										   NULL)) {
-		USENET_LOG_MESSAGE("unable to authenticate connection");
-		goto cleanup;
+	/* take the lowest free block */
+	_ix = __builtin_ctz(_free);
+	_pool._used_mask |= (1u << _ix);
+
+	__sync_fetch_and_add(&_pool_stats._hits, 1);
+	__sync_fetch_and_add(&_pool_stats._in_use, 1);
+
+	memset(_pool._blocks[_ix], 0, sz);
+	return _pool._blocks[_ix];
+}
+
+/* return the block to the pool, or free if it came from malloc */
+void usenet_pool_free(void* ptr)
+{
+	ptrdiff_t _off = 0;
+
+	if(ptr == NULL)
+		return;
+
+	_off = (char*) ptr - (char*) _pool._blocks;
+	if(_off < 0 || _off >= (ptrdiff_t) sizeof(_pool._blocks)) {
+		free(ptr);
+		return;
 	}
 
-	USENET_LOG_MESSAGE("ssh connection authenticated successfully");
+	_pool._used_mask &= ~(1u << (_off / USENET_POOL_BLOCK_SZ));
+	__sync_fetch_and_sub(&_pool_stats._in_use, 1);
+	return;
+}
 
-	/* open file and get stats */
-	USENET_LOG_MESSAGE("openning source file and getting stats");
-	_fd = open(source, O_RDONLY);
+/* copy the pool counters */
+int usenet_pool_get_stats(struct usenet_pool_stats* stats)
+{
+	if(stats == NULL)
+		return USENET_ARG_ERROR;
+
+	stats->_hits = __sync_fetch_and_add(&_pool_stats._hits, 0);
+	stats->_misses = __sync_fetch_and_add(&_pool_stats._misses, 0);
+	stats->_in_use = __sync_fetch_and_add(&_pool_stats._in_use, 0);
+	return USENET_SUCCESS;
+}
+
+/* unserialise the buffer */
+int usenet_unserialise_message(const void* buff, const size_t sz, struct usenet_message* msg)
+{
+	size_t _body_sz = 0;
+
+	/* check buffer size */
+	if(sz < USENET_MSG_HEADER_SZ)
+		return USENET_ERROR;
+
+	/* copy the bytes to the message struct */
+	memcpy(&msg->ins, buff, USENET_CMD_BUFF_SZ);
+	memcpy(&msg->size, buff + USENET_CMD_BUFF_SZ, USENET_SIZE_BUFF_SZ);
+	msg->msg_body = NULL;
 
-	if(_fd < 1) {
-		USENET_LOG_MESSAGE_ARGS("unable to open the file %s", source);
-		goto cleanup;
+	/* never trust the embedded size beyond what was received */
+	if(USENET_GET_MSG_SIZE(msg) < USENET_MSG_HEADER_SZ || USENET_GET_MSG_SIZE(msg) > sz) {
+		USENET_LOG_MESSAGE_ARGS("message size %u doesn't match received bytes %lu", msg->size, sz);
+		msg->size = USENET_MSG_HEADER_SZ;
+		return USENET_ERROR;
 	}
 
-	fstat(_fd, &_fstat);
-	USENET_LOG_MESSAGE_ARGS("creating channel for target %s", target);
-	_channel = libssh2_scp_send(_session,
-								target,
-								_fstat.st_mode & 0777,
-								(unsigned long) _fstat.st_size);
-	/* errors have occured */
-	if(!_channel) {
-		USENET_LOG_MESSAGE("errors occured while creating a channel");
-		goto cleanup;
+	_body_sz = USENET_GET_MSG_SIZE(msg) - USENET_MSG_HEADER_SZ;
+	if(_body_sz > 0) {
+		msg->msg_body = (char*) malloc(sizeof(char) * (_body_sz + 1));
+		memcpy(msg->msg_body, buff + USENET_MSG_HEADER_SZ, _body_sz);
+		msg->msg_body[_body_sz] = '\0';
 	}
 
-	/* read chunk at a time and write to the channel */
-	do {
-		_nread = read(_fd, &_buf, USENET_SCP_BUF_SZ);
+	return USENET_SUCCESS;
+}
 
-		/* break from loop if the read size less or equal to zero */
-		if(_nread <= 0)
-			break;
+/* encode the binary payload into the buffer */
+int usenet_bin_encode(const struct usenet_bin_payload* payload, char* buff, size_t sz)
+{
+	uint32_t _val = 0;
 
-		_w_ptr = _buf;
+	if(payload == NULL || buff == NULL || sz < USENET_BIN_PAYLOAD_SZ)
+		return USENET_ARG_ERROR;
 
-		/* handle progress */
-		_prog += _nread;
+	buff[0] = (char) payload->_opcode;
 
-		do {
+	_val = htonl((uint32_t) payload->_nzb_id);
+	memcpy(buff + 1, &_val, sizeof(_val));
 
-			/* write all of the read bytes until done */
-			_rc = libssh2_channel_write(_channel, _w_ptr, _nread);
-			if(_rc < 0) {
-				USENET_LOG_MESSAGE("errors occured writing to channel");
-				goto cleanup;
-			}
+	_val = htonl((uint32_t) payload->_pid);
+	memcpy(buff + 5, &_val, sizeof(_val));
 
-			/*
-			 * increment write position of the buffer and decrement the number of
-			 * bytes written from the total read.
-			 */
-			_w_ptr += _rc;
-			_nread -= _rc;
+	_val = htonl((uint32_t) payload->_progress);
+	memcpy(buff + 9, &_val, sizeof(_val));
 
-		} while(_nread);
+	return USENET_SUCCESS;
+}
 
-		/* if the callback function is supplied with this we call to indicate progress */
-		if(prog != NULL)
-			prog(ext_obj,  (float) ((float) _prog / (float) _fstat.st_size));
+/* decode the binary payload from the buffer */
+int usenet_bin_decode(const char* buff, size_t sz, struct usenet_bin_payload* payload)
+{
+	uint32_t _val = 0;
 
-	}while(1);
+	if(payload == NULL || buff == NULL || sz < USENET_BIN_PAYLOAD_SZ)
+		return USENET_ARG_ERROR;
 
-	/* send ending characters */
-	libssh2_channel_send_eof(_channel);
+	payload->_opcode = (unsigned char) buff[0];
 
-	libssh2_channel_wait_eof(_channel);
+	memcpy(&_val, buff + 1, sizeof(_val));
+	payload->_nzb_id = (int) ntohl(_val);
 
-	libssh2_channel_wait_closed(_channel);
+	memcpy(&_val, buff + 5, sizeof(_val));
+	payload->_pid = (pid_t) ntohl(_val);
 
-	_ret = USENET_SUCCESS;
+	memcpy(&_val, buff + 9, sizeof(_val));
+	payload->_progress = ntohl(_val);
 
-cleanup:
+	return USENET_SUCCESS;
+}
 
-	USENET_LOG_MESSAGE("ssh cleanup...");
+/* initialise the frame decoder */
+int usenet_decoder_init(struct usenet_msg_decoder* dec, int (*handler)(void*, struct usenet_message*), void* ext_obj)
+{
+	if(dec == NULL || handler == NULL)
+		return USENET_ARG_ERROR;
 
-	/* free the channel */
-	if(_channel)
-		libssh2_channel_free(_channel);
-	_channel = NULL;
+	dec->_buf = (char*) malloc(sizeof(char) * USENET_DECODER_INIT_SZ);
+	if(dec->_buf == NULL) {
+		dec->_cap = 0;
+		return USENET_ERROR;
+	}
 
-	/* close the open file descriptor */
-	if(_fd > 0)
-		close(_fd);
+	dec->_len = 0;
+	dec->_cap = USENET_DECODER_INIT_SZ;
+	dec->_handler = handler;
+	dec->_ext_obj = ext_obj;
 
-	/* close the session */
-	if(_session) {
-		libssh2_session_disconnect(_session, "ssh session shutdown");
-		libssh2_session_free(_session);
-	}
+	return USENET_SUCCESS;
+}
 
-	/* close descriptor if was open */
-	if(_sock > 0)
-		close(_sock);
+/*
+ * Consume as many complete frames as available in the buffer.
+ * Returns the number of bytes consumed or USENET_ERROR if a corrupt
+ * header was found.
+ */
+static ssize_t _usenet_decoder_drain(struct usenet_msg_decoder* dec, const char* data, size_t sz)
+{
+	size_t _off = 0;
+	unsigned int _frame_sz = 0;
+	size_t _body_sz = 0;
+	char* _body = NULL;
+	struct usenet_message _msg;
+
+	while(sz - _off >= USENET_MSG_HEADER_SZ) {
+
+		/* peek the frame size, only the size field is significant */
+		memcpy(&_frame_sz, data + _off + USENET_CMD_BUFF_SZ, sizeof(_frame_sz));
+		if(_frame_sz < USENET_MSG_HEADER_SZ || _frame_sz > USENET_MSG_MAX_SZ) {
+			USENET_LOG_MESSAGE_ARGS("corrupt frame header with size %u, dropping buffered data", _frame_sz);
+			return USENET_ERROR;
+		}
 
+		/* wait for the rest of the frame */
+		if(sz - _off < _frame_sz)
+			break;
 
-	/* delete connection object */
-	thcon_delete(&_thcon);
-	return _ret;
+		/* unpack the frame, the body is taken from the pool */
+		usenet_message_init(&_msg);
+		memcpy(&_msg.ins, data + _off, USENET_CMD_BUFF_SZ);
+		_msg.size = _frame_sz;
+
+		_body_sz = _frame_sz - USENET_MSG_HEADER_SZ;
+		if(_body_sz > 0) {
+			USENET_CREATE_POOLED_MESSAGE(&_msg, _body_sz);
+			memcpy(_msg.msg_body, data + _off + USENET_MSG_HEADER_SZ, _body_sz);
+		}
+
+		/*
+		 * Keep a copy of the body pointer, the handler is
+		 * free to reinitialise the message.
+		 */
+		_body = _msg.msg_body;
+		dec->_handler(dec->_ext_obj, &_msg);
+
+		usenet_pool_free(_body);
+		_body = NULL;
+
+		_off += _frame_sz;
+	}
+
+	return (ssize_t) _off;
 }
 
-/* Serialise the message into buffer */
-int usenet_serialise_message(struct usenet_message* msg, void** buff, size_t* sz)
+/*
+ * Feed received bytes to the decoder. On USENET_ERROR the stream can not
+ * be followed any further, the buffered bytes are dropped and the caller
+ * must reset the peer or close the connection.
+ */
+int usenet_decoder_feed(struct usenet_msg_decoder* dec, const void* data, size_t sz)
 {
-	/* get the buffer size */
-	*sz = USENET_GET_MSG_SIZE(msg);
-
-	*buff = malloc(sizeof(char) * (*sz));
+	ssize_t _used = 0;
+	size_t _cap = 0;
+	char* _buf = NULL;
 
-	/* pack the buffer with message contents */
-	memcpy(*buff, &msg->ins, USENET_CMD_BUFF_SZ);
-	memcpy(*buff + USENET_CMD_BUFF_SZ, &msg->size, USENET_SIZE_BUFF_SZ);
+	if(dec == NULL || data == NULL || dec->_buf == NULL)
+		return USENET_ARG_ERROR;
 
 	/*
-	 * copy to the message buffer if its not NULL and the length is greather than
-	 * standard.
+	 * Nothing pending, decode straight from the received bytes
+	 * and only buffer the tail of an incomplete frame.
 	 */
-	if(msg->msg_body != NULL &&
-	   *sz > (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)) {
-		memcpy(*buff + USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ,
-			   msg->msg_body,
-			   msg->size - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ));
+	if(dec->_len == 0) {
+		_used = _usenet_decoder_drain(dec, (const char*) data, sz);
+		if(_used < 0)
+			return USENET_ERROR;
+
+		data = (const char*) data + _used;
+		sz -= (size_t) _used;
+		if(sz == 0)
+			return USENET_SUCCESS;
+	}
+
+	/* grow the buffer to hold the new bytes */
+	if(dec->_len + sz > dec->_cap) {
+		_cap = dec->_cap;
+		while(dec->_len + sz > _cap)
+			_cap *= 2;
+
+		/* the new bytes are lost, so is the frame boundary */
+		_buf = (char*) realloc(dec->_buf, _cap);
+		if(_buf == NULL) {
+			USENET_LOG_MESSAGE("unable to grow the decoder buffer, dropping buffered data");
+			dec->_len = 0;
+			return USENET_ERROR;
+		}
+
+		dec->_buf = _buf;
+		dec->_cap = _cap;
+	}
+
+	memcpy(dec->_buf + dec->_len, data, sz);
+	dec->_len += sz;
+
+	_used = _usenet_decoder_drain(dec, dec->_buf, dec->_len);
+	if(_used < 0) {
+		dec->_len = 0;
+		return USENET_ERROR;
+	}
+
+	/* shift the incomplete frame to the front */
+	if(_used > 0) {
+		memmove(dec->_buf, dec->_buf + _used, dec->_len - (size_t) _used);
+		dec->_len -= (size_t) _used;
 	}
 
-	/* return the total size */
 	return USENET_SUCCESS;
 }
 
-/* unserialise the buffer */
-int usenet_unserialise_message(const void* buff, const size_t sz, struct usenet_message* msg)
+/* drop any pending bytes, used when the connection is reset */
+int usenet_decoder_reset(struct usenet_msg_decoder* dec)
 {
-	/* check buffer size */
-	if(sz < (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ))
-		return USENET_ERROR;
+	if(dec == NULL)
+		return USENET_ARG_ERROR;
 
-	/* copy the bytes to the message struct */
-	memcpy(&msg->ins, buff, USENET_CMD_BUFF_SZ);
-	memcpy(&msg->size, buff + USENET_CMD_BUFF_SZ, USENET_SIZE_BUFF_SZ);
-	msg->msg_body = NULL;
-	if(sz > (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)) {
-		msg->msg_body = (char*) malloc(sizeof(char) * (sz - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)+1));
-		memset(msg->msg_body, 0, sizeof(char) * (sz - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)));
-		memcpy(msg->msg_body,
-			   buff + USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ,
-			   msg->size - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ));
-		msg->msg_body[msg->size - (USENET_CMD_BUFF_SZ + USENET_SIZE_BUFF_SZ)] = '\0';
-	}
+	dec->_len = 0;
+	return USENET_SUCCESS;
+}
+
+int usenet_decoder_destroy(struct usenet_msg_decoder* dec)
+{
+	if(dec == NULL)
+		return USENET_ARG_ERROR;
+
+	if(dec->_buf)
+		free(dec->_buf);
 
+	dec->_buf = NULL;
+	dec->_len = 0;
+	dec->_cap = 0;
 	return USENET_SUCCESS;
 }
 
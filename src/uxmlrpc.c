@@ -1,7 +1,8 @@
 /*
  * This is a basic implementation of xmlrpc using libxml2 and curl.
  * xmlrpc library has int limitations which doesn't suit the needs
- * of this project.
+ * of this project. A single curl handle is kept for the process so
+ * the connection to nzbget is reused between calls.
  */
 
 #define _XOPEN_SOURCE
@@ -12,6 +13,7 @@
 #include <string.h>
 #include <curl/curl.h>
 #include <errno.h>
+#include <pthread.h>
 
 #include <libxml/parser.h>
 #include <libxml/tree.h>
@@ -28,26 +30,144 @@
 #define USENET_XMLRPC_HEADER1 "Content-Type: text/xml"
 #define USENET_XMLRPC_HEADER2 "Content-length: %i"
 #define USENET_XMLRPC_CURL_TIMEOUT 5L
+#define USENET_XMLRPC_MULTICALL "system.multicall"
+#define USENET_XMLRPC_INT_SZ 16
+#define USENET_XMLRPC_NAME_SZ 64
+#define USENET_XMLRPC_LIST_SZ 16
+#define USENET_XMLRPC_VALUE_SZ 256
 
 
-/* buffer to hold the data returned from the server */
-struct uxmlrpc_buffer
+/*
+ * State of the sax handlers. Entries of a list are the structs opened at
+ * list_level arrays deep, members of nested structs and arrays are skipped.
+ */
+struct uxmlrpc_sax_state
 {
-	char* _buffer;
-	size_t _size;
+	xmlParserCtxtPtr _ctxt;
+	int _multi_flg;													/* the response of a multicall */
+	int _fault_flg;													/* the whole call failed */
+	int _err_flg;													/* out of memory */
+	int _list_level;
+	int _arrays;													/* open arrays */
+	int _structs;													/* open structs */
+	int _call_ix;													/* multicall result being read */
+	int _name_flg;
+	int _value_flg;
+	int _got_value;
+
+	char _name[USENET_XMLRPC_NAME_SZ];
+	size_t _name_len;
+	char* _value;
+	size_t _value_len;
+	size_t _value_sz;
+
+	struct usenet_uxmlrpc_result* _res;
+	size_t _num_res;
+	size_t _list_sz;												/* entries allocated in the current list */
 };
 
+static pthread_once_t _uxmlrpc_once = PTHREAD_ONCE_INIT;
+static pthread_mutex_t _uxmlrpc_mutex = PTHREAD_MUTEX_INITIALIZER;
+static CURL* _uxmlrpc_curl = NULL;									/* kept open between calls */
+
+/* curl global state is initialised once for the process */
+static void _uxmlrpc_global_init(void);
+
+/* create the shared handle if it's not open, called with the mutex held */
+static int _uxmlrpc_open(void);
+
+/* send the request document */
+static int _uxmlrpc_perform(const char* method_name, xmlDocPtr req_xmldoc, curl_write_callback write_fn, void* userp);
+
 /* Helper method for constructing a xmldocument with parameters */
 static int _create_xml_para(const char* method, char** paras, size_t size, xmlDocPtr* xmldoc);
 
-/* parse the buffer into a xmldoc */
-static int _parse_xml_char(struct uxmlrpc_buffer* rpc_buff, xmlDocPtr* xmldoc);
+/* build the system.multicall request of the calls */
+static int _create_xml_multicall(struct usenet_uxmlrpc_call* calls, size_t num, xmlDocPtr* xmldoc);
+static void _add_xml_call_para(xmlNodePtr data_node, struct usenet_uxmlrpc_call* call, size_t ix);
+
+/* post the request and read the results with the sax handlers */
+static int _uxmlrpc_stream(const char* method_name, xmlDocPtr req_xmldoc, int multi_flg, struct usenet_uxmlrpc_result* res, size_t num);
+static size_t _write_sax_callback(char* contents, size_t size, size_t nmemb, void* userp);
+static void _sax_start(void* ctx,
+					   const xmlChar* localname,
+					   const xmlChar* prefix,
+					   const xmlChar* uri,
+					   int nb_namespaces,
+					   const xmlChar** namespaces,
+					   int nb_attributes,
+					   int nb_defaulted,
+					   const xmlChar** attributes);
+static void _sax_end(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* uri);
+static void _sax_characters(void* ctx, const xmlChar* ch, int len);
+static void _sax_clear_value(struct uxmlrpc_sax_state* state);
+static struct usenet_uxmlrpc_result* _sax_result(struct uxmlrpc_sax_state* state);
+
+/*
+ * Call a method returning an array of structs, the entries are read into
+ * the list of the result as the response arrives without building a tree.
+ */
+int usenet_uxmlrpc_call_list(const char* method_name, char** paras, size_t size, struct usenet_uxmlrpc_result* res)
+{
+	int _ret = USENET_SUCCESS;
+	xmlDocPtr _req_xmldoc = NULL;
+
+	if(res == NULL)
+		return USENET_ARG_ERROR;
+
+	if(_create_xml_para(method_name, paras, size, &_req_xmldoc) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	_ret = _uxmlrpc_stream(method_name, _req_xmldoc, 0, res, 1);
+
+	xmlFreeDoc(_req_xmldoc);
+	return _ret;
+}
+
+/*
+ * Send the calls in one system.multicall request. The result of each
+ * call is read into res, in the order of the calls, as the response
+ * arrives.
+ */
+int usenet_uxmlrpc_multicall(struct usenet_uxmlrpc_call* calls, size_t num, struct usenet_uxmlrpc_result* res)
+{
+	int _ret = USENET_SUCCESS;
+	xmlDocPtr _req_xmldoc = NULL;
+
+	if(calls == NULL || num == 0 || res == NULL)
+		return USENET_ARG_ERROR;
+
+	if(_create_xml_multicall(calls, num, &_req_xmldoc) != USENET_SUCCESS)
+		return USENET_ERROR;
+
+	_ret = _uxmlrpc_stream(USENET_XMLRPC_MULTICALL, _req_xmldoc, 1, res, num);
+
+	xmlFreeDoc(_req_xmldoc);
+	return _ret;
+}
+
+/* free the lists of the results */
+void usenet_uxmlrpc_free_results(struct usenet_uxmlrpc_result* res, size_t num)
+{
+	size_t _i = 0, _j = 0;
+
+	if(res == NULL)
+		return;
+
+	for(_i = 0; _i < num; _i++) {
+		for(_j = 0; _j < res[_i]._num; _j++) {
+			USENET_FILELIST_FREE(&res[_i]._list[_j]);
+		}
+		if(res[_i]._list)
+			free(res[_i]._list);
 
-/* callback for loading the return contents from the curl */
-static unsigned int _write_content_callback(void* contents, size_t size, size_t nmemb, void* userp);
+		res[_i]._list = NULL;
+		res[_i]._num = 0;
+	}
+}
 
-/* main rpc call */
-int usenet_uxmlrpc_call(const char* method_name, char** paras, size_t size, xmlDocPtr* res)
+/* post the request, the response is passed to the write function as it arrives */
+static int _uxmlrpc_perform(const char* method_name, xmlDocPtr req_xmldoc, curl_write_callback write_fn, void* userp)
 {
 	int _stat = CURLE_OK, _ret = USENET_SUCCESS;
 	int _xml_sz = 0;												/* size of the serailsie xml data */
@@ -57,204 +177,128 @@ int usenet_uxmlrpc_call(const char* method_name, char** paras, size_t size, xmlD
 
 	CURL* _curl = NULL;
 	struct curl_slist* _hlist = NULL;								/* header lsit for rpc call */
-	xmlDocPtr _req_xmldoc = NULL;
-
-	struct uxmlrpc_buffer _cbuf;									/* content buffer */
-
-	/* Create xml parameter */
-	if(_create_xml_para(method_name, paras, size, &_req_xmldoc) != USENET_SUCCESS)
-		return USENET_ERROR;
 
 	/* serialise the xml and get the size */
-	xmlDocDumpFormatMemory(_req_xmldoc, &_xml_mem, &_xml_sz, 0);
+	xmlDocDumpFormatMemory(req_xmldoc, &_xml_mem, &_xml_sz, 0);
 
 	sprintf(_hbuf, USENET_XMLRPC_HEADER2, _xml_sz);
 
-	/* initialise the content buffer */
-	_cbuf._buffer = (char*) malloc(sizeof(char));
-	_cbuf._size = 0;
-
-	curl_global_init(CURL_GLOBAL_ALL);
-
-	/* initialise curl */
-	USENET_LOG_MESSAGE_ARGS("initialising curl for the rpc call: %s", method_name);
-	_curl = curl_easy_init();
-	if(_curl == NULL) {
-		USENET_LOG_MESSAGE("failed to initialise curl for rpc call");
-		curl_global_cleanup();
+	/* the handle is shared by the threads calling nzbget */
+	pthread_mutex_lock(&_uxmlrpc_mutex);
+	if(_uxmlrpc_open() != USENET_SUCCESS) {
+		pthread_mutex_unlock(&_uxmlrpc_mutex);
+		xmlFree(_xml_mem);
 		return USENET_ERROR;
 	}
+	_curl = _uxmlrpc_curl;
 
 	/* setup headers */
 	USENET_LOG_MESSAGE("setting up headers");
 	_hlist = curl_slist_append(_hlist, USENET_XMLRPC_HEADER1);
 	_hlist = curl_slist_append(_hlist, _hbuf);
 
-	/* set http basic authentication */
-	curl_easy_setopt(_curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-	curl_easy_setopt(_curl, CURLOPT_USERPWD, USENET_XMLRPC_USERNAME_PASS);
-
-	/*
-	 * Set curl options for url, writing data, callback and
-	 * and header list.
-	 */
-	curl_easy_setopt(_curl, CURLOPT_POST, 1L);
-	curl_easy_setopt(_curl, CURLOPT_URL, USENET_XMLRPC_SERVER_URL);
-	curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, _hlist);
-	curl_easy_setopt(_curl, CURLOPT_USERAGENT, USENET_XMLRPC_USERAGENT);
-	curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, _write_content_callback);
-
-	/* set time out */
-	curl_easy_setopt(_curl, CURLOPT_TIMEOUT, USENET_XMLRPC_CURL_TIMEOUT);
-
 	/* set post fields */
+	curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, _hlist);
 	curl_easy_setopt(_curl, CURLOPT_POSTFIELDS, (char*) _xml_mem);
-
-
-	curl_easy_setopt(_curl, CURLOPT_WRITEDATA, &_cbuf);
+	curl_easy_setopt(_curl, CURLOPT_WRITEFUNCTION, write_fn);
+	curl_easy_setopt(_curl, CURLOPT_WRITEDATA, userp);
 
 	/* post the action */
 	USENET_LOG_MESSAGE_ARGS("performing curl operation on method: %s", method_name);
 	_stat = curl_easy_perform(_curl);
 
+	/* the buffers are released below, don't leave them on the handle */
+	curl_easy_setopt(_curl, CURLOPT_HTTPHEADER, NULL);
+	curl_easy_setopt(_curl, CURLOPT_POSTFIELDS, NULL);
+	curl_easy_setopt(_curl, CURLOPT_WRITEDATA, NULL);
+	pthread_mutex_unlock(&_uxmlrpc_mutex);
+
 	if(_stat != CURLE_OK) {
-		USENET_LOG_MESSAGE("rpc call was not successful, therefore no parsed xml document is available");
+		USENET_LOG_MESSAGE_ARGS("rpc call was not successful, %s", curl_easy_strerror((CURLcode) _stat));
 		_ret = USENET_ERROR;
 	}
-	else {
-		/* since the call is sucessfull parse the document and send back to the caller */
+	else
 		USENET_LOG_MESSAGE_ARGS("rpc call %s, was successful", method_name);
-		_parse_xml_char(&_cbuf, res);
-	}
 
-	/* free content buffer */
-	USENET_LOG_MESSAGE("cleaning up used memory");
-	if(_cbuf._size > 0 || _cbuf._buffer != NULL) {
-		free(_cbuf._buffer);
-		_cbuf._buffer = NULL;
-		_cbuf._size = 0;
-	}
 	if(_hlist)
 		curl_slist_free_all(_hlist);
 
-	if(_req_xmldoc)
-		xmlFreeDoc(_req_xmldoc);
-
-	USENET_LOG_MESSAGE("cleaning up curl after rpc call");
-	curl_easy_cleanup(_curl);
-
 	if(_xml_mem)
 		xmlFree(_xml_mem);
 
 	return _ret;
 }
 
-int usenet_uxmlrpc_get_node_count(xmlNodePtr root_node, const char* key, int* count, xmlNodePtr* node)
+/* Open the connection handle up front, safe to call more than once */
+int usenet_uxmlrpc_init(void)
 {
-	int _val_flg = 0;
-	xmlNodePtr _child_node = NULL;
-
-	/* find the value node */
-	_child_node = xmlFirstElementChild(root_node);
-	do {
-
-		/* check for value */
-		/* set val flag to true and find get the value node */
-		if(strcmp((char*) _child_node->name, key) == 0)
-			_val_flg += 1;
-
-		/* break out of the loop */
-		if(_val_flg > 1)
-			break;
+	int _ret = USENET_SUCCESS;
 
-		_child_node = xmlFirstElementChild(_child_node);
+	pthread_mutex_lock(&_uxmlrpc_mutex);
+	_ret = _uxmlrpc_open();
+	pthread_mutex_unlock(&_uxmlrpc_mutex);
 
-	}while(_child_node != NULL);
-
-
-	*node = _child_node;
+	return _ret;
+}
 
-	/* get count */
-	while(_child_node) {
-		(*count) += 1;
-		_child_node = xmlNextElementSibling(_child_node);
+/* close the connection and release the handle */
+int usenet_uxmlrpc_cleanup(void)
+{
+	pthread_mutex_lock(&_uxmlrpc_mutex);
+	if(_uxmlrpc_curl) {
+		USENET_LOG_MESSAGE("cleaning up curl");
+		curl_easy_cleanup(_uxmlrpc_curl);
 	}
+	_uxmlrpc_curl = NULL;
+	pthread_mutex_unlock(&_uxmlrpc_mutex);
 
 	return USENET_SUCCESS;
 }
 
-int usenet_uxmlrpc_get_member(xmlNodePtr member_node, const char* name, char** value)
+static void _uxmlrpc_global_init(void)
 {
-	xmlNodePtr _child_node = NULL;
-	xmlChar* _name_val = NULL;
-
-	/* initialise to NULL */
-	*value = NULL;
-
-	if(strcmp((char*) member_node->name, "member") != 0) {
-		USENET_LOG_MESSAGE("node is not a member");
-		return USENET_ERROR;
-	}
+	curl_global_init(CURL_GLOBAL_ALL);
+	xmlInitParser();
+}
 
-	_child_node = xmlFirstElementChild(member_node);
-	if(_child_node == NULL)
-		return USENET_ERROR;
+/*
+ * Create the curl handle used for every call, the options which don't
+ * change between calls are set here.
+ */
+static int _uxmlrpc_open(void)
+{
+	pthread_once(&_uxmlrpc_once, _uxmlrpc_global_init);
 
-	if(strcmp((char*) _child_node->name, "name") != 0)
-		return USENET_ERROR;
+	if(_uxmlrpc_curl)
+		return USENET_SUCCESS;
 
-	/* if the element is the name, compare the field */
-	_name_val = xmlNodeGetContent(_child_node);
-	if(_name_val == NULL)
+	USENET_LOG_MESSAGE("initialising curl for the rpc calls");
+	_uxmlrpc_curl = curl_easy_init();
+	if(_uxmlrpc_curl == NULL) {
+		USENET_LOG_MESSAGE("failed to initialise curl for rpc call");
 		return USENET_ERROR;
+	}
 
-	/* if the name doesn't match clean up and exit */
-	if(strcmp((char*) _name_val, name) != 0)
-		goto cleanup;
-
-	/* get the next sibling */
-	if(!(_child_node = xmlNextElementSibling(_child_node)) &&
-	   strcmp((char*) _child_node->name, USENET_NZBGET_XMLRESPONSE_VALUE))
-		goto cleanup;
-
-	_child_node = xmlFirstElementChild(_child_node);
-	if(!_child_node)
-		goto cleanup;
+	/* set http basic authentication */
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_USERPWD, USENET_XMLRPC_USERNAME_PASS);
 
-	/* get the contents of field */
-	*value = (char*) xmlNodeGetContent(_child_node);
+	/*
+	 * Set curl options for url and time out, the write callback
+	 * is set by each call.
+	 */
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_POST, 1L);
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_URL, USENET_XMLRPC_SERVER_URL);
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_USERAGENT, USENET_XMLRPC_USERAGENT);
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_TIMEOUT, USENET_XMLRPC_CURL_TIMEOUT);
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_NOSIGNAL, 1L);
 
-cleanup:
-	if(_name_val)
-		xmlFree(_name_val);
+	/* keep the connection to nzbget open between the polls */
+	curl_easy_setopt(_uxmlrpc_curl, CURLOPT_TCP_KEEPALIVE, 1L);
 
 	return USENET_SUCCESS;
 }
 
-static unsigned int _write_content_callback(void* contents, size_t size, size_t nmemb, void* userp)
-{
-    size_t _act_size = size * nmemb;
-
-    /* cast user pointer */
-    struct uxmlrpc_buffer* _content = (struct uxmlrpc_buffer*) userp;
-
-    /* reallocate memory */
-    _content->_buffer = realloc(_content->_buffer, _content->_size + _act_size + 1);
-    if(_content->_buffer == NULL)
-	{
-	    /* failure allocating memory bail here */
-	    USENET_LOG_MESSAGE("Unable to allocate content memory..");
-	    return 0;
-	}
-
-    /* copy content into the buffer */
-    memcpy(&_content->_buffer[_content->_size], contents, _act_size);
-    _content->_size += _act_size;
-    _content->_buffer[_content->_size] = 0;
-
-    return _act_size;
-}
-
 static int _create_xml_para(const char* method, char** paras, size_t size, xmlDocPtr* xmldoc)
 {
 	size_t _i = 0;
@@ -292,20 +336,328 @@ static int _create_xml_para(const char* method, char** paras, size_t size, xmlDo
 
 }
 
-/* parse the memory into a xml document */
-static int _parse_xml_char(struct uxmlrpc_buffer* rpc_buff, xmlDocPtr* xmldoc)
+static int _create_xml_multicall(struct usenet_uxmlrpc_call* calls, size_t num, xmlDocPtr* xmldoc)
 {
-	/* initialise the parser */
-	xmlInitParser();
+	size_t _i = 0, _j = 0;
+	xmlNodePtr _root_node = NULL;
+	xmlNodePtr _data_node = NULL;
+	xmlNodePtr _struct_node = NULL;
+	xmlNodePtr _member_node = NULL;
+	xmlNodePtr _call_data_node = NULL;
 
-	*xmldoc = xmlReadMemory(rpc_buff->_buffer,
-							rpc_buff->_size,
-							"rpc_method.xml",
-							NULL,
-							XML_PARSE_RECOVER | XML_PARSE_HUGE);
+	*xmldoc = xmlNewDoc(BAD_CAST "1.0");
 
-	/* clean up the global memory consumed internally */
-	xmlCleanupParser();
+	_root_node = xmlNewNode(NULL, BAD_CAST "methodCall");
+	xmlDocSetRootElement(*xmldoc, _root_node);
+	xmlNewChild(_root_node, NULL, BAD_CAST "methodName", BAD_CAST USENET_XMLRPC_MULTICALL);
+
+	/* the only parameter is an array of the calls */
+	_data_node = xmlNewChild(_root_node, NULL, BAD_CAST "params", NULL);
+	_data_node = xmlNewChild(_data_node, NULL, BAD_CAST "param", NULL);
+	_data_node = xmlNewChild(_data_node, NULL, BAD_CAST "value", NULL);
+	_data_node = xmlNewChild(_data_node, NULL, BAD_CAST "array", NULL);
+	_data_node = xmlNewChild(_data_node, NULL, BAD_CAST "data", NULL);
+
+	/* each call is a struct of methodName and params */
+	for(_i = 0; _i < num; _i++) {
+		if(calls[_i]._method == NULL) {
+			USENET_LOG_MESSAGE("multicall method not set");
+			xmlFreeDoc(*xmldoc);
+			*xmldoc = NULL;
+			return USENET_ERROR;
+		}
+
+		_struct_node = xmlNewChild(_data_node, NULL, BAD_CAST "value", NULL);
+		_struct_node = xmlNewChild(_struct_node, NULL, BAD_CAST "struct", NULL);
+
+		_member_node = xmlNewChild(_struct_node, NULL, BAD_CAST "member", NULL);
+		xmlNewChild(_member_node, NULL, BAD_CAST "name", BAD_CAST "methodName");
+		xmlNewTextChild(xmlNewChild(_member_node, NULL, BAD_CAST "value", NULL), NULL, BAD_CAST "string", BAD_CAST calls[_i]._method);
+
+		_member_node = xmlNewChild(_struct_node, NULL, BAD_CAST "member", NULL);
+		xmlNewChild(_member_node, NULL, BAD_CAST "name", BAD_CAST "params");
+		_call_data_node = xmlNewChild(_member_node, NULL, BAD_CAST "value", NULL);
+		_call_data_node = xmlNewChild(_call_data_node, NULL, BAD_CAST "array", NULL);
+		_call_data_node = xmlNewChild(_call_data_node, NULL, BAD_CAST "data", NULL);
+
+		for(_j = 0; calls[_i]._types && calls[_i]._types[_j]; _j++)
+			_add_xml_call_para(_call_data_node, &calls[_i], _j);
+	}
 
 	return USENET_SUCCESS;
 }
+
+/* add parameter ix of the call, the type is the character at ix of the types */
+static void _add_xml_call_para(xmlNodePtr data_node, struct usenet_uxmlrpc_call* call, size_t ix)
+{
+	size_t _i = 0;
+	char _ibuf[USENET_XMLRPC_INT_SZ] = {0};
+	xmlNodePtr _value_node = NULL;
+
+	_value_node = xmlNewChild(data_node, NULL, BAD_CAST "value", NULL);
+
+	switch(call->_types[ix]) {
+	case 'i':
+		xmlNewTextChild(_value_node, NULL, BAD_CAST "i4", BAD_CAST call->_paras[ix]);
+		break;
+	case 'b':
+		xmlNewTextChild(_value_node, NULL, BAD_CAST "boolean", BAD_CAST call->_paras[ix]);
+		break;
+	case 'A':
+		_value_node = xmlNewChild(_value_node, NULL, BAD_CAST "array", NULL);
+		_value_node = xmlNewChild(_value_node, NULL, BAD_CAST "data", NULL);
+		for(_i = 0; _i < call->_num_ints; _i++) {
+			snprintf(_ibuf, sizeof(_ibuf), "%i", call->_ints[_i]);
+			xmlNewTextChild(xmlNewChild(_value_node, NULL, BAD_CAST "value", NULL), NULL, BAD_CAST "i4", BAD_CAST _ibuf);
+		}
+		break;
+	default:
+		/* a value without a type is a string, same as usenet_uxmlrpc_call */
+		xmlNodeAddContent(_value_node, BAD_CAST call->_paras[ix]);
+		break;
+	}
+}
+
+/* post the request and read the results with the sax handlers */
+static int _uxmlrpc_stream(const char* method_name, xmlDocPtr req_xmldoc, int multi_flg, struct usenet_uxmlrpc_result* res, size_t num)
+{
+	int _ret = USENET_SUCCESS;
+	size_t _i = 0;
+	xmlSAXHandler _handler;
+	struct uxmlrpc_sax_state _state;
+
+	memset(&_handler, 0, sizeof(xmlSAXHandler));
+	_handler.initialized = XML_SAX2_MAGIC;
+	_handler.startElementNs = _sax_start;
+	_handler.endElementNs = _sax_end;
+	_handler.characters = _sax_characters;
+
+	memset(&_state, 0, sizeof(struct uxmlrpc_sax_state));
+	_state._multi_flg = multi_flg;
+	_state._list_level = multi_flg ? 3 : 1;							/* results, the call and the list */
+	_state._call_ix = -1;
+	_state._res = res;
+	_state._num_res = num;
+
+	for(_i = 0; _i < num; _i++) {
+		memset(&res[_i], 0, sizeof(struct usenet_uxmlrpc_result));
+		res[_i]._ok = multi_flg ? USENET_ERROR : USENET_SUCCESS;
+	}
+
+	_state._ctxt = xmlCreatePushParserCtxt(&_handler, &_state, NULL, 0, "rpc_method.xml");
+	if(_state._ctxt == NULL)
+		return USENET_ERROR;
+	xmlCtxtUseOptions(_state._ctxt, XML_PARSE_RECOVER | XML_PARSE_NONET);
+
+	_ret = _uxmlrpc_perform(method_name, req_xmldoc, _write_sax_callback, &_state);
+	if(_ret == USENET_SUCCESS)
+		xmlParseChunk(_state._ctxt, NULL, 0, 1);
+
+	if(_ret != USENET_SUCCESS || _state._fault_flg || _state._err_flg) {
+		USENET_LOG_MESSAGE_ARGS("unable to read the response of %s", method_name);
+		usenet_uxmlrpc_free_results(res, num);
+		for(_i = 0; _i < num; _i++)
+			res[_i]._ok = USENET_ERROR;
+		_ret = USENET_ERROR;
+	}
+
+	xmlFreeParserCtxt(_state._ctxt);
+	if(_state._value)
+		free(_state._value);
+
+	return _ret;
+}
+
+/* the response is parsed chunk by chunk, nothing is kept after the handlers run */
+static size_t _write_sax_callback(char* contents, size_t size, size_t nmemb, void* userp)
+{
+	struct uxmlrpc_sax_state* _state = (struct uxmlrpc_sax_state*) userp;
+
+	if(_state->_err_flg)
+		return 0;
+
+	xmlParseChunk(_state->_ctxt, contents, (int) (size * nmemb), 0);
+	return size * nmemb;
+}
+
+static void _sax_start(void* ctx,
+					   const xmlChar* localname,
+					   const xmlChar* prefix,
+					   const xmlChar* uri,
+					   int nb_namespaces,
+					   const xmlChar** namespaces,
+					   int nb_attributes,
+					   int nb_defaulted,
+					   const xmlChar** attributes)
+{
+	struct uxmlrpc_sax_state* _state = (struct uxmlrpc_sax_state*) ctx;
+	struct usenet_uxmlrpc_result* _res = NULL;
+	struct usenet_nzb_filellist* _list = NULL;
+	const char* _name = (const char*) localname;
+
+	/* a value holds one typed element, the text before it is dropped */
+	if(_state->_value_flg)
+		_sax_clear_value(_state);
+
+	if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_ARRAY) == 0) {
+		_state->_value_flg = 0;
+		_state->_arrays++;
+
+		/* a call that succeeded returns its value in an array of one */
+		if(_state->_multi_flg && _state->_arrays == 2 && _state->_structs == 0) {
+			_state->_call_ix++;
+			if((_res = _sax_result(_state)) != NULL)
+				_res->_ok = USENET_SUCCESS;
+		}
+	}
+	else if(strcmp(_name, "struct") == 0) {
+		_state->_value_flg = 0;
+
+		/* a call that failed returns a fault struct in place of the array */
+		if(_state->_multi_flg && _state->_arrays == 1 && _state->_structs == 0)
+			_state->_call_ix++;
+
+		_state->_structs++;
+		if(_state->_structs != 1 || _state->_arrays != _state->_list_level || _state->_fault_flg)
+			return;
+
+		/* start an entry of the list */
+		if((_res = _sax_result(_state)) == NULL)
+			return;
+
+		if(_res->_num == _state->_list_sz) {
+			_list = (struct usenet_nzb_filellist*) realloc(_res->_list,
+														   (_state->_list_sz + USENET_XMLRPC_LIST_SZ) * sizeof(struct usenet_nzb_filellist));
+			if(_list == NULL) {
+				_state->_err_flg = 1;
+				xmlStopParser(_state->_ctxt);
+				return;
+			}
+			_res->_list = _list;
+			_state->_list_sz += USENET_XMLRPC_LIST_SZ;
+		}
+
+		USENET_NZBGET_INIT_LIST(&_res->_list[_res->_num]);
+		_res->_num++;
+	}
+	else if(strcmp(_name, "fault") == 0)
+		_state->_fault_flg = 1;
+	else if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_NAME) == 0) {
+		if(_state->_structs == 1 && _state->_arrays == _state->_list_level) {
+			_state->_name_flg = 1;
+			_state->_name_len = 0;
+		}
+	}
+	else if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_VALUE) == 0) {
+
+		/* the value of an entry member or the value a call returned */
+		if((_state->_structs == 1 && _state->_arrays == _state->_list_level && _state->_name_len > 0) ||
+		   (_state->_multi_flg && _state->_structs == 0 && _state->_arrays == 2)) {
+			_state->_value_flg = 1;
+			_sax_clear_value(_state);
+		}
+	}
+}
+
+static void _sax_end(void* ctx, const xmlChar* localname, const xmlChar* prefix, const xmlChar* uri)
+{
+	struct uxmlrpc_sax_state* _state = (struct uxmlrpc_sax_state*) ctx;
+	struct usenet_uxmlrpc_result* _res = NULL;
+	const char* _name = (const char*) localname;
+
+	if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_ARRAY) == 0) {
+		_state->_arrays--;
+
+		/* the list of a multicall result is done, the next starts empty */
+		if(_state->_arrays == _state->_list_level - 1 && _state->_structs == 0)
+			_state->_list_sz = 0;
+	}
+	else if(strcmp(_name, "struct") == 0)
+		_state->_structs--;
+	else if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_NAME) == 0)
+		_state->_name_flg = 0;
+	else if(strcmp(_name, USENET_NZBGET_XMLRESPONSE_MEMBER) == 0) {
+		if(_state->_structs == 1 &&
+		   _state->_arrays == _state->_list_level &&
+		   _state->_got_value &&
+		   (_res = _sax_result(_state)) != NULL &&
+		   _res->_num > 0) {
+			_state->_name[_state->_name_len] = '\0';
+			usenet_nzb_set_field(&_res->_list[_res->_num - 1], _state->_name, (_state->_value ? _state->_value : ""));
+		}
+
+		_state->_name_len = 0;
+		_state->_got_value = 0;
+	}
+	else if(_state->_value_flg) {
+
+		/* end of the typed element or of a value without a type */
+		_state->_value_flg = 0;
+		_state->_got_value = 1;
+
+		/* a scalar returned by a call, the boolean of editqueue and scan */
+		if(_state->_multi_flg && _state->_structs == 0 && _state->_arrays == 2 && (_res = _sax_result(_state)) != NULL)
+			_res->_bool = (_state->_value && (_state->_value[0] == '1' || _state->_value[0] == 't'));
+	}
+}
+
+static void _sax_characters(void* ctx, const xmlChar* ch, int len)
+{
+	char* _value = NULL;
+	size_t _sz = 0;
+	struct uxmlrpc_sax_state* _state = (struct uxmlrpc_sax_state*) ctx;
+
+	/* member names are short, a longer name is not one of ours */
+	if(_state->_name_flg) {
+		_sz = (size_t) len;
+		if(_state->_name_len + _sz >= USENET_XMLRPC_NAME_SZ)
+			_sz = USENET_XMLRPC_NAME_SZ - 1 - _state->_name_len;
+		memcpy(_state->_name + _state->_name_len, ch, _sz);
+		_state->_name_len += _sz;
+		return;
+	}
+
+	if(!_state->_value_flg)
+		return;
+
+	/* the value buffer is reused for every member */
+	if(_state->_value_len + (size_t) len + 1 > _state->_value_sz) {
+		_sz = _state->_value_sz > 0 ? _state->_value_sz : USENET_XMLRPC_VALUE_SZ;
+		while(_sz < _state->_value_len + (size_t) len + 1)
+			_sz *= 2;
+
+		_value = (char*) realloc(_state->_value, _sz);
+		if(_value == NULL) {
+			_state->_err_flg = 1;
+			xmlStopParser(_state->_ctxt);
+			return;
+		}
+		_state->_value = _value;
+		_state->_value_sz = _sz;
+	}
+
+	memcpy(_state->_value + _state->_value_len, ch, (size_t) len);
+	_state->_value_len += (size_t) len;
+	_state->_value[_state->_value_len] = '\0';
+}
+
+/* an empty value has no text */
+static void _sax_clear_value(struct uxmlrpc_sax_state* state)
+{
+	state->_value_len = 0;
+	if(state->_value)
+		state->_value[0] = '\0';
+}
+
+/* result being read, the only one of a plain call */
+static struct usenet_uxmlrpc_result* _sax_result(struct uxmlrpc_sax_state* state)
+{
+	if(!state->_multi_flg)
+		return &state->_res[0];
+
+	if(state->_call_ix < 0 || (size_t) state->_call_ix >= state->_num_res)
+		return NULL;
+
+	return &state->_res[state->_call_ix];
+}
+